@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
+#include "AstSimplifier.h"
+#include "Benchmark.h"
+#include "BytecodeOptimizer.h"
+#include "compiler.h"
+#include "Interpreter.h"
+#include "Parser.h"
+
+// Checks that a warmed up `Interpreter::runMain` doesn't touch the heap: frames, operands and
+// calls all live in memory reserved by earlier runs. Every allocation of this process goes
+// through the counting `operator new` below. Run by `ctest`, exits with 1 on failure.
+
+namespace
+{
+    std::atomic<size_t> allocations = 0;
+
+    void* allocate(size_t size, size_t alignment) {
+        ++allocations;
+        void* memory = alignment > alignof(std::max_align_t)
+                           ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                           : std::malloc(size ? size : 1);
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+
+    // Allocations made by `runs` runs of `main` after two warm-up runs
+    size_t allocationsAfterWarmUp(Interpreter& interpreter, int runs, ExecutionResult& outResult) {
+        // The first runs grow the stacks and give the JIT its hot functions
+        interpreter.runMain();
+        interpreter.runMain();
+
+        const size_t before = allocations;
+        for (int i = 0; i < runs; ++i) {
+            outResult = interpreter.runMain();
+        }
+        return allocations - before;
+    }
+}
+
+void* operator new(size_t size) { return allocate(size, alignof(std::max_align_t)); }
+void* operator new[](size_t size) { return allocate(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+
+int main() {
+    constexpr std::string_view Scripts[] = {"locals arithmetic", "tail-call loop"};
+
+    bool passed = true;
+    for (const auto& script : benchmarkScripts()) {
+        if (std::find(std::begin(Scripts), std::end(Scripts), script.name) == std::end(Scripts)) {
+            continue;
+        }
+
+        Shared<ProgramNode> program = std::make_shared<Parser>(std::make_shared<Lexer>(script.code))->parse();
+        AstSimplifier().simplify(program);
+        Compiler compiler;
+        compiler.compileProgram(program);
+        BytecodeOptimizer().optimize(compiler.instructions, *compiler.functionTable);
+
+        for (const bool useJit : {false, true}) {
+            Interpreter interpreter(compiler);
+            if (!useJit) {
+                interpreter.jit.reset();
+            }
+
+            ExecutionResult result;
+            const size_t count = allocationsAfterWarmUp(interpreter, 3, result);
+            const bool ok = result.ok() && count == 0;
+            passed &= ok;
+            std::cout << (ok ? "ok   " : "FAIL ") << script.name << (useJit ? " (jit)" : "") << ": "
+                << count << " allocations";
+            if (!result.ok()) {
+                std::cout << ", error: " << result.error;
+            }
+            std::cout << std::endl;
+        }
+    }
+    return passed ? 0 : 1;
+}
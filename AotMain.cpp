@@ -0,0 +1,25 @@
+#include "AotRuntime.h"
+
+// Defined by the C++ that `ScriptingLang --emit-cpp` translated the script to
+namespace script
+{
+    ExecutionResult runMain();
+}
+
+// Host of a script translated ahead of time, see `add_scripting_lang_aot` in CMakeLists.txt.
+// Reports like `Interpreter::execute`.
+int main() {
+    const ExecutionResult result = script::runMain();
+    if (!result.ok()) {
+        std::cerr << "Runtime error: " << result.error << std::endl;
+        return 1;
+    }
+
+    std::cout << "Execution complete." << std::endl;
+    if (result.value.type != ValueType::None) {
+        std::cout << "Return value of main: " << result.value << std::endl;
+    } else {
+        std::cout << "No return value." << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include "AotRuntime.h"
+
+#if __has_include(<pthread.h>)
+#include <pthread.h>
+#define AOT_NATIVE_STACK 1
+#else
+#define AOT_NATIVE_STACK 0
+#endif
+
+#include "Interpreter.h"
+
+namespace
+{
+    // Stack the calling thread is assumed to have left when a run can't get one of its own
+    constexpr size_t CallerStackSize = 512 * 1024;
+
+    uintptr_t stackPointer() {
+        volatile char marker = 0;
+        return reinterpret_cast<uintptr_t>(&marker);
+    }
+}
+
+AotContext::AotContext():
+    globals(std::make_shared<SymbolTable>()) {
+    segments.emplace_back();
+
+    heapRoots = ObjectHeap::addRoots([this] {
+        for (size_t i = 0; i <= currentSegment; ++i) {
+            for (size_t slot = 0; slot < segments[i].used; ++slot) {
+                ObjectHeap::mark(segments[i].values[slot]);
+            }
+        }
+        for (const auto& value : tailArgs) {
+            ObjectHeap::mark(value);
+        }
+        for (const auto& [name, value] : globals->values()) {
+            ObjectHeap::mark(value);
+        }
+    });
+}
+
+AotContext::~AotContext() {
+    ObjectHeap::removeRoots(heapRoots);
+}
+
+AotContext::Frame::Frame(AotContext& context, uint32_t size, const char* function): slots(nullptr), context(context), size(size) {
+    // Calls are the collector's safepoints, every live value is in a frame or a global
+    ObjectHeap::safepoint();
+
+    const bool nextSegment = context.segments[context.currentSegment].used + size > SegmentSize;
+    // Same value limit as the interpreter, the native stack is sized to reach it first
+    const bool valuesLeft = !nextSegment || (context.currentSegment + 2) * SegmentSize <= Interpreter::MaxValueStackSize;
+    if (!valuesLeft || stackPointer() < context.nativeStackLimit) [[unlikely]] {
+        context.error.raise(VMStatus::StackOverflow, std::string("Stack overflow calling function: ") + function);
+        context.error.function = function;
+        return;
+    }
+
+    if (nextSegment && ++context.currentSegment == context.segments.size()) {
+        context.segments.emplace_back();
+    }
+    Segment& segment = context.segments[context.currentSegment];
+    slots = segment.values.get() + segment.used;
+    segment.used += size;
+}
+
+AotContext::Frame::~Frame() {
+    if (!slots) {
+        return;
+    }
+    // Values die with the frame, like the interpreter's stack window
+    std::fill_n(slots, size, RuntimeValue());
+
+    Segment& segment = context.segments[context.currentSegment];
+    segment.used -= size;
+    if (segment.used == 0 && context.currentSegment > 0) {
+        --context.currentSegment;
+    }
+}
+
+bool AotContext::run(AotFunction function, RuntimeValue& result) {
+#if AOT_NATIVE_STACK
+    struct Run
+    {
+        AotContext* context;
+        AotFunction function;
+        RuntimeValue* result;
+        bool ok;
+    } run{this, function, &result, false};
+
+    pthread_attr_t attributes;
+    pthread_t thread;
+    bool started = pthread_attr_init(&attributes) == 0;
+    if (started) {
+        started = pthread_attr_setstacksize(&attributes, NativeStackSize) == 0 &&
+            pthread_create(&thread, &attributes, [](void* data) -> void* {
+                Run& run = *static_cast<Run*>(data);
+                run.ok = run.context->runOnThisStack(run.function, *run.result, NativeStackSize);
+                return nullptr;
+            }, &run) == 0;
+        pthread_attr_destroy(&attributes);
+    }
+    // The thread only runs while this one waits, the heaps are never used concurrently
+    if (started) {
+        pthread_join(thread, nullptr);
+        return run.ok;
+    }
+#endif
+    return runOnThisStack(function, result, CallerStackSize);
+}
+
+bool AotContext::runOnThisStack(AotFunction function, RuntimeValue& result, size_t size) {
+    nativeStackLimit = stackPointer() - size + NativeStackReserve;
+    return call(function, nullptr, result);
+}
+
+bool AotContext::binaryOp(RuntimeValue& left, ArithmeticOp op, const RuntimeValue& right) {
+    if (!Interpreter::checkOperation(error, left, op, right)) {
+        return false;
+    }
+
+    switch (op) {
+        case ArithmeticOp::ADD: left = left + right; break;
+        case ArithmeticOp::SUB: left = left - right; break;
+        case ArithmeticOp::MUL: left = left * right; break;
+        case ArithmeticOp::DIV: left = left / right; break;
+        case ArithmeticOp::MOD: left = left % right; break;
+        case ArithmeticOp::EQ: left = left == right; break;
+        case ArithmeticOp::NEQ: left = left != right; break;
+        case ArithmeticOp::LT: left = left < right; break;
+        case ArithmeticOp::LTE: left = left <= right; break;
+        case ArithmeticOp::GT: left = left > right; break;
+        case ArithmeticOp::GTE: left = left >= right; break;
+    }
+    return true;
+}
+
+bool AotContext::typeMismatch(const RuntimeValue& value, ValueType expected) {
+    return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected {}, got {}", to_string(expected), to_string(value.type)));
+}
+
+bool AotContext::checkStruct(const RuntimeValue& value, uint32_t layoutIndex) {
+    const StructLayout& expected = structLayouts[layoutIndex];
+    if (value.type != ValueType::Struct) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected {}, got {}", expected.name.str(), to_string(value.type)));
+    }
+    const StructLayout* layout = value.asStruct().layout;
+    if (layout != &expected) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch,
+                           std::format("Type mismatch: expected {}, got {}", expected.name.str(), layout ? layout->name.str() : "Struct"));
+    }
+    return true;
+}
+
+bool AotContext::loadVar(uint32_t name, RuntimeValue& out) {
+    const RuntimeValue* var = globals->resolve(names[name]);
+    if (!var) [[unlikely]] {
+        return error.raise(VMStatus::UndefinedVariable, "Undefined variable: " + names[name].str());
+    }
+    out = *var;
+    return true;
+}
+
+void AotContext::storeVar(uint32_t name, RuntimeValue&& value) {
+    globals->define(names[name], value);
+    value = RuntimeValue();
+}
+
+bool AotContext::loadField(uint32_t cache, RuntimeValue& object) {
+    uint32_t index;
+    if (!resolveField(cache, object, index)) {
+        return false;
+    }
+    RuntimeValue field = object.asStruct().fields[index];
+    object = std::move(field);
+    return true;
+}
+
+bool AotContext::storeField(uint32_t cache, RuntimeValue& value, RuntimeValue& object) {
+    uint32_t index;
+    if (!resolveField(cache, object, index)) {
+        return false;
+    }
+    // Struct typed fields only hold their declared layout, the compiler couldn't check this one
+    if (const StructLayout* fieldLayout = object.asStruct().layout->fieldLayouts[index]) {
+        uint32_t layoutIndex;
+        structLayouts.lookup(fieldLayout->name, layoutIndex);
+        if (!checkStruct(value, layoutIndex)) {
+            return false;
+        }
+    }
+
+    object.mutableStruct().fields[index] = std::move(value);
+    value = std::move(object);
+    return true;
+}
+
+bool AotContext::resolveField(uint32_t cache, const RuntimeValue& object, uint32_t& outIndex) {
+    if (object.type != ValueType::Struct) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected Struct, got {}", to_string(object.type)));
+    }
+
+    FieldCache& fieldCache = fieldCaches[cache];
+    const RuntimeStruct& fields = object.asStruct();
+    if (fieldCache.find(fields.layout, outIndex)) {
+        return true;
+    }
+
+    const InternedString& fieldName = names[fieldCache.name];
+    if (!fields.layout || !fields.layout->fieldIndex(fieldName, outIndex)) [[unlikely]] {
+        return error.raise(VMStatus::UnknownField, "Struct has no field named " + fieldName.str());
+    }
+    fieldCache.remember(fields.layout, outIndex);
+    return true;
+}
+
+bool AotContext::fault(uint32_t pc, const char* opcode, const char* function) {
+    error.opcode = opcode;
+    error.pc = pc;
+    error.function = function;
+    return false;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+
+#include "BytecodeInstructions.h"
+#include "Common.h"
+#include "StructLayout.h"
+#include "SymbolTable.h"
+#include "VMError.h"
+
+class AotContext;
+
+// A translated script function, `args` are moved into its frame before anything else happens
+using AotFunction = bool (*)(AotContext& ctx, RuntimeValue* args, RuntimeValue& result);
+
+// State of one run of a script translated to C++ by `CppTranslator`, and the operations its
+// functions can't do inline. The translated code behaves like `Interpreter` running the same
+// bytecode: same results, same faults (without the compiler site), same collector safepoints.
+//
+// Frames are windows of a segmented value stack owned by the context, so everything the
+// collector has to see stays in one place, like the interpreter's value stack. Windows never
+// move, a frame that doesn't fit in the current segment starts the next one.
+//
+// Calls between functions are native calls, so a run gets a native stack sized for recursion
+// as deep as the interpreter's, and tail calls to another function go through `call` instead
+// of nesting.
+class AotContext
+{
+public:
+    // Values per stack segment, also the largest frame that can be translated
+    static constexpr size_t SegmentSize = 64 * 1024;
+    // Native stack of a run, only the pages recursion reaches are ever committed
+    static constexpr size_t NativeStackSize = size_t(1) << 30;
+    // Native stack left for the runtime below the deepest frame
+    static constexpr size_t NativeStackReserve = 256 * 1024;
+
+    VMError error;
+    Shared<SymbolTable> globals;
+    StructLayoutTable structLayouts;
+
+    // Names used by the program (globals, fields), indexed like `BytecodeInstructionSet::names`
+    std::vector<InternedString> names;
+    std::vector<FieldCache> fieldCaches;
+
+    AotContext();
+    ~AotContext();
+
+    AotContext(const AotContext&) = delete;
+    AotContext& operator=(const AotContext&) = delete;
+
+    // A function's locals and operands for the duration of one call
+    class Frame
+    {
+    public:
+        // Null if the call would overflow the stack, with the fault raised in `context.error`
+        RuntimeValue* slots;
+
+        Frame(AotContext& context, uint32_t size, const char* function);
+        ~Frame();
+
+        Frame(const Frame&) = delete;
+        Frame& operator=(const Frame&) = delete;
+
+    private:
+        AotContext& context;
+        uint32_t size;
+    };
+
+    // Runs `function` with no arguments on a native stack of its own
+    bool run(AotFunction function, RuntimeValue& result);
+
+    // Calls `function`, then whatever tail calls it and its successors made
+    bool call(AotFunction function, RuntimeValue* args, RuntimeValue& result) {
+        while (function(*this, args, result)) {
+            if (!pendingTailCall) {
+                return true;
+            }
+            function = std::exchange(pendingTailCall, nullptr);
+            args = tailArgs.data();
+        }
+        return false;
+    }
+
+    // Makes the caller's `call` run `function` once the current function returned true, with the
+    // `arity` arguments stored in the returned array
+    RuntimeValue* tailCall(AotFunction function, uint32_t arity) {
+        if (tailArgs.size() < arity) {
+            tailArgs.resize(arity);
+        }
+        pendingTailCall = function;
+        return tailArgs.data();
+    }
+
+    // `left = left op right`, raising a fault for operands it isn't defined for
+    bool binaryOp(RuntimeValue& left, ArithmeticOp op, const RuntimeValue& right);
+
+    bool checkType(const RuntimeValue& value, ValueType expected) {
+        return value.type == expected || typeMismatch(value, expected);
+    }
+
+    bool checkStruct(const RuntimeValue& value, uint32_t layoutIndex);
+
+    bool loadVar(uint32_t name, RuntimeValue& out);
+
+    void storeVar(uint32_t name, RuntimeValue&& value);
+
+    // Replaces `object` with the field `fieldCaches[cache]` names
+    bool loadField(uint32_t cache, RuntimeValue& object);
+
+    // Sets the field `fieldCaches[cache]` names in `object` to `value`, then moves the struct to `value`'s place
+    bool storeField(uint32_t cache, RuntimeValue& value, RuntimeValue& object);
+
+    // Records where the raised fault happened, always false so callers can `return fault(...)`
+    bool fault(uint32_t pc, const char* opcode, const char* function);
+
+private:
+    struct Segment
+    {
+        std::unique_ptr<RuntimeValue[]> values = std::make_unique<RuntimeValue[]>(SegmentSize);
+        size_t used = 0;
+    };
+
+    std::vector<Segment> segments;
+    size_t currentSegment = 0;
+
+    AotFunction pendingTailCall = nullptr;
+    std::vector<RuntimeValue> tailArgs;
+
+    // Frames starting below this address would overflow the native stack
+    uintptr_t nativeStackLimit = 0;
+
+    // Id of the stack and globals as `ObjectHeap` roots
+    uint32_t heapRoots;
+
+    bool typeMismatch(const RuntimeValue& value, ValueType expected);
+
+    // Runs `function` on the current native stack, which has `size` bytes left
+    bool runOnThisStack(AotFunction function, RuntimeValue& result, size_t size);
+
+    bool resolveField(uint32_t cache, const RuntimeValue& object, uint32_t& outIndex);
+};
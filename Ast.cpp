@@ -1,5 +1,7 @@
 #include "Ast.h"
 
+#include <algorithm>
+
 // os << "\tLHS: " << (lhs ? lhs->toString(os) : "nullptr") << std::endl;
 // os << "\t{STRKEY}: "
 // if({VARNAME}) {VARNAME->toString(os)} else os << "nullptr";
@@ -95,6 +97,7 @@ std::ostream& VariableDeclarationNode::toString(std::ostream& os) const {
     os << "VariableDeclarationNode(" << name << ") {" << std::endl;
 
     NODE_TO_STRING_OPTIONAL(Type, type);
+    NODE_TO_STRING_OPTIONAL(Initializer, initializer);
 
     os << "}" << std::endl;
 
@@ -179,3 +182,70 @@ std::ostream& FunctionCallNode::toString(std::ostream& os) const {
 std::ostream& TypeReferenceNode::toString(std::ostream& os) const {
     return os << "TypeReferenceNode(name=" << typeName << ", tokenType=" << to_string(tokenType) << ")" << std::endl;
 }
+
+void countVariableReads(const Shared<AstNode>& node, std::unordered_map<std::string, size_t>& outReads) {
+    if (!node) {
+        return;
+    }
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        ++outReads[n->identifier];
+    } else if (const auto n = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+        countVariableReads(n->left, outReads);
+        countVariableReads(n->right, outReads);
+    } else if (const auto n = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+        for (auto& arg : n->arguments) {
+            countVariableReads(arg, outReads);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<MemberAccessNode>(node)) {
+        countVariableReads(n->object, outReads);
+    } else if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        for (auto& stmt : n->statements) {
+            countVariableReads(stmt, outReads);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        countVariableReads(n->condition, outReads);
+        countVariableReads(n->thenBranch, outReads);
+        countVariableReads(n->elseBranch, outReads);
+    } else if (const auto n = std::dynamic_pointer_cast<AssignmentNode>(node)) {
+        if (std::dynamic_pointer_cast<MemberAccessNode>(n->lhs)) {
+            countVariableReads(n->lhs, outReads);
+        }
+        countVariableReads(n->rhs, outReads);
+    } else if (const auto n = std::dynamic_pointer_cast<VariableDeclarationNode>(node)) {
+        countVariableReads(n->initializer, outReads);
+    } else if (const auto n = std::dynamic_pointer_cast<ReturnStatementNode>(node)) {
+        countVariableReads(n->expression, outReads);
+    }
+}
+
+void countVariableWrites(const Shared<AstNode>& node, std::unordered_map<std::string, size_t>& outWrites) {
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        for (auto& stmt : n->statements) {
+            countVariableWrites(stmt, outWrites);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        countVariableWrites(n->thenBranch, outWrites);
+        if (n->elseBranch) {
+            countVariableWrites(n->elseBranch, outWrites);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<AssignmentNode>(node)) {
+        if (const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(n->lhs)) {
+            ++outWrites[lhsVar->identifier];
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<VariableDeclarationNode>(node)) {
+        ++outWrites[n->name];
+    }
+}
+
+bool alwaysReturns(const Shared<AstNode>& node) {
+    if (std::dynamic_pointer_cast<ReturnStatementNode>(node)) {
+        return true;
+    }
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        return std::ranges::any_of(n->statements, alwaysReturns);
+    }
+    if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        return n->elseBranch && alwaysReturns(n->thenBranch) && alwaysReturns(n->elseBranch);
+    }
+    return false;
+}
@@ -230,6 +230,8 @@ class VariableDeclarationNode : public StmtNode
 public:
     std::string name;
     Shared<TypeReferenceNode> type;
+    // `int a = ...;`, null for a plain `int a;`
+    Shared<ExprNode> initializer;
 
     VariableDeclarationNode(std::string name, Shared<TypeReferenceNode> type):
         StmtNode("VariableDeclaration"),
@@ -279,22 +281,30 @@ class IHasFields
 {
 public:
     std::unordered_map<std::string, Shared<FieldDeclarationNode>> fields;
+    // Field names in declaration order
+    std::vector<std::string> fieldOrder;
 
     Shared<FieldDeclarationNode> addMember(const std::string& name, const Shared<TypeReferenceNode>& type) {
         Shared<FieldDeclarationNode> field = std::make_shared<FieldDeclarationNode>(name, type);
-        fields.emplace(name, field);
+        if (fields.emplace(name, field).second) {
+            fieldOrder.push_back(name);
+        }
         return field;
     }
 
     Shared<FieldDeclarationNode> addMember(const std::string& name, const Token& token) {
         Shared<FieldDeclarationNode> field = std::make_shared<FieldDeclarationNode>(name, token);
-        fields.emplace(name, field);
+        if (fields.emplace(name, field).second) {
+            fieldOrder.push_back(name);
+        }
         return field;
     }
 
     Shared<FieldDeclarationNode> addMember(const std::string& name, const std::string& typeName, const TokenType tokenType) {
         Shared<FieldDeclarationNode> field = std::make_shared<FieldDeclarationNode>(name, typeName, tokenType);
-        fields.emplace(name, field);
+        if (fields.emplace(name, field).second) {
+            fieldOrder.push_back(name);
+        }
         return field;
     }
 
@@ -434,4 +444,18 @@ constexpr std::string getValueNodeValue<std::string>(const Shared<ExprNode>& nod
 }*/
 
 
+#pragma endregion
+
+#pragma region "Analysis Helpers"
+
+// Counts reads of each variable in `node` and everything below it.
+// A member assignment (`s.x = ...`) counts as a use of `s`.
+void countVariableReads(const Shared<AstNode>& node, std::unordered_map<std::string, size_t>& outReads);
+
+// Counts assignments and declarations of each variable in `node` and everything below it
+void countVariableWrites(const Shared<AstNode>& node, std::unordered_map<std::string, size_t>& outWrites);
+
+// Whether every path through `node` ends in a return statement
+bool alwaysReturns(const Shared<AstNode>& node);
+
 #pragma endregion
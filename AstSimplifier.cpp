@@ -0,0 +1,270 @@
+#include "AstSimplifier.h"
+
+#include <cmath>
+
+static bool toLiteral(const Shared<ExprNode>& node, RuntimeValue& outValue) {
+    if (const auto n = std::dynamic_pointer_cast<IntNode>(node)) {
+        outValue = RuntimeValue(n->value);
+        return true;
+    }
+    if (const auto n = std::dynamic_pointer_cast<FloatNode>(node)) {
+        outValue = RuntimeValue(n->value);
+        return true;
+    }
+    if (const auto n = std::dynamic_pointer_cast<BooleanNode>(node)) {
+        outValue = RuntimeValue(n->value);
+        return true;
+    }
+    if (const auto n = std::dynamic_pointer_cast<StringNode>(node)) {
+        outValue = RuntimeValue(n->value);
+        return true;
+    }
+    return false;
+}
+
+static Shared<ExprNode> fromLiteral(const RuntimeValue& value) {
+    switch (value.type) {
+        case ValueType::Int: return std::make_shared<IntNode>(value.asInt());
+        case ValueType::Float: return std::make_shared<FloatNode>(value.asFloat());
+        case ValueType::Bool: return std::make_shared<BooleanNode>(value.asBool());
+        case ValueType::String: return std::make_shared<StringNode>(value.asString());
+        default: return nullptr;
+    }
+}
+
+// Whether `x op literal` (or `literal op x`) always evaluates to `x` when `x` has type `xType`.
+// Mixed int/float operations produce an int, so a float `x` only keeps its value with float
+// literals, and `x + 0.0` would turn -0.0 into 0.0.
+static bool isIdentity(ArithmeticOp op, const RuntimeValue& literal, bool literalOnRight, ValueType xType) {
+    double value;
+    if (literal.type == ValueType::Int && xType == ValueType::Int) {
+        value = literal.asInt();
+    } else if (literal.type == ValueType::Float && (xType == ValueType::Int || xType == ValueType::Float)) {
+        value = literal.asFloat();
+    } else {
+        return false;
+    }
+
+    const bool exactFloat = xType == ValueType::Float;
+    switch (op) {
+        case ArithmeticOp::ADD: return value == 0 && (!exactFloat || std::signbit(value));
+        case ArithmeticOp::SUB: return literalOnRight && value == 0 && (!exactFloat || !std::signbit(value));
+        case ArithmeticOp::MUL: return value == 1;
+        case ArithmeticOp::DIV: return literalOnRight && value == 1;
+        default: return false;
+    }
+}
+
+void AstSimplifier::simplify(const Shared<ProgramNode>& program) {
+    for (auto& stmt : program->statements) {
+        if (const auto n = std::dynamic_pointer_cast<FunctionNode>(stmt)) {
+            simplifyFunction(n);
+        } else {
+            simplifyStatement(stmt);
+        }
+    }
+}
+
+void AstSimplifier::simplifyFunction(const Shared<FunctionNode>& node) {
+    constants.clear();
+    parameterTypes.clear();
+    for (const auto& [typeName, paramName] : node->parameters) {
+        parameterTypes[paramName] = valueTypeFromName(typeName);
+    }
+
+    std::unordered_map<std::string, size_t> assignments;
+    countVariableWrites(node->body, assignments);
+
+    // Statements run in order, so a literal assigned at the top level of the body holds for
+    // every statement after it as long as nothing else assigns the local
+    auto& statements = node->body->statements;
+    for (auto& stmt : statements) {
+        simplifyStatement(stmt);
+
+        const auto assignment = std::dynamic_pointer_cast<AssignmentNode>(stmt);
+        if (!assignment || !assignment->rhs) {
+            continue;
+        }
+        const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(assignment->lhs);
+        RuntimeValue value;
+        if (lhsVar && assignments[lhsVar->identifier] == 1 && !parameterTypes.contains(lhsVar->identifier)
+            && toLiteral(assignment->rhs, value)) {
+            constants[lhsVar->identifier] = assignment->rhs;
+        }
+    }
+
+    std::unordered_map<std::string, size_t> reads;
+    countVariableReads(node->body, reads);
+    std::erase_if(statements, [&](const Shared<AstNode>& stmt) {
+        const auto assignment = std::dynamic_pointer_cast<AssignmentNode>(stmt);
+        if (!assignment) {
+            return false;
+        }
+        const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(assignment->lhs);
+        if (!lhsVar || !constants.contains(lhsVar->identifier) || reads[lhsVar->identifier] != 0) {
+            return false;
+        }
+        ++removedAssignments;
+        return true;
+    });
+
+    constants.clear();
+    parameterTypes.clear();
+}
+
+void AstSimplifier::simplifyStatement(const Shared<AstNode>& node) {
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        return simplifyBlock(n);
+    }
+    if (const auto n = std::dynamic_pointer_cast<AssignmentNode>(node)) {
+        // The target of `s.x = ...` is written to, only the value side is an expression
+        if (n->rhs) {
+            n->rhs = simplifyExpression(n->rhs);
+        }
+        return;
+    }
+    if (const auto n = std::dynamic_pointer_cast<VariableDeclarationNode>(node)) {
+        if (n->initializer) {
+            n->initializer = simplifyExpression(n->initializer);
+        }
+        return;
+    }
+    if (const auto n = std::dynamic_pointer_cast<ReturnStatementNode>(node)) {
+        if (n->expression) {
+            n->expression = simplifyExpression(n->expression);
+        }
+        return;
+    }
+    if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        n->condition = simplifyExpression(n->condition);
+        simplifyBlock(n->thenBranch);
+        if (n->elseBranch) {
+            simplifyBlock(n->elseBranch);
+        }
+        return;
+    }
+    if (const auto n = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+        for (auto& arg : n->arguments) {
+            arg = simplifyExpression(arg);
+        }
+    }
+}
+
+void AstSimplifier::simplifyBlock(const Shared<BlockNode>& node) {
+    for (auto& stmt : node->statements) {
+        simplifyStatement(stmt);
+    }
+}
+
+Shared<ExprNode> AstSimplifier::simplifyExpression(const Shared<ExprNode>& node) {
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        if (const auto it = constants.find(n->identifier); it != constants.end()) {
+            ++propagatedConstants;
+            return it->second;
+        }
+        return node;
+    }
+    if (const auto n = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+        return simplifyBinaryOp(n);
+    }
+    if (const auto n = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+        for (auto& arg : n->arguments) {
+            arg = simplifyExpression(arg);
+        }
+        return node;
+    }
+    if (const auto n = std::dynamic_pointer_cast<MemberAccessNode>(node)) {
+        n->object = simplifyExpression(n->object);
+        return node;
+    }
+    return node;
+}
+
+Shared<ExprNode> AstSimplifier::simplifyBinaryOp(const Shared<BinaryOpNode>& node) {
+    node->left = simplifyExpression(node->left);
+    node->right = simplifyExpression(node->right);
+
+    ArithmeticOp op;
+    if (!toArithmeticOp(node->op, op)) {
+        return node;
+    }
+
+    RuntimeValue left, right;
+    const bool leftIsLiteral = toLiteral(node->left, left);
+    const bool rightIsLiteral = toLiteral(node->right, right);
+
+    if (leftIsLiteral && rightIsLiteral) {
+        if (!RuntimeValue::CanPerformOperation(left, op, right)) {
+            return node;
+        }
+        // Integer division by zero is an error, leave it to fail at run time. Everything else folds
+        // through the runtime's operators, which wrap on overflow like the VMs do
+        if ((op == ArithmeticOp::DIV || op == ArithmeticOp::MOD) && !(left.type == ValueType::Float && right.type == ValueType::Float)) {
+            const int divisor = right.type == ValueType::Int ? right.asInt() : truncateToInt(right.asFloat());
+            if (divisor == 0) {
+                return node;
+            }
+        }
+
+        RuntimeValue result;
+        try {
+            switch (op) {
+                case ArithmeticOp::ADD: result = left + right; break;
+                case ArithmeticOp::SUB: result = left - right; break;
+                case ArithmeticOp::MUL: result = left * right; break;
+                case ArithmeticOp::DIV: result = left / right; break;
+                case ArithmeticOp::MOD: result = left % right; break;
+                case ArithmeticOp::EQ: result = left == right; break;
+                case ArithmeticOp::NEQ: result = left != right; break;
+                case ArithmeticOp::LT: result = left < right; break;
+                case ArithmeticOp::LTE: result = left <= right; break;
+                case ArithmeticOp::GT: result = left > right; break;
+                case ArithmeticOp::GTE: result = left >= right; break;
+            }
+        } catch (const std::runtime_error&) {
+            // Combinations the runtime rejects keep rejecting at run time
+            return node;
+        }
+
+        if (auto folded = fromLiteral(result)) {
+            ++foldedConstants;
+            return folded;
+        }
+        return node;
+    }
+
+    if (rightIsLiteral && isIdentity(op, right, true, staticType(node->left))) {
+        ++simplifiedIdentities;
+        return node->left;
+    }
+    if (leftIsLiteral && isIdentity(op, left, false, staticType(node->right))) {
+        ++simplifiedIdentities;
+        return node->right;
+    }
+    return node;
+}
+
+ValueType AstSimplifier::staticType(const Shared<ExprNode>& node) const {
+    RuntimeValue literal;
+    if (toLiteral(node, literal)) {
+        return literal.type;
+    }
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        // Parameters are taken to hold their declared type
+        const auto it = parameterTypes.find(n->identifier);
+        return it != parameterTypes.end() ? it->second : ValueType::None;
+    }
+    if (const auto n = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+        ArithmeticOp op;
+        if (!toArithmeticOp(n->op, op)) {
+            return ValueType::None;
+        }
+        return RuntimeValue::ResultType(staticType(n->left), op, staticType(n->right));
+    }
+    return ValueType::None;
+}
+
+void AstSimplifier::dumpStats() const {
+    std::cout << "------------ simplifier: " << foldedConstants << " folded, " << simplifiedIdentities << " identities, "
+        << propagatedConstants << " propagated, " << removedAssignments << " assignments removed" << std::endl;
+}
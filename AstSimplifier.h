@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Ast.h"
+#include "Common.h"
+#include "RuntimeValue.h"
+
+// Rewrites the AST between `Parser::parse` and the compilers:
+//  - folds operators whose operands are all literals, using the runtime's own operators
+//  - applies identities (`x + 0`, `x - 0`, `x * 1`, `1 * x`, `x / 1`) when `x`'s type is known
+//  - propagates literals through locals that are assigned once, at the top level of a function
+//    body, and drops the assignment when nothing reads the local anymore
+// Anything that would fail or be undefined at run time (type mismatches, division by zero) is
+// left alone so it still fails the same way.
+class AstSimplifier
+{
+public:
+    size_t foldedConstants = 0;
+    size_t simplifiedIdentities = 0;
+    size_t propagatedConstants = 0;
+    size_t removedAssignments = 0;
+
+    void simplify(const Shared<ProgramNode>& program);
+
+    void dumpStats() const;
+
+private:
+    // Literals known for locals of the function being simplified
+    std::unordered_map<std::string, Shared<ExprNode>> constants;
+    // Declared parameter types of the function being simplified
+    std::unordered_map<std::string, ValueType> parameterTypes;
+
+    void simplifyFunction(const Shared<FunctionNode>& node);
+
+    void simplifyStatement(const Shared<AstNode>& node);
+
+    void simplifyBlock(const Shared<BlockNode>& node);
+
+    Shared<ExprNode> simplifyExpression(const Shared<ExprNode>& node);
+
+    Shared<ExprNode> simplifyBinaryOp(const Shared<BinaryOpNode>& node);
+
+    // Static type of `node` if it can be told without running it, None otherwise
+    ValueType staticType(const Shared<ExprNode>& node) const;
+};
@@ -0,0 +1,143 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "AstSimplifier.h"
+#include "BytecodeOptimizer.h"
+#include "compiler.h"
+#include "Interpreter.h"
+#include "Parser.h"
+#include "RegisterCompiler.h"
+#include "RegisterInterpreter.h"
+#include "Utils.h"
+
+static const BenchmarkScript BenchmarkScripts[] = {
+    {
+        "fib(24)", R"(
+        int fib(int n) {
+            if (n < 2) {
+                return n;
+            }
+            return fib(n - 1) + fib(n - 2);
+        }
+        int main() {
+            return fib(24);
+        }
+    )"
+    },
+    {
+        "tail-call loop", R"(
+        int loop(int n, int acc) {
+            if (n < 1) {
+                return acc;
+            }
+            return loop(n - 1, acc + n % 7);
+        }
+        int main() {
+            return loop(1000000, 0);
+        }
+    )"
+    },
+    {
+        "locals arithmetic", R"(
+        int step(int a, int b) {
+            c = a * 3 + b;
+            d = c - a % 5;
+            e = d * d - c * b;
+            return e % 1000 + a;
+        }
+        int run(int n, int acc) {
+            if (n == 0) {
+                return acc;
+            }
+            return run(n - 1, step(n, acc) % 100000);
+        }
+        int main() {
+            return run(300000, 1);
+        }
+    )"
+    },
+};
+
+std::span<const BenchmarkScript> benchmarkScripts() {
+    return BenchmarkScripts;
+}
+
+struct BenchmarkResult
+{
+    size_t staticInstructions = 0;
+    uint64_t executedInstructions = 0;
+    std::chrono::nanoseconds bestTime = std::chrono::nanoseconds::max();
+    ExecutionResult outcome;
+};
+
+template <typename TInterpreter>
+static void measure(TInterpreter& interpreter, size_t iterations, BenchmarkResult& result) {
+    result.staticInstructions = interpreter.bytecode.size();
+    for (size_t i = 0; i < iterations; ++i) {
+        interpreter.executedInstructions = 0;
+
+        const auto start = std::chrono::high_resolution_clock::now();
+        result.outcome = interpreter.runMain();
+        const auto elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        result.bestTime = std::min(result.bestTime, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed));
+        result.executedInstructions = interpreter.executedInstructions;
+    }
+}
+
+static void printResult(const char* vm, const BenchmarkResult& result) {
+    std::cout << "    " << std::left << std::setw(10) << vm << std::right
+        << std::setw(6) << result.staticInstructions << " instructions, ";
+#if INTERPRETER_INSTRUCTION_STATS
+    std::cout << std::setw(10) << result.executedInstructions << " executed, ";
+#endif
+    // Fractional milliseconds, `TimeStat` rounds down to whole ones and most runs take only a few
+    const double milliseconds = std::chrono::duration<double, std::milli>(result.bestTime).count();
+    std::cout << std::setw(12) << std::format("{:.3f} ms", milliseconds) << " -> ";
+    if (result.outcome.ok()) {
+        std::cout << result.outcome.value << std::endl;
+    } else {
+        std::cout << "error: " << result.outcome.error << std::endl;
+    }
+}
+
+void runBenchmarks(size_t iterations) {
+    std::cout << "Best of " << iterations << " runs per VM";
+#if !INTERPRETER_INSTRUCTION_STATS
+    std::cout << " (build with SCRIPTINGLANG_INSTRUCTION_STATS for executed instruction counts)";
+#endif
+    std::cout << std::endl;
+
+    for (const auto& script : BenchmarkScripts) {
+        Shared<Lexer> lexer = std::make_shared<Lexer>(script.code);
+        Shared<Parser> parser = std::make_shared<Parser>(lexer);
+        Shared<ProgramNode> program = parser->parse();
+        AstSimplifier().simplify(program);
+
+        Compiler compiler;
+        compiler.compileProgram(program);
+        BytecodeOptimizer().optimize(compiler.instructions, *compiler.functionTable);
+        Interpreter interpreter(compiler);
+        interpreter.jit.reset();
+        // Same bytecode with hot functions compiled to native code, quickened separately
+        Interpreter jitInterpreter(compiler);
+
+        RegisterCompiler registerCompiler;
+        registerCompiler.compileProgram(program);
+        RegisterInterpreter registerInterpreter(registerCompiler);
+
+        BenchmarkResult stackResult, jitResult, registerResult;
+        measure(interpreter, iterations, stackResult);
+        measure(jitInterpreter, iterations, jitResult);
+        measure(registerInterpreter, iterations, registerResult);
+
+        std::cout << script.name << std::endl;
+        printResult("stack", stackResult);
+        if (jitInterpreter.jit) {
+            printResult("stack+jit", jitResult);
+        }
+        printResult("register", registerResult);
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <span>
+
+#include "Common.h"
+
+struct BenchmarkScript
+{
+    const char* name;
+    const char* code;
+};
+
+// The scripts `runBenchmarks` measures, also run by AllocationTest
+std::span<const BenchmarkScript> benchmarkScripts();
+
+// Runs each built-in benchmark script on both the stack VM and the register VM and prints
+// instruction counts (static, plus executed when built with INTERPRETER_INSTRUCTION_STATS)
+// and the best wall time out of `iterations` runs.
+void runBenchmarks(size_t iterations);
@@ -0,0 +1,529 @@
+#include "BytecodeImage.h"
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BYTECODE_IMAGE_MMAP 1
+#else
+#define BYTECODE_IMAGE_MMAP 0
+#endif
+
+#include "Ast.h"
+#include "StructLayout.h"
+#include "SymbolTable.h"
+
+namespace
+{
+    constexpr size_t OpcodeCount = 0
+#define OPCODE_COUNT(op, kind) +1
+        OPCODE_LIST(OPCODE_COUNT)
+#undef OPCODE_COUNT
+        ;
+
+    class Writer
+    {
+    public:
+        std::string bytes;
+
+        template <typename T>
+        void write(T value) {
+            bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        void write(const std::string& value) {
+            write(static_cast<uint32_t>(value.size()));
+            bytes.append(value);
+        }
+    };
+
+    // Reads the tables back, every read is bounds checked since the file could be anything
+    class Reader
+    {
+        std::span<const char> bytes;
+        size_t offset = 0;
+
+        void require(size_t size) const {
+            if (size > bytes.size() - offset) {
+                throw std::runtime_error("[BytecodeImage] Truncated tables");
+            }
+        }
+
+    public:
+        explicit Reader(std::span<const char> bytes): bytes(bytes) {}
+
+        template <typename T>
+        T read() {
+            require(sizeof(T));
+            T value;
+            std::memcpy(&value, bytes.data() + offset, sizeof(T));
+            offset += sizeof(T);
+            return value;
+        }
+
+        std::string readString() {
+            const auto size = read<uint32_t>();
+            require(size);
+            std::string value(bytes.data() + offset, size);
+            offset += size;
+            return value;
+        }
+    };
+
+    // Values an instruction reads off the stack before pushing anything, calls aside
+    int stackInputs(Opcode opcode) {
+        switch (opcode) {
+            case Opcode::CHECK_TYPE:
+            case Opcode::CHECK_STRUCT:
+            case Opcode::STORE_VAR:
+            case Opcode::STORE_LOCAL:
+            case Opcode::LOAD_FIELD:
+            case Opcode::LOAD_FIELD_IDX:
+            case Opcode::JUMP_IF_FALSE:
+            case Opcode::POP:
+            case Opcode::RETURN_VALUE:
+                return 1;
+            default:
+                // Binary operations and field stores take two values and push one back
+                return stackEffect(opcode) < 0 ? 2 : 0;
+        }
+    }
+
+    // Forgets the layouts of `layouts` that `other` doesn't agree on, returns whether any were
+    bool joinLayouts(std::vector<const StructLayout*>& layouts, const std::vector<const StructLayout*>& other) {
+        bool changed = false;
+        for (size_t i = 0; i < layouts.size(); ++i) {
+            if (layouts[i] && layouts[i] != other[i]) {
+                layouts[i] = nullptr;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // What validation knows about the values of a frame before an instruction: the layout of
+    // each operand and local that's certainly a struct of that layout, null for the others
+    struct FrameLayouts
+    {
+        std::vector<const StructLayout*> stack;
+        std::vector<const StructLayout*> locals;
+
+        bool join(const FrameLayouts& other) {
+            const bool stackChanged = joinLayouts(stack, other.stack);
+            return joinLayouts(locals, other.locals) || stackChanged;
+        }
+    };
+
+    bool isValueType(uint32_t type) {
+        return type <= static_cast<uint32_t>(ValueType::Struct);
+    }
+
+    void writeConstant(Writer& writer, const RuntimeValue& value) {
+        writer.write(value.type);
+        switch (value.type) {
+            case ValueType::Int: writer.write(static_cast<int32_t>(value.asInt())); break;
+            case ValueType::Float: writer.write(std::bit_cast<uint32_t>(value.asFloat())); break;
+            case ValueType::Bool: writer.write(static_cast<uint8_t>(value.asBool())); break;
+            case ValueType::String: writer.write(value.asString()); break;
+            default: throw std::runtime_error("[BytecodeImage::write] Constant of type " + std::string(to_string(value.type)) + " can't be saved");
+        }
+    }
+
+    RuntimeValue readConstant(Reader& reader) {
+        const auto type = reader.read<ValueType>();
+        switch (type) {
+            case ValueType::Int: return RuntimeValue(static_cast<int>(reader.read<int32_t>()));
+            case ValueType::Float: return RuntimeValue(std::bit_cast<float>(reader.read<uint32_t>()));
+            case ValueType::Bool: return RuntimeValue(reader.read<uint8_t>() != 0);
+            case ValueType::String: return RuntimeValue(reader.readString());
+            default: throw std::runtime_error("[BytecodeImage] Bad constant type");
+        }
+    }
+}
+
+void BytecodeImage::write(std::ostream& os, const BytecodeInstructionSet& instructions, const FunctionTable& functionTable, const StructLayoutTable& structLayouts) {
+    Writer tables;
+
+    tables.write(static_cast<uint32_t>(instructions.constants.size()));
+    for (const auto& constant : instructions.constants) {
+        writeConstant(tables, constant);
+    }
+
+    tables.write(static_cast<uint32_t>(instructions.names.size()));
+    for (const auto& name : instructions.names) {
+        tables.write(name.str());
+    }
+
+    tables.write(static_cast<uint32_t>(instructions.fieldCaches.size()));
+    for (const auto& cache : instructions.fieldCaches) {
+        tables.write(cache.name);
+    }
+
+    tables.write(static_cast<uint32_t>(instructions.callSites.size()));
+    for (const auto& site : instructions.callSites) {
+        tables.write(site.name);
+        tables.write(site.argumentCount);
+    }
+
+    // The first context is always the empty one
+    tables.write(static_cast<uint32_t>(instructions.debugContexts.size() - 1));
+    for (size_t i = 1; i < instructions.debugContexts.size(); ++i) {
+        tables.write(instructions.debugContexts[i]);
+    }
+
+    tables.write(static_cast<uint32_t>(functionTable.descriptors.size()));
+    for (uint32_t i = 0; i < functionTable.descriptors.size(); ++i) {
+        const FunctionDescriptor& descriptor = functionTable.descriptors[i];
+        const auto& node = functionTable.node(i);
+        tables.write(node->name);
+        tables.write(node->returnType);
+        tables.write(static_cast<uint32_t>(node->parameters.size()));
+        for (const auto& [type, name] : node->parameters) {
+            tables.write(type);
+            tables.write(name);
+        }
+        tables.write(descriptor.address);
+        tables.write(descriptor.frameSize);
+        tables.write(descriptor.maxStack);
+        tables.write(descriptor.returnType);
+    }
+
+    tables.write(static_cast<uint32_t>(structLayouts.layouts.size()));
+    for (const auto& layout : structLayouts.layouts) {
+        tables.write(layout->name.str());
+        tables.write(static_cast<uint32_t>(layout->size()));
+        for (size_t field = 0; field < layout->size(); ++field) {
+            tables.write(layout->fieldNames[field].str());
+            tables.write(layout->fieldTypes[field]);
+        }
+    }
+
+    const uint64_t instructionOffset = (sizeof(Header) + tables.bytes.size() + PageAlignment - 1) / PageAlignment * PageAlignment;
+    const Header header = {
+        Magic,
+        Version,
+        sizeof(Instruction),
+        static_cast<uint32_t>(instructions.size()),
+        instructionOffset,
+        instructionOffset + instructions.size() * sizeof(Instruction),
+    };
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(tables.bytes.data(), static_cast<std::streamsize>(tables.bytes.size()));
+    os << std::string(instructionOffset - sizeof(Header) - tables.bytes.size(), '\0');
+
+    for (const auto& instruction : instructions) {
+        // Written field by field into zeroed bytes so the padding byte is always zero
+        std::array<char, sizeof(Instruction)> bytes = {};
+        std::memcpy(bytes.data() + offsetof(Instruction, opcode), &instruction.opcode, sizeof(instruction.opcode));
+        std::memcpy(bytes.data() + offsetof(Instruction, debugIndex), &instruction.debugIndex, sizeof(instruction.debugIndex));
+        std::memcpy(bytes.data() + offsetof(Instruction, operand), &instruction.operand, sizeof(instruction.operand));
+        os.write(bytes.data(), bytes.size());
+    }
+}
+
+BytecodeImage::BytecodeImage(const std::string& path):
+    functionTable(std::make_shared<FunctionTable>()),
+    structLayouts(std::make_shared<StructLayoutTable>()) {
+    std::span<char> bytes;
+#if BYTECODE_IMAGE_MMAP
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("[BytecodeImage] Could not open " + path);
+    }
+    struct stat status = {};
+    if (fstat(file, &status) == 0 && status.st_size > 0) {
+        mappingSize = static_cast<size_t>(status.st_size);
+        mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (!mapping || mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw std::runtime_error("[BytecodeImage] Could not map " + path);
+    }
+    bytes = std::span(static_cast<char*>(mapping), mappingSize);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("[BytecodeImage] Could not open " + path);
+    }
+    const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    // Word sized elements keep the instructions aligned
+    buffer.resize((contents.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    std::memcpy(buffer.data(), contents.data(), contents.size());
+    bytes = std::span(reinterpret_cast<char*>(buffer.data()), contents.size());
+#endif
+
+    Header header;
+    if (bytes.size() < sizeof(header)) {
+        throw std::runtime_error("[BytecodeImage] Not a bytecode file: " + path);
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != Magic) {
+        throw std::runtime_error("[BytecodeImage] Not a bytecode file: " + path);
+    }
+    if (header.version != Version || header.instructionSize != sizeof(Instruction)) {
+        throw std::runtime_error(std::format("[BytecodeImage] {} is version {}, this build reads version {}", path, header.version, Version));
+    }
+    if (header.fileSize != bytes.size() || header.instructionOffset % alignof(Instruction) != 0 ||
+        header.instructionOffset < sizeof(Header) ||
+        header.instructionOffset + uint64_t(header.instructionCount) * sizeof(Instruction) != header.fileSize) {
+        throw std::runtime_error("[BytecodeImage] Truncated or corrupt file: " + path);
+    }
+
+    decodeTables(bytes.subspan(sizeof(Header), header.instructionOffset - sizeof(Header)));
+    code = std::span(reinterpret_cast<const Instruction*>(bytes.data() + header.instructionOffset), header.instructionCount);
+
+    validate(path);
+}
+
+void BytecodeImage::validate(const std::string& path) const {
+    // Operands are used as indices without checks while running, so don't trust them blindly
+    for (const Instruction& instruction : code) {
+        if (static_cast<size_t>(instruction.opcode) >= OpcodeCount || instruction.debugIndex >= tables.debugContexts.size()) {
+            throw std::runtime_error("[BytecodeImage] Corrupt instruction in " + path);
+        }
+        size_t limit = SIZE_MAX;
+        switch (operandKind(instruction.opcode)) {
+            case OperandKind::Constant: limit = tables.constants.size(); break;
+            case OperandKind::Name: limit = tables.names.size(); break;
+            case OperandKind::FieldCache: limit = tables.fieldCaches.size(); break;
+            case OperandKind::CallSite: limit = tables.callSites.size(); break;
+            case OperandKind::Function: limit = functionTable->descriptors.size(); break;
+            case OperandKind::Address: limit = code.size(); break;
+            case OperandKind::Layout: limit = structLayouts->layouts.size(); break;
+            case OperandKind::Type: limit = static_cast<size_t>(ValueType::Struct) + 1; break;
+            default: break;
+        }
+        if (instruction.operand >= limit) {
+            throw std::runtime_error("[BytecodeImage] Corrupt instruction in " + path);
+        }
+    }
+
+    for (const auto& descriptor : functionTable->descriptors) {
+        if (descriptor.address >= code.size() || descriptor.arity > descriptor.frameSize || !isValueType(static_cast<uint32_t>(descriptor.returnType))) {
+            throw std::runtime_error("[BytecodeImage] Corrupt function table in " + path);
+        }
+        validateFunction(descriptor, path);
+    }
+}
+
+void BytecodeImage::validateFunction(const FunctionDescriptor& descriptor, const std::string& path) const {
+    const auto corrupt = [&](uint32_t pc) {
+        return std::runtime_error(std::format("[BytecodeImage] Corrupt instruction at {} in {}", pc, path));
+    };
+    // Layout of field `index` of a value known to be a struct of `layout`, throws for anything else
+    const auto field = [&](const StructLayout* layout, uint32_t index, uint32_t pc) {
+        if (!layout || index >= layout->size()) {
+            throw corrupt(pc);
+        }
+        return layout->fieldLayouts[index];
+    };
+
+    // Walks every instruction the function can reach like `Compiler::maxStackDepth`, so slots are
+    // checked against this frame and the stack never underflows or outgrows `maxStack`. Indexed
+    // field accesses don't check their struct while running either, so it also follows which
+    // operands and locals hold a struct of a known layout, like `Compiler::staticLayout` does.
+    std::unordered_map<uint32_t, FrameLayouts> stateAt;
+    std::vector<uint32_t> pending;
+    // Joins `state` into the one before `target`, layouts that differ between paths become unknown
+    const auto flowTo = [&](uint32_t target, const FrameLayouts& state, uint32_t pc) {
+        const auto [it, added] = stateAt.try_emplace(target, state);
+        if (!added) {
+            // Every path has to reach an instruction at the same depth
+            if (it->second.stack.size() != state.stack.size()) {
+                throw corrupt(pc);
+            }
+            if (!it->second.join(state)) {
+                return;
+            }
+        }
+        pending.push_back(target);
+    };
+    flowTo(descriptor.address, {{}, std::vector<const StructLayout*>(descriptor.frameSize)}, descriptor.address);
+
+    while (!pending.empty()) {
+        const uint32_t pc = pending.back();
+        pending.pop_back();
+        FrameLayouts state = stateAt[pc];
+        auto& stack = state.stack;
+        auto& locals = state.locals;
+
+        const Instruction& instruction = code[pc];
+        const Opcode opcode = instruction.opcode;
+        const uint32_t operand = instruction.operand;
+        bool valid = true;
+        switch (operandKind(opcode)) {
+            case OperandKind::Slot: valid = operand < descriptor.frameSize; break;
+            case OperandKind::TypedSlot: valid = (operand >> 8) < descriptor.frameSize && isValueType(operand & 0xFF); break;
+            case OperandKind::LayoutSlot: valid = (operand >> 16) < descriptor.frameSize && (operand & 0xFFFF) < structLayouts->layouts.size(); break;
+            case OperandKind::FieldSlot: valid = (operand >> 16) < descriptor.frameSize; break;
+            default: break;
+        }
+
+        int inputs = stackInputs(opcode);
+        int effect = stackEffect(opcode);
+        if (opcode == Opcode::CALL_DIRECT || opcode == Opcode::TAIL_CALL_DIRECT) {
+            inputs = functionTable->descriptors[operand].arity;
+        } else if (opcode == Opcode::CALL_FUNC || opcode == Opcode::TAIL_CALL) {
+            inputs = static_cast<int>(tables.callSites[operand].argumentCount);
+        }
+        if (opcode == Opcode::CALL_DIRECT || opcode == Opcode::CALL_FUNC) {
+            effect -= inputs;
+        }
+        const int depth = static_cast<int>(stack.size());
+        if (!valid || depth < inputs || depth + effect > descriptor.maxStack) {
+            throw corrupt(pc);
+        }
+
+        // Layout of the value the instruction leaves on top, if it pushes or replaces one
+        const StructLayout* result = nullptr;
+        switch (opcode) {
+            case Opcode::NEW_STRUCT:
+            case Opcode::CHECK_STRUCT:
+                result = structLayouts->layouts[operand].get();
+                break;
+            case Opcode::CHECK_LOCAL_STRUCT:
+                locals[operand >> 16] = structLayouts->layouts[operand & 0xFFFF].get();
+                break;
+            case Opcode::LOAD_LOCAL:
+                result = locals[operand];
+                break;
+            case Opcode::TAKE_LOCAL:
+                result = locals[operand];
+                locals[operand] = nullptr;
+                break;
+            case Opcode::STORE_LOCAL:
+                locals[operand] = stack.back();
+                break;
+            case Opcode::LOAD_FIELD_IDX:
+                result = field(stack.back(), operand, pc);
+                break;
+            case Opcode::LOAD_LOCAL_FIELD:
+                result = field(locals[operand >> 16], operand & 0xFFFF, pc);
+                break;
+            case Opcode::STORE_FIELD_IDX:
+                // Struct typed fields only ever hold their layout, the compiler checks the value first
+                if (const StructLayout* fieldLayout = field(stack.back(), operand, pc); fieldLayout && stack[depth - 2] != fieldLayout) {
+                    throw corrupt(pc);
+                }
+                result = stack.back();
+                break;
+            default:
+                break;
+        }
+        stack.resize(depth - inputs);
+        stack.resize(depth + effect, nullptr);
+        if (inputs + effect > 0) {
+            stack.back() = result;
+        }
+
+        if (opcode == Opcode::JUMP || opcode == Opcode::JUMP_IF_FALSE) {
+            flowTo(operand, state, pc);
+        }
+        if (opcode == Opcode::JUMP || opcode == Opcode::RETURN || opcode == Opcode::RETURN_VALUE ||
+            opcode == Opcode::TAIL_CALL || opcode == Opcode::TAIL_CALL_DIRECT) {
+            continue;
+        }
+        if (pc + 1 >= code.size()) {
+            throw corrupt(pc);
+        }
+        flowTo(pc + 1, state, pc);
+    }
+}
+
+BytecodeImage::~BytecodeImage() {
+#if BYTECODE_IMAGE_MMAP
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    }
+#endif
+}
+
+void BytecodeImage::decodeTables(std::span<const char> bytes) {
+    Reader reader(bytes);
+
+    const auto constantCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < constantCount; ++i) {
+        // The pool only ever held distinct values, so they land at the same indices
+        if (tables.addConstant(readConstant(reader)) != i) {
+            throw std::runtime_error("[BytecodeImage] Duplicate constant");
+        }
+    }
+
+    const auto nameCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < nameCount; ++i) {
+        if (tables.addName(reader.readString()) != i) {
+            throw std::runtime_error("[BytecodeImage] Duplicate name");
+        }
+    }
+
+    const auto cacheCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < cacheCount; ++i) {
+        const auto name = reader.read<uint32_t>();
+        if (name >= tables.names.size()) {
+            throw std::runtime_error("[BytecodeImage] Bad field cache name");
+        }
+        tables.fieldCaches.emplace_back(name);
+    }
+
+    const auto siteCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < siteCount; ++i) {
+        const auto name = reader.read<uint32_t>();
+        if (name >= tables.names.size()) {
+            throw std::runtime_error("[BytecodeImage] Bad call site name");
+        }
+        tables.callSites.push_back({name, reader.read<uint32_t>()});
+    }
+
+    const auto contextCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < contextCount; ++i) {
+        if (tables.addDebugContext(reader.readString()) != i + 1) {
+            throw std::runtime_error("[BytecodeImage] Duplicate debug context");
+        }
+    }
+
+    const auto functionCount = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < functionCount; ++i) {
+        // Only the signature is kept, calls and errors need nothing else from the AST
+        auto node = std::make_shared<FunctionNode>(reader.readString());
+        node->returnType = reader.readString();
+        const auto parameterCount = reader.read<uint32_t>();
+        for (uint32_t parameter = 0; parameter < parameterCount; ++parameter) {
+            std::string type = reader.readString();
+            node->parameters.emplace_back(std::move(type), reader.readString());
+        }
+        const auto address = reader.read<uint32_t>();
+        const auto frameSize = reader.read<uint16_t>();
+        if (functionTable->define(node, address, frameSize) != i) {
+            throw std::runtime_error("[BytecodeImage] Duplicate function " + node->name);
+        }
+        FunctionDescriptor& descriptor = functionTable->descriptors[i];
+        descriptor.maxStack = reader.read<uint16_t>();
+        descriptor.returnType = reader.read<ValueType>();
+    }
+
+    const auto layoutCount = reader.read<uint32_t>();
+    std::vector<Shared<StructLayout>> layouts;
+    for (uint32_t i = 0; i < layoutCount; ++i) {
+        const std::string name = reader.readString();
+        const auto fieldCount = reader.read<uint32_t>();
+        std::vector<std::string> fieldNames, fieldTypes;
+        for (uint32_t field = 0; field < fieldCount; ++field) {
+            fieldNames.push_back(reader.readString());
+            fieldTypes.push_back(reader.readString());
+        }
+        layouts.push_back(std::make_shared<StructLayout>(name, fieldNames, fieldTypes));
+    }
+    structLayouts->define(layouts);
+    if (structLayouts->layouts.size() != layoutCount) {
+        throw std::runtime_error("[BytecodeImage] Duplicate struct layout");
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <span>
+
+#include "BytecodeInstructions.h"
+#include "Common.h"
+
+struct FunctionDescriptor;
+class FunctionTable;
+class StructLayoutTable;
+
+// A compiled program loaded from its on-disk form (`Compiler::save`), so it runs without
+// lexing, parsing or compiling the script again (`ScriptingLang --load-bytecode`).
+//
+// File layout, in the byte order and `Instruction` layout of the machine that wrote it:
+//   header | constants, names, field caches, call sites, debug contexts, functions, struct layouts | instructions
+// The instructions start on a page boundary and are stored exactly as they are in memory, so
+// they're used in place from a read-only mapping of the file. Processes running the same file
+// share those pages, the interpreter doesn't quicken them. The tables are small and are decoded
+// into this process.
+class BytecodeImage
+{
+public:
+    static constexpr uint32_t Magic = 0x43424C53; // "SLBC"
+    // Bumped whenever the layout or the instruction encoding changes, older files are refused
+    static constexpr uint32_t Version = 2;
+    // Alignment of the instructions, so they don't share a page with the tables
+    static constexpr size_t PageAlignment = 4 * 1024;
+
+    // Operand tables of `code`, its own instruction list stays empty
+    BytecodeInstructionSet tables;
+    Shared<FunctionTable> functionTable;
+    Shared<StructLayoutTable> structLayouts;
+
+    // The program's instructions, in the mapping
+    std::span<const Instruction> code;
+
+    // Maps the program at `path`, throws if it can't be read or wasn't written by this version
+    explicit BytecodeImage(const std::string& path);
+    ~BytecodeImage();
+
+    BytecodeImage(const BytecodeImage&) = delete;
+    BytecodeImage& operator=(const BytecodeImage&) = delete;
+
+    // Writes a linked program in the format above
+    static void write(std::ostream& os, const BytecodeInstructionSet& instructions, const FunctionTable& functionTable, const StructLayoutTable& structLayouts);
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        // Catches a writer with another `Instruction` layout
+        uint32_t instructionSize;
+        uint32_t instructionCount;
+        uint64_t instructionOffset;
+        uint64_t fileSize;
+    };
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    // Holds the file instead when it can't be mapped
+    std::vector<uint64_t> buffer;
+
+    // Fills the tables from the bytes between the header and the instructions
+    void decodeTables(std::span<const char> bytes);
+
+    // Throws unless every operand indexes into the tables it refers to
+    void validate(const std::string& path) const;
+
+    // Throws unless the instructions `descriptor` can reach stay within its frame and `maxStack`,
+    // and indexed field accesses only see structs that have the field
+    void validateFunction(const FunctionDescriptor& descriptor, const std::string& path) const;
+};
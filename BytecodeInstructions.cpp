@@ -5,22 +5,35 @@ BytecodeInstructionSet::BytecodeInstructionSet(const std::vector<Instruction>& v
 // BytecodeInstructionSet::BytecodeInstructionSet(const BytecodeInstructionSet& other): std::vector<Instruction>(other) {}
 // BytecodeInstructionSet::BytecodeInstructionSet(BytecodeInstructionSet&& other) noexcept: std::vector<Instruction>(std::move(other)) {}
 
-BytecodeInstructionSet& BytecodeInstructionSet::operator=(const BytecodeInstructionSet& other) {
-    if (this == &other)
-        return *this;
-    std::vector<Instruction>::operator =(other);
-    return *this;
-}
+// Operand tables have to travel with the instructions that index into them
+BytecodeInstructionSet& BytecodeInstructionSet::operator=(const BytecodeInstructionSet& other) = default;
 
-BytecodeInstructionSet& BytecodeInstructionSet::operator=(BytecodeInstructionSet&& other) noexcept {
-    if (this == &other)
-        return *this;
-    std::vector<Instruction>::operator =(std::move(other));
-    return *this;
-}
+BytecodeInstructionSet& BytecodeInstructionSet::operator=(BytecodeInstructionSet&& other) noexcept = default;
 
 BytecodeInstructionSet& BytecodeInstructionSet::operator+=(const BytecodeInstructionSet& rhs) {
-    insert(end(), rhs.begin(), rhs.end());
+    // Operands index into `rhs`'s tables, so re-encode them against ours
+    reserve(size() + rhs.size());
+    for (auto& instruction : rhs) {
+        Instruction copy = instruction;
+        copy.debugIndex = addDebugContext(rhs.debugContext(instruction));
+        switch (operandKind(instruction.opcode)) {
+            case OperandKind::Constant:
+                copy.operand = addConstant(rhs.constant(instruction));
+                break;
+            case OperandKind::Name:
+                copy.operand = addName(rhs.name(instruction));
+                break;
+            case OperandKind::FieldCache:
+                copy.operand = addFieldCache(rhs.fieldName(instruction));
+                break;
+            case OperandKind::CallSite:
+                copy.operand = addCallSite(rhs.calleeName(instruction), rhs.callSite(instruction).argumentCount);
+                break;
+            default:
+                break;
+        }
+        push_back(copy);
+    }
     return *this;
 }
 
@@ -47,13 +60,113 @@ BytecodeInstructionSet& BytecodeInstructionSet::operator+=(Instruction&& rhs) {
 }
 
 BytecodeInstructionSet& BytecodeInstructionSet::push(Opcode opcode, const RuntimeValue& operand, const std::string& debugContext) {
-    push_back(Instruction(opcode, operand, debugContext));
+    uint32_t encoded = 0;
+    switch (operandKind(opcode)) {
+        case OperandKind::Constant:
+            encoded = addConstant(operand);
+            break;
+        case OperandKind::Name:
+            encoded = addName(operand.asString());
+            break;
+        case OperandKind::FieldCache:
+            encoded = addFieldCache(operand.asString());
+            break;
+        default:
+            if (operand.type != ValueType::None) {
+                encoded = static_cast<uint32_t>(operand.asInt());
+            }
+            break;
+    }
+
+    push_back(Instruction(opcode, addDebugContext(debugContext), encoded));
     return *this;
 }
 
+uint32_t BytecodeInstructionSet::addConstant(const RuntimeValue& value) {
+    return constants.add(value);
+}
+
+uint32_t BytecodeInstructionSet::addName(const std::string& name) {
+    auto [it, inserted] = nameIndices.try_emplace(name, static_cast<uint32_t>(names.size()));
+    if (inserted) {
+        names.push_back(name);
+    }
+    return it->second;
+}
+
+uint32_t BytecodeInstructionSet::addFieldCache(const std::string& name) {
+    fieldCaches.emplace_back(addName(name));
+    return static_cast<uint32_t>(fieldCaches.size() - 1);
+}
+
+uint32_t BytecodeInstructionSet::addCallSite(const std::string& name, uint32_t argumentCount) {
+    callSites.push_back({addName(name), argumentCount});
+    return static_cast<uint32_t>(callSites.size() - 1);
+}
+
+uint16_t BytecodeInstructionSet::addDebugContext(const std::string& debugContext) {
+    if (const auto it = debugContextIndices.find(debugContext); it != debugContextIndices.end()) {
+        return it->second;
+    }
+    if (debugContexts.size() > UINT16_MAX) {
+        throw std::runtime_error("Too many debug contexts for a 16-bit index");
+    }
+
+    const auto index = static_cast<uint16_t>(debugContexts.size());
+    debugContexts.push_back(debugContext);
+    debugContextIndices.emplace(debugContext, index);
+    return index;
+}
+
 void BytecodeInstructionSet::dump() {
-    std::cout << "------------" << std::endl;
+    std::cout << "------------ " << size() << " instructions, " << size() * sizeof(Instruction) << " bytes, "
+        << constants.size() << " constants" << std::endl;
     for (auto& instruction : *this) {
-        std::cout << instruction.debugContext << to_string(instruction.opcode) << " -> " << instruction.operand << std::endl;
+        std::cout << debugContext(instruction) << to_string(instruction.opcode);
+        switch (operandKind(instruction.opcode)) {
+            case OperandKind::Constant:
+                std::cout << " -> " << constant(instruction);
+                break;
+            case OperandKind::Name:
+                std::cout << " -> " << name(instruction);
+                break;
+            case OperandKind::FieldCache:
+                std::cout << " -> " << fieldName(instruction) << " (ic#" << instruction.operand << ")";
+                break;
+            case OperandKind::CallSite:
+                std::cout << " -> " << calleeName(instruction) << " (" << callSite(instruction).argumentCount << " args)";
+                break;
+            case OperandKind::Slot:
+                std::cout << " -> #" << instruction.operand;
+                break;
+            case OperandKind::Function:
+                std::cout << " -> fn#" << instruction.operand;
+                break;
+            case OperandKind::Address:
+                std::cout << " -> @" << instruction.operand;
+                break;
+            case OperandKind::Type:
+                std::cout << " -> " << to_string(static_cast<ValueType>(instruction.operand));
+                break;
+            case OperandKind::TypedSlot:
+                std::cout << " -> #" << (instruction.operand >> 8) << " "
+                    << to_string(static_cast<ValueType>(instruction.operand & 0xFF));
+                break;
+            case OperandKind::Layout:
+                std::cout << " -> layout#" << instruction.operand;
+                break;
+            case OperandKind::Field:
+                std::cout << " -> field#" << instruction.operand;
+                break;
+            case OperandKind::FieldSlot:
+                std::cout << " -> #" << (instruction.operand >> 16) << " field#" << (instruction.operand & 0xFFFF);
+                break;
+            case OperandKind::LayoutSlot:
+                std::cout << " -> #" << (instruction.operand >> 16) << " layout#" << (instruction.operand & 0xFFFF);
+                break;
+            default:
+                break;
+        }
+        std::cout << std::endl;
     }
 }
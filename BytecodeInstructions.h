@@ -1,89 +1,294 @@
 #pragma once
 
+#include <array>
+
 #include "Common.h"
+#include "ConstantPool.h"
 #include "RuntimeValue.h"
 
+class StructLayout;
+
+// What an instruction's operand refers to
+enum class OperandKind : uint8_t
+{
+    // Operand is unused
+    None,
+    // Index into `BytecodeInstructionSet::constants` (the program's constant pool)
+    Constant,
+    // Index into `BytecodeInstructionSet::names`
+    Name,
+    // Index of a local slot in the current call frame
+    Slot,
+    // Index into `FunctionTable::descriptors`
+    Function,
+    // Bytecode address
+    Address,
+    // A `ValueType`
+    Type,
+    // Local slot in the upper bits, `ValueType` in the low 8 bits
+    TypedSlot,
+    // Index into `StructLayoutTable::layouts`
+    Layout,
+    // Field index within a struct's layout
+    Field,
+    // Local slot in the upper bits, layout index in the low 16 bits
+    LayoutSlot,
+    // Local slot in the upper bits, field index in the low 16 bits
+    FieldSlot,
+    // Index into `BytecodeInstructionSet::fieldCaches`
+    FieldCache,
+    // Index into `BytecodeInstructionSet::callSites`
+    CallSite,
+};
+
+// Every opcode, in enum order. Expanded with `X(name, operandKind)` to keep the `Opcode` enum,
+// `to_string`, operand encoding and the interpreter's dispatch tables in sync.
+#define OPCODE_LIST(X) \
+    /* Push constant pool entry `operand` */ \
+    X(LOAD_CONST, Constant) \
+    /* Generic operations, operand types are checked on every execution. The operand is */ \
+    /* unused by the compiler, the interpreter counts failed quickenings in it. */ \
+    /* Addition */ \
+    X(ADD, None) \
+    /* Subtraction */ \
+    X(SUB, None) \
+    /* Multiplication */ \
+    X(MUL, None) \
+    /* Division */ \
+    X(DIV, None) \
+    /* Modulus */ \
+    X(MOD, None) \
+    /* Equality */ \
+    X(EQ, None) \
+    /* Inequality */ \
+    X(NEQ, None) \
+    /* Less than */ \
+    X(LT, None) \
+    /* Less than or equal to */ \
+    X(LTE, None) \
+    /* Greater than */ \
+    X(GT, None) \
+    /* Greater than or equal to */ \
+    X(GTE, None) \
+    \
+    /* Operations on two ints or two floats, emitted where the compiler knows both operand */ \
+    /* types (see `TypeInference`). They skip all type checks. */ \
+    X(ADD_INT, None) \
+    X(SUB_INT, None) \
+    X(MUL_INT, None) \
+    X(DIV_INT, None) \
+    X(MOD_INT, None) \
+    X(EQ_INT, None) \
+    X(NEQ_INT, None) \
+    X(LT_INT, None) \
+    X(LTE_INT, None) \
+    X(GT_INT, None) \
+    X(GTE_INT, None) \
+    X(ADD_FLOAT, None) \
+    X(SUB_FLOAT, None) \
+    X(MUL_FLOAT, None) \
+    X(DIV_FLOAT, None) \
+    X(EQ_FLOAT, None) \
+    X(NEQ_FLOAT, None) \
+    X(LT_FLOAT, None) \
+    X(LTE_FLOAT, None) \
+    X(GT_FLOAT, None) \
+    X(GTE_FLOAT, None) \
+    /* Generic operations rewritten by the interpreter once it has seen both operands be ints */ \
+    /* or floats at that instruction. They check the types and go back to the generic form */ \
+    /* if they don't match. */ \
+    X(ADD_INT_INT, None) \
+    X(SUB_INT_INT, None) \
+    X(MUL_INT_INT, None) \
+    X(DIV_INT_INT, None) \
+    X(MOD_INT_INT, None) \
+    X(EQ_INT_INT, None) \
+    X(NEQ_INT_INT, None) \
+    X(LT_INT_INT, None) \
+    X(LTE_INT_INT, None) \
+    X(GT_INT_INT, None) \
+    X(GTE_INT_INT, None) \
+    X(ADD_FLOAT_FLOAT, None) \
+    X(SUB_FLOAT_FLOAT, None) \
+    X(MUL_FLOAT_FLOAT, None) \
+    X(DIV_FLOAT_FLOAT, None) \
+    X(EQ_FLOAT_FLOAT, None) \
+    X(NEQ_FLOAT_FLOAT, None) \
+    X(LT_FLOAT_FLOAT, None) \
+    X(LTE_FLOAT_FLOAT, None) \
+    X(GT_FLOAT_FLOAT, None) \
+    X(GTE_FLOAT_FLOAT, None) \
+    \
+    /* Throw unless the top of the stack has type `operand`, guards stores to declared locals */ \
+    X(CHECK_TYPE, Type) \
+    /* Throw unless a local slot has the given type, guards typed parameters on entry */ \
+    X(CHECK_LOCAL_TYPE, TypedSlot) \
+    /* Throw unless the top of the stack is a struct with layout `operand` */ \
+    X(CHECK_STRUCT, Layout) \
+    /* Throw unless a local slot holds a struct with the given layout, guards struct parameters */ \
+    X(CHECK_LOCAL_STRUCT, LayoutSlot) \
+    \
+    /* Load variable */ \
+    X(LOAD_VAR, Name) \
+    /* Store variable */ \
+    X(STORE_VAR, Name) \
+    /* Load local variable from frame slot `operand` */ \
+    X(LOAD_LOCAL, Slot) \
+    /* Store local variable to frame slot `operand` */ \
+    X(STORE_LOCAL, Slot) \
+    /* Move local variable out of frame slot `operand`, leaving it empty. Loads a struct that's */ \
+    /* about to be modified and stored back, so it isn't shared (and copied) while it's written. */ \
+    X(TAKE_LOCAL, Slot) \
+    /* Pop a struct and a value below it, push the struct with the field named by cache `operand` */ \
+    /* set to the value. Used where the struct's layout isn't known at compile time. */ \
+    X(STORE_FIELD, FieldCache) \
+    /* Replace the struct on top of the stack with the field named by cache `operand` */ \
+    X(LOAD_FIELD, FieldCache) \
+    /* Push a new instance of layout `operand`, every field set to its default */ \
+    X(NEW_STRUCT, Layout) \
+    /* STORE_FIELD and LOAD_FIELD with the field's index in a layout known at compile time */ \
+    X(STORE_FIELD_IDX, Field) \
+    X(LOAD_FIELD_IDX, Field) \
+    /* Push a field of the struct in a local slot, without copying the struct itself */ \
+    X(LOAD_LOCAL_FIELD, FieldSlot) \
+    \
+    /* Jump to `operand` */ \
+    X(JUMP, Address) \
+    /* Pop a value, jump to `operand` if it's falsy */ \
+    X(JUMP_IF_FALSE, Address) \
+    \
+    /* Call function by name, resolved on every call (late bound) */ \
+    X(CALL_FUNC, CallSite) \
+    /* Call function descriptor `operand`, rewritten from CALL_FUNC by `Compiler::link` */ \
+    X(CALL_DIRECT, Function) \
+    /* `return f(...)`: call by name, reusing the current frame */ \
+    X(TAIL_CALL, CallSite) \
+    /* Tail call function descriptor `operand`, rewritten from TAIL_CALL by `Compiler::link` */ \
+    X(TAIL_CALL_DIRECT, Function) \
+    /* Discard the top of the stack (e.g. the result of a call used as a statement) */ \
+    X(POP, None) \
+    \
+    X(RETURN_VALUE, None) \
+    X(RETURN, None)
 
-enum class Opcode
+enum class Opcode : uint8_t
 {
-    // Load constant
-    LOAD_CONST,
-    // Addition
-    ADD,
-    // Subtraction
-    SUB,
-    // Multiplication
-    MUL,
-    // Division
-    DIV,
-    // Modulus
-    MOD,
-    // Equality
-    EQ,
-    // Inequality
-    NEQ,
-    // Less than
-    LT,
-    // Less than or equal to
-    LTE,
-    // Greater than
-    GT,
-    // Greater than or equal to
-    GTE,
-
-    // Load variable
-    LOAD_VAR,
-    // Store variable
-    STORE_VAR,
-    // Store field
-    STORE_FIELD,
-    // Load field
-    LOAD_FIELD,
-
-    // Call function
-    CALL_FUNC,
-    // Push argument count
-    // PUSH_ARG_COUNT,
-
-    RETURN_VALUE,
-    RETURN,
+#define OPCODE_ENUM(op, kind) op,
+    OPCODE_LIST(OPCODE_ENUM)
+#undef OPCODE_ENUM
 };
 
 inline const char* to_string(Opcode e) {
     switch (e) {
-        case Opcode::LOAD_CONST: return "LOAD_CONST";
-        case Opcode::ADD: return "ADD";
-        case Opcode::SUB: return "SUB";
-        case Opcode::MUL: return "MUL";
-        case Opcode::DIV: return "DIV";
-        case Opcode::MOD: return "MOD";
-        case Opcode::EQ: return "EQ";
-        case Opcode::NEQ: return "NEQ";
-        case Opcode::LT: return "LT";
-        case Opcode::LTE: return "LTE";
-        case Opcode::GT: return "GT";
-        case Opcode::GTE: return "GTE";
-        case Opcode::LOAD_VAR: return "LOAD_VAR";
-        case Opcode::STORE_VAR: return "STORE_VAR";
-        case Opcode::STORE_FIELD: return "STORE_FIELD";
-        case Opcode::LOAD_FIELD: return "LOAD_FIELD";
-        case Opcode::CALL_FUNC: return "CALL_FUNC";
-        case Opcode::RETURN_VALUE: return "RETURN_VALUE";
-        case Opcode::RETURN: return "RETURN";
+#define OPCODE_NAME(op, kind) case Opcode::op: return #op;
+        OPCODE_LIST(OPCODE_NAME)
+#undef OPCODE_NAME
         default: return "unknown";
     }
 }
 
+inline OperandKind operandKind(Opcode e) {
+    switch (e) {
+#define OPCODE_OPERAND_KIND(op, kind) case Opcode::op: return OperandKind::kind;
+        OPCODE_LIST(OPCODE_OPERAND_KIND)
+#undef OPCODE_OPERAND_KIND
+        default: return OperandKind::None;
+    }
+}
+
+// Change in stack depth after `e` falls through to the next instruction. Calls count only
+// the result they push, the caller subtracts the callee's arity. Instructions that leave
+// the function (returns, tail calls) report 0, nothing runs after them in this frame.
+inline int stackEffect(Opcode e) {
+    switch (e) {
+        case Opcode::LOAD_CONST:
+        case Opcode::LOAD_VAR:
+        case Opcode::LOAD_LOCAL:
+        case Opcode::TAKE_LOCAL:
+        case Opcode::NEW_STRUCT:
+        case Opcode::LOAD_LOCAL_FIELD:
+        case Opcode::CALL_FUNC:
+        case Opcode::CALL_DIRECT:
+            return 1;
+        case Opcode::CHECK_TYPE:
+        case Opcode::CHECK_LOCAL_TYPE:
+        case Opcode::CHECK_STRUCT:
+        case Opcode::CHECK_LOCAL_STRUCT:
+        case Opcode::LOAD_FIELD:
+        case Opcode::LOAD_FIELD_IDX:
+        case Opcode::JUMP:
+        case Opcode::TAIL_CALL:
+        case Opcode::TAIL_CALL_DIRECT:
+        case Opcode::RETURN_VALUE:
+        case Opcode::RETURN:
+            return 0;
+        default:
+            // Binary operations, stores and POP/JUMP_IF_FALSE all consume one value
+            return -1;
+    }
+}
+
+
+// Inline cache of a LOAD_FIELD/STORE_FIELD site. Struct layouts act as the shapes: the site
+// remembers the last few layouts it has seen and where each keeps the field, so a hit skips
+// the lookup by name. Once all entries are taken the site stays megamorphic and misses go
+// through the layout's name table.
+class FieldCache
+{
+public:
+    static constexpr size_t Size = 4;
+
+    // Index into `BytecodeInstructionSet::names`
+    uint32_t name = 0;
+    uint32_t count = 0;
+    std::array<const StructLayout*, Size> layouts = {};
+    std::array<uint32_t, Size> indices = {};
 
+    explicit FieldCache(uint32_t name): name(name) {}
+
+    bool find(const StructLayout* layout, uint32_t& outIndex) const {
+        for (uint32_t i = 0; i < count; ++i) {
+            if (layouts[i] == layout) {
+                outIndex = indices[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void remember(const StructLayout* layout, uint32_t index) {
+        if (count < Size) {
+            layouts[count] = layout;
+            indices[count] = index;
+            ++count;
+        }
+    }
+};
+
+// A call by name, kept until `Compiler::link` binds it (or for good if the callee doesn't
+// exist). The argument count is checked against the callee's arity when it's resolved, the
+// callee's frame starts that many values below the top of the stack.
+class CallSite
+{
+public:
+    // Index into `BytecodeInstructionSet::names`
+    uint32_t name = 0;
+    uint32_t argumentCount = 0;
+};
+
+// Fixed-width encoded instruction. Anything larger than an integer lives in the
+// operand tables of the owning `BytecodeInstructionSet` and is referenced by index.
 class Instruction
 {
 public:
     Opcode opcode;
-    RuntimeValue operand;
-
-    std::string debugContext;
+    // Index into `BytecodeInstructionSet::debugContexts`
+    uint16_t debugIndex = 0;
+    uint32_t operand = 0;
 };
 
+static_assert(sizeof(Instruction) == 8, "Instruction should stay 8 bytes");
+
 class BytecodeInstructionSet : public std::vector<Instruction>
 {
 public:
@@ -107,7 +312,36 @@ public:
 
     BytecodeInstructionSet& operator+=(Instruction&& rhs);
 
+    // Encodes `operand` according to `operandKind(opcode)`: constants and names are added to
+    // their tables, anything else must be an int (or None for no operand), call sites are
+    // passed as the index `addCallSite` returned
     BytecodeInstructionSet& push(Opcode opcode, const RuntimeValue& operand = RuntimeValue(), const std::string& debugContext = "");
-    
+
+    uint32_t addConstant(const RuntimeValue& value);
+    uint32_t addName(const std::string& name);
+    // Each field access site gets its own cache, they're never shared
+    uint32_t addFieldCache(const std::string& name);
+    uint16_t addDebugContext(const std::string& debugContext);
+    uint32_t addCallSite(const std::string& name, uint32_t argumentCount);
+
+    const RuntimeValue& constant(const Instruction& instruction) const { return constants[instruction.operand]; }
+    const InternedString& name(const Instruction& instruction) const { return names[instruction.operand]; }
+    const InternedString& fieldName(const Instruction& instruction) const { return names[fieldCaches[instruction.operand].name]; }
+    const std::string& debugContext(const Instruction& instruction) const { return debugContexts[instruction.debugIndex]; }
+    const CallSite& callSite(const Instruction& instruction) const { return callSites[instruction.operand]; }
+    const InternedString& calleeName(const Instruction& instruction) const { return names[callSite(instruction).name]; }
+
     void dump();
+
+    // Operand tables, shared by all instructions in the set
+    ConstantPool constants;
+    std::vector<InternedString> names;
+    // Filled in by the interpreter as it runs
+    std::vector<FieldCache> fieldCaches;
+    std::vector<CallSite> callSites;
+    std::vector<std::string> debugContexts = {""};
+
+private:
+    std::unordered_map<std::string, uint32_t> nameIndices;
+    std::unordered_map<std::string, uint16_t> debugContextIndices = {{"", 0}};
 };
@@ -0,0 +1,160 @@
+#include "BytecodeOptimizer.h"
+
+#include <algorithm>
+
+#include "SymbolTable.h"
+
+static bool isUnconditionalExit(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::JUMP:
+        case Opcode::RETURN:
+        case Opcode::RETURN_VALUE:
+        case Opcode::TAIL_CALL:
+        case Opcode::TAIL_CALL_DIRECT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+BytecodeOptimizer::BytecodeOptimizer() {
+    enabledRules.fill(true);
+}
+
+void BytecodeOptimizer::optimize(BytecodeInstructionSet& instructions, FunctionTable& functionTable) {
+    instructionsBefore = instructions.size();
+
+    for (;;) {
+        const size_t count = instructions.size();
+
+        // Function entries and jump targets can be reached from elsewhere, no rule may
+        // remove one as the second half of a pair or as dead code
+        std::vector<bool> isJumpTarget(count + 1, false);
+        std::vector<size_t> entries = {0};
+        for (auto& descriptor : functionTable.descriptors) {
+            isJumpTarget[descriptor.address] = true;
+            entries.push_back(descriptor.address);
+        }
+        for (auto& instruction : instructions) {
+            if (operandKind(instruction.opcode) == OperandKind::Address) {
+                isJumpTarget[instruction.operand] = true;
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+        entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+        entries.push_back(count);
+
+        std::vector<bool> isRemoved(count, false);
+        bool changed = false;
+        for (size_t i = 0; i + 1 < entries.size(); ++i) {
+            changed |= markFunction(instructions, entries[i], entries[i + 1], isJumpTarget, isRemoved);
+        }
+        if (!changed) {
+            break;
+        }
+
+        // A removed instruction maps to the next one that's kept, so jumps to it still land right
+        std::vector<uint32_t> newAddress(count + 1);
+        uint32_t kept = 0;
+        for (size_t pc = 0; pc < count; ++pc) {
+            newAddress[pc] = kept;
+            if (!isRemoved[pc]) {
+                ++kept;
+            }
+        }
+        newAddress[count] = kept;
+
+        size_t out = 0;
+        for (size_t pc = 0; pc < count; ++pc) {
+            if (isRemoved[pc]) {
+                continue;
+            }
+            Instruction instruction = instructions[pc];
+            if (operandKind(instruction.opcode) == OperandKind::Address) {
+                instruction.operand = newAddress[instruction.operand];
+            }
+            instructions[out++] = instruction;
+        }
+        instructions.resize(out);
+
+        for (auto& descriptor : functionTable.descriptors) {
+            descriptor.address = newAddress[descriptor.address];
+        }
+    }
+
+    instructionsAfter = instructions.size();
+}
+
+bool BytecodeOptimizer::markFunction(const BytecodeInstructionSet& instructions, size_t begin, size_t end,
+                                     const std::vector<bool>& isJumpTarget, std::vector<bool>& isRemoved) {
+    std::unordered_map<uint32_t, size_t> slotLoads;
+    for (size_t pc = begin; pc < end; ++pc) {
+        if (instructions[pc].opcode == Opcode::LOAD_LOCAL || instructions[pc].opcode == Opcode::TAKE_LOCAL) {
+            ++slotLoads[instructions[pc].operand];
+        } else if (instructions[pc].opcode == Opcode::LOAD_LOCAL_FIELD) {
+            ++slotLoads[instructions[pc].operand >> 16];
+        }
+    }
+
+    bool changed = false;
+    for (size_t pc = begin; pc < end; ++pc) {
+        if (isRemoved[pc]) {
+            continue;
+        }
+        const Instruction& current = instructions[pc];
+
+        if (isUnconditionalExit(current.opcode) && isEnabled(PeepholeRule::DeadCode)) {
+            for (size_t next = pc + 1; next < end && !isJumpTarget[next]; ++next) {
+                markRemoved(PeepholeRule::DeadCode, next, isRemoved);
+                changed = true;
+            }
+            continue;
+        }
+
+        if (current.opcode == Opcode::JUMP && current.operand == pc + 1 && isEnabled(PeepholeRule::NoOp)) {
+            markRemoved(PeepholeRule::NoOp, pc, isRemoved);
+            changed = true;
+            continue;
+        }
+
+        // The remaining rules remove `current` together with the instruction after it
+        if (pc + 1 >= end || isJumpTarget[pc + 1]) {
+            continue;
+        }
+        const Instruction& next = instructions[pc + 1];
+
+        bool removePair = false;
+        PeepholeRule rule = PeepholeRule::NoOp;
+        if (current.opcode == Opcode::STORE_LOCAL && next.opcode == Opcode::LOAD_LOCAL && current.operand == next.operand) {
+            // The stored value is already on the stack; only drop the slot if nothing else reads it
+            rule = PeepholeRule::StoreLoad;
+            removePair = slotLoads[current.operand] == 1;
+        } else if ((current.opcode == Opcode::LOAD_CONST || current.opcode == Opcode::LOAD_LOCAL) && next.opcode == Opcode::POP) {
+            removePair = true;
+        } else if (current.opcode == Opcode::LOAD_LOCAL && next.opcode == Opcode::STORE_LOCAL && current.operand == next.operand) {
+            removePair = true;
+        }
+
+        if (removePair && isEnabled(rule)) {
+            markRemoved(rule, pc, isRemoved);
+            markRemoved(rule, pc + 1, isRemoved);
+            changed = true;
+            ++pc;
+        }
+    }
+    return changed;
+}
+
+void BytecodeOptimizer::markRemoved(PeepholeRule rule, size_t pc, std::vector<bool>& isRemoved) {
+    isRemoved[pc] = true;
+    ++removed[static_cast<size_t>(rule)];
+}
+
+void BytecodeOptimizer::dumpStats() const {
+    std::cout << "------------ peephole: " << instructionsBefore << " -> " << instructionsAfter << " instructions" << std::endl;
+#define PEEPHOLE_RULE_STATS(name, description) \
+    std::cout << "  " << std::left << std::setw(18) << description << std::right << removed[static_cast<size_t>(PeepholeRule::name)] \
+        << (isEnabled(PeepholeRule::name) ? "" : " (disabled)") << std::endl;
+    PEEPHOLE_RULE_LIST(PEEPHOLE_RULE_STATS)
+#undef PEEPHOLE_RULE_STATS
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+
+#include "BytecodeInstructions.h"
+#include "Common.h"
+
+class FunctionTable;
+
+// Peephole rules of `BytecodeOptimizer`. Expanded with `X(name, description)`.
+#define PEEPHOLE_RULE_LIST(X) \
+    /* STORE_LOCAL n; LOAD_LOCAL n where slot n is read nowhere else in the function */ \
+    X(StoreLoad, "store/load pairs") \
+    /* Instructions after RETURN/RETURN_VALUE/JUMP/TAIL_CALL that no jump lands on */ \
+    X(DeadCode, "dead code") \
+    /* Jumps to the next instruction, loads that are popped right away, `x = x` */ \
+    X(NoOp, "no-op sequences")
+
+enum class PeepholeRule : uint8_t
+{
+#define PEEPHOLE_RULE_ENUM(name, description) name,
+    PEEPHOLE_RULE_LIST(PEEPHOLE_RULE_ENUM)
+#undef PEEPHOLE_RULE_ENUM
+    Count
+};
+
+// Removes redundant instructions from compiled bytecode. Runs after `Compiler::compileProgram`
+// (and its `link`), then patches jump operands and `FunctionTable` addresses to the new layout.
+class BytecodeOptimizer
+{
+public:
+    static constexpr size_t RuleCount = static_cast<size_t>(PeepholeRule::Count);
+
+    // Instructions removed by each rule, across all passes
+    std::array<size_t, RuleCount> removed = {};
+
+    BytecodeOptimizer();
+
+    void setEnabled(PeepholeRule rule, bool enabled) { enabledRules[static_cast<size_t>(rule)] = enabled; }
+
+    [[nodiscard]] bool isEnabled(PeepholeRule rule) const { return enabledRules[static_cast<size_t>(rule)]; }
+
+    // Repeats passes until nothing changes, removing one pair can expose another
+    void optimize(BytecodeInstructionSet& instructions, FunctionTable& functionTable);
+
+    void dumpStats() const;
+
+private:
+    std::array<bool, RuleCount> enabledRules = {};
+
+    size_t instructionsBefore = 0;
+    size_t instructionsAfter = 0;
+
+    // Marks removable instructions in `[begin, end)`, returns whether anything was marked
+    bool markFunction(const BytecodeInstructionSet& instructions, size_t begin, size_t end,
+                      const std::vector<bool>& isJumpTarget, std::vector<bool>& isRemoved);
+
+    void markRemoved(PeepholeRule rule, size_t pc, std::vector<bool>& isRemoved);
+};
@@ -0,0 +1,33 @@
+#include "ConstantPool.h"
+
+#include <bit>
+
+uint32_t ConstantPool::append(const RuntimeValue& value) {
+    values.push_back(value);
+    return static_cast<uint32_t>(values.size() - 1);
+}
+
+uint32_t ConstantPool::add(const RuntimeValue& value) {
+    auto intern = [&](auto& indices, const auto& key) {
+        if (const auto it = indices.find(key); it != indices.end()) {
+            return it->second;
+        }
+        const uint32_t index = append(value);
+        indices.emplace(key, index);
+        return index;
+    };
+
+    switch (value.type) {
+        case ValueType::Int:
+            return intern(intIndices, value.asInt());
+        case ValueType::Float:
+            return intern(floatIndices, std::bit_cast<uint32_t>(value.asFloat()));
+        case ValueType::String:
+            return intern(stringIndices, value.asString());
+        case ValueType::Bool:
+            return intern(boolIndices, value.asBool());
+        default:
+            // Structs/None literals aren't deduplicated
+            return append(value);
+    }
+}
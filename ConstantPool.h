@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Common.h"
+#include "RuntimeValue.h"
+
+// Per-program table of literal values. Each distinct int/float/bool/string literal
+// is stored once and `LOAD_CONST` refers to it by index.
+class ConstantPool
+{
+    std::vector<RuntimeValue> values;
+
+    std::unordered_map<int, uint32_t> intIndices;
+    // Keyed by bit pattern so that e.g. 0.0 and -0.0 stay distinct
+    std::unordered_map<uint32_t, uint32_t> floatIndices;
+    std::unordered_map<std::string, uint32_t> stringIndices;
+    std::unordered_map<bool, uint32_t> boolIndices;
+
+    uint32_t append(const RuntimeValue& value);
+
+public:
+    // Returns the index of `value`, adding it if no equal constant exists yet
+    uint32_t add(const RuntimeValue& value);
+
+    const RuntimeValue& operator[](uint32_t index) const { return values[index]; }
+
+    [[nodiscard]] size_t size() const { return values.size(); }
+
+    auto begin() const { return values.begin(); }
+    auto end() const { return values.end(); }
+};
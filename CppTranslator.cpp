@@ -0,0 +1,437 @@
+#include "CppTranslator.h"
+
+#include <bit>
+#include <format>
+#include <set>
+
+#include "AotRuntime.h"
+#include "StructLayout.h"
+#include "SymbolTable.h"
+
+namespace
+{
+    // Operation of an arithmetic opcode and the operand type the compiler proved for it,
+    // None for the generic (and quickened, which still check) forms
+    bool decodeArithmetic(Opcode opcode, ArithmeticOp& outOp, ValueType& outType) {
+        switch (opcode) {
+#define TRANSLATED_INT_ARITHMETIC(op) \
+            case Opcode::op: \
+            case Opcode::op##_INT_INT: outOp = ArithmeticOp::op; outType = ValueType::None; return true; \
+            case Opcode::op##_INT: outOp = ArithmeticOp::op; outType = ValueType::Int; return true;
+#define TRANSLATED_ARITHMETIC(op) \
+            TRANSLATED_INT_ARITHMETIC(op) \
+            case Opcode::op##_FLOAT_FLOAT: outOp = ArithmeticOp::op; outType = ValueType::None; return true; \
+            case Opcode::op##_FLOAT: outOp = ArithmeticOp::op; outType = ValueType::Float; return true;
+            TRANSLATED_ARITHMETIC(ADD)
+            TRANSLATED_ARITHMETIC(SUB)
+            TRANSLATED_ARITHMETIC(MUL)
+            TRANSLATED_ARITHMETIC(DIV)
+            TRANSLATED_INT_ARITHMETIC(MOD)
+            TRANSLATED_ARITHMETIC(EQ)
+            TRANSLATED_ARITHMETIC(NEQ)
+            TRANSLATED_ARITHMETIC(LT)
+            TRANSLATED_ARITHMETIC(LTE)
+            TRANSLATED_ARITHMETIC(GT)
+            TRANSLATED_ARITHMETIC(GTE)
+#undef TRANSLATED_ARITHMETIC
+#undef TRANSLATED_INT_ARITHMETIC
+            default:
+                return false;
+        }
+    }
+
+    // Name of `op`'s `ArithmeticOp` enumerator, `to_string` gives its C++ operator
+    const char* enumerator(ArithmeticOp op) {
+        switch (op) {
+            case ArithmeticOp::ADD: return "ADD";
+            case ArithmeticOp::SUB: return "SUB";
+            case ArithmeticOp::MUL: return "MUL";
+            case ArithmeticOp::DIV: return "DIV";
+            case ArithmeticOp::MOD: return "MOD";
+            case ArithmeticOp::EQ: return "EQ";
+            case ArithmeticOp::NEQ: return "NEQ";
+            case ArithmeticOp::LT: return "LT";
+            case ArithmeticOp::LTE: return "LTE";
+            case ArithmeticOp::GT: return "GT";
+            default: return "GTE";
+        }
+    }
+
+    bool isComparison(ArithmeticOp op) {
+        return op != ArithmeticOp::ADD && op != ArithmeticOp::SUB && op != ArithmeticOp::MUL && op != ArithmeticOp::DIV && op != ArithmeticOp::MOD;
+    }
+
+    // String literal with the characters of `value`, anything unusual as an octal escape
+    std::string cppString(const std::string& value) {
+        std::string literal = "\"";
+        for (const char c : value) {
+            const auto byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\' || byte < 0x20 || byte >= 0x7F) {
+                literal += std::format("\\{:03o}", byte);
+            } else {
+                literal += c;
+            }
+        }
+        return literal + "\"";
+    }
+
+    std::string cppConstant(const RuntimeValue& value) {
+        switch (value.type) {
+            case ValueType::Int:
+                // The literal 2147483648 doesn't fit an int, so `-2147483648` would be a long
+                if (value.asInt() == INT32_MIN) {
+                    return "RuntimeValue(-2147483647 - 1)";
+                }
+                return std::format("RuntimeValue({})", value.asInt());
+            case ValueType::Float: return std::format("RuntimeValue(std::bit_cast<float>(0x{:08X}u))", std::bit_cast<uint32_t>(value.asFloat()));
+            case ValueType::Bool: return value.asBool() ? "RuntimeValue(true)" : "RuntimeValue(false)";
+            case ValueType::String: return std::format("RuntimeValue(std::string({}))", cppString(value.asString()));
+            default: return "RuntimeValue()";
+        }
+    }
+
+    std::string slot(uint32_t index) {
+        return std::format("s[{}]", index);
+    }
+}
+
+CppTranslator::CppTranslator(const BytecodeInstructionSet& instructions, const FunctionTable& functionTable, const StructLayoutTable& structLayouts):
+    instructions(instructions),
+    functionTable(functionTable),
+    structLayouts(structLayouts) {}
+
+void CppTranslator::translate(std::ostream& os, const std::string& source, const std::string& namespaceName) {
+    os << "// Translated from " << source << " by `ScriptingLang --emit-cpp`, don't edit\n"
+        << "#include <bit>\n\n"
+        << "#include \"AotRuntime.h\"\n\n"
+        << "namespace " << namespaceName << "\n{\n";
+
+    if (instructions.constants.size() > 0) {
+        os << "static const RuntimeValue constants[] = {\n";
+        for (const auto& constant : instructions.constants) {
+            os << "    " << cppConstant(constant) << ",\n";
+        }
+        os << "};\n\n";
+    }
+
+    const auto functionCount = static_cast<uint32_t>(functionTable.descriptors.size());
+    for (uint32_t i = 0; i < functionCount; ++i) {
+        os << "static bool " << functionName(i) << "(AotContext& ctx, RuntimeValue* args, RuntimeValue& result);\n";
+    }
+    for (uint32_t i = 0; i < functionCount; ++i) {
+        os << "\n";
+        translateFunction(os, i);
+    }
+
+    os << "\nExecutionResult runMain() {\n"
+        << "    ExecutionResult result;\n";
+    uint32_t mainIndex;
+    if (!functionTable.lookup("main", mainIndex)) {
+        os << "    result.error.raise(VMStatus::NoMain, \"Main function not found\");\n"
+            << "    return result;\n"
+            << "}\n";
+    } else {
+        os << "    AotContext ctx;\n";
+        if (!instructions.names.empty()) {
+            os << "    ctx.names = {";
+            for (const auto& name : instructions.names) {
+                os << cppString(name) << ", ";
+            }
+            os << "};\n";
+        }
+        if (!instructions.fieldCaches.empty()) {
+            os << "    ctx.fieldCaches = {";
+            for (const auto& cache : instructions.fieldCaches) {
+                os << "FieldCache(" << cache.name << "), ";
+            }
+            os << "};\n";
+        }
+        if (!structLayouts.layouts.empty()) {
+            // Same order as the compiler's table, NEW_STRUCT and struct checks refer to them by index
+            os << "    ctx.structLayouts.define({\n";
+            for (const auto& layout : structLayouts.layouts) {
+                os << "        std::make_shared<StructLayout>(" << cppString(layout->name) << ", std::vector<std::string>{";
+                for (const auto& fieldName : layout->fieldNames) {
+                    os << cppString(fieldName) << ", ";
+                }
+                os << "}, std::vector<std::string>{";
+                for (const auto& fieldType : layout->fieldTypes) {
+                    os << cppString(fieldType) << ", ";
+                }
+                os << "}),\n";
+            }
+            os << "    });\n";
+        }
+        os << "    if (!ctx.run(" << functionName(mainIndex) << ", result.value)) {\n"
+            << "        result.error = std::move(ctx.error);\n"
+            << "    }\n"
+            << "    return result;\n"
+            << "}\n";
+    }
+
+    os << "}\n";
+}
+
+std::map<uint32_t, uint32_t> CppTranslator::operandDepths(uint32_t address) const {
+    // Same walk as `Compiler::maxStackDepth`, keeping the depth of every instruction
+    std::map<uint32_t, uint32_t> depths = {{address, 0}};
+    std::vector<uint32_t> pending = {address};
+
+    while (!pending.empty()) {
+        uint32_t pc = pending.back();
+        pending.pop_back();
+        int depth = static_cast<int>(depths[pc]);
+
+        for (;;) {
+            const Instruction& instruction = instructions[pc];
+            const Opcode opcode = instruction.opcode;
+            depth += stackEffect(opcode);
+            if (opcode == Opcode::CALL_DIRECT) {
+                depth -= functionTable.descriptors[instruction.operand].arity;
+            }
+
+            if (opcode == Opcode::JUMP || opcode == Opcode::JUMP_IF_FALSE) {
+                if (depths.try_emplace(instruction.operand, depth).second) {
+                    pending.push_back(instruction.operand);
+                }
+            }
+            // A late-bound call that's still unresolved always faults, its arity isn't known
+            if (opcode == Opcode::JUMP || opcode == Opcode::RETURN || opcode == Opcode::RETURN_VALUE ||
+                opcode == Opcode::TAIL_CALL || opcode == Opcode::TAIL_CALL_DIRECT || opcode == Opcode::CALL_FUNC) {
+                break;
+            }
+            if (!depths.try_emplace(++pc, depth).second) {
+                break;
+            }
+        }
+    }
+    return depths;
+}
+
+void CppTranslator::translateFunction(std::ostream& os, uint32_t functionIndex) {
+    const FunctionDescriptor& descriptor = functionTable.descriptors[functionIndex];
+    const auto& node = functionTable.node(functionIndex);
+    const std::map<uint32_t, uint32_t> depths = operandDepths(descriptor.address);
+
+    uint32_t maxDepth = 0;
+    std::set<uint32_t> labels;
+    for (const auto& [pc, depth] : depths) {
+        maxDepth = std::max(maxDepth, depth + 1);
+        const Instruction& instruction = instructions[pc];
+        if (instruction.opcode == Opcode::JUMP || instruction.opcode == Opcode::JUMP_IF_FALSE) {
+            labels.insert(instruction.operand);
+        } else if (instruction.opcode == Opcode::TAIL_CALL_DIRECT && instruction.operand == functionIndex) {
+            labels.insert(descriptor.address);
+        }
+    }
+    const uint32_t frameSlots = descriptor.frameSize + maxDepth;
+    if (frameSlots > AotContext::SegmentSize) {
+        throw std::runtime_error("[CppTranslator::translateFunction] Frame of " + node->name + " is too large");
+    }
+
+    os << "// " << node->returnType << " " << node->name << "(";
+    for (size_t i = 0; i < node->parameters.size(); ++i) {
+        os << (i ? ", " : "") << node->parameters[i].first << " " << node->parameters[i].second;
+    }
+    os << ")\n"
+        << "static bool " << functionName(functionIndex) << "(AotContext& ctx, RuntimeValue* args, RuntimeValue& result) {\n"
+        << "    AotContext::Frame frame(ctx, " << frameSlots << ", " << cppString(node->name) << ");\n"
+        << "    RuntimeValue* const s = frame.slots;\n"
+        << "    if (!s) {\n"
+        << "        return false;\n"
+        << "    }\n";
+    for (uint32_t i = 0; i < descriptor.arity; ++i) {
+        os << "    " << slot(i) << " = std::move(args[" << i << "]);\n";
+    }
+
+    for (const auto& [pc, depth] : depths) {
+        if (labels.contains(pc)) {
+            os << "pc" << pc << ":\n";
+        }
+        translateInstruction(os, functionIndex, pc, depth);
+    }
+    os << "}\n";
+}
+
+void CppTranslator::translateInstruction(std::ostream& os, uint32_t functionIndex, uint32_t pc, uint32_t depth) {
+    const FunctionDescriptor& descriptor = functionTable.descriptors[functionIndex];
+    const Instruction& instruction = instructions[pc];
+    const uint32_t operand = instruction.operand;
+    // Slot of the top operand and of the next one pushed
+    const uint32_t top = descriptor.frameSize + depth - 1;
+    const uint32_t next = top + 1;
+
+    const std::string fault = std::format("return ctx.fault({}, \"{}\", {});", pc, to_string(instruction.opcode), cppString(functionTable.node(functionIndex)->name));
+    const auto check = [&](const std::string& call) {
+        os << "    if (!" << call << ") {\n"
+            << "        " << fault << "\n"
+            << "    }\n";
+    };
+    const auto raise = [&](const std::string& status, const std::string& message) {
+        os << "    ctx.error.raise(VMStatus::" << status << ", " << cppString(message) << ");\n"
+            << "    " << fault << "\n";
+    };
+
+    ArithmeticOp op;
+    ValueType provenType;
+    if (decodeArithmetic(instruction.opcode, op, provenType)) {
+        const std::string left = slot(top - 1), right = slot(top);
+        const auto emitRaw = [&](const char* accessor, const std::string& indent) {
+            if (isComparison(op)) {
+                os << indent << left << " = " << left << "." << accessor << "() " << to_string(op) << " " << right << "." << accessor << "();\n";
+            } else if (std::string_view(accessor) == "uncheckedInt") {
+                // Ints wrap like in the VMs, the C++ operators would overflow
+                static constexpr const char* functions[] = {"wrappingAdd", "wrappingSub", "wrappingMul", "wrappingDiv", "wrappingMod"};
+                os << indent << left << ".uncheckedInt() = " << functions[static_cast<int>(op)] << "(" << left << ".uncheckedInt(), " << right << ".uncheckedInt());\n";
+            } else {
+                os << indent << left << "." << accessor << "() " << to_string(op) << "= " << right << "." << accessor << "();\n";
+            }
+        };
+
+        if (provenType == ValueType::Int) {
+            if (op == ArithmeticOp::DIV || op == ArithmeticOp::MOD) {
+                os << "    if (" << right << ".uncheckedInt() == 0) {\n"
+                    << "        ctx.error.raise(VMStatus::DivisionByZero, \"Division by zero\");\n"
+                    << "        " << fault << "\n"
+                    << "    }\n";
+            }
+            emitRaw("uncheckedInt", "    ");
+        } else if (provenType == ValueType::Float) {
+            emitRaw("uncheckedFloat", "    ");
+        } else if (op == ArithmeticOp::DIV || op == ArithmeticOp::MOD) {
+            check(std::format("ctx.binaryOp({}, ArithmeticOp::{}, {})", left, enumerator(op), right));
+        } else {
+            // Ints go inline, like the interpreter's quickened forms
+            os << "    if (" << left << ".type == ValueType::Int && " << right << ".type == ValueType::Int) {\n";
+            emitRaw("uncheckedInt", "        ");
+            os << "    } else if (!ctx.binaryOp(" << left << ", ArithmeticOp::" << enumerator(op) << ", " << right << ")) {\n"
+                << "        " << fault << "\n"
+                << "    }\n";
+        }
+        return;
+    }
+
+    switch (instruction.opcode) {
+        case Opcode::LOAD_CONST:
+            os << "    " << slot(next) << " = constants[" << operand << "];\n";
+            break;
+        case Opcode::CHECK_TYPE:
+            check(std::format("ctx.checkType({}, ValueType::{})", slot(top), to_string(static_cast<ValueType>(operand))));
+            break;
+        case Opcode::CHECK_LOCAL_TYPE:
+            check(std::format("ctx.checkType({}, ValueType::{})", slot(operand >> 8), to_string(static_cast<ValueType>(operand & 0xFF))));
+            break;
+        case Opcode::CHECK_STRUCT:
+            check(std::format("ctx.checkStruct({}, {})", slot(top), operand));
+            break;
+        case Opcode::CHECK_LOCAL_STRUCT:
+            check(std::format("ctx.checkStruct({}, {})", slot(operand >> 16), operand & 0xFFFF));
+            break;
+        case Opcode::LOAD_VAR:
+            check(std::format("ctx.loadVar({}, {})", operand, slot(next)));
+            break;
+        case Opcode::STORE_VAR:
+            os << "    ctx.storeVar(" << operand << ", std::move(" << slot(top) << "));\n";
+            break;
+        case Opcode::LOAD_LOCAL:
+            os << "    " << slot(next) << " = " << slot(operand) << ";\n";
+            break;
+        case Opcode::STORE_LOCAL:
+            os << "    " << slot(operand) << " = std::move(" << slot(top) << ");\n";
+            break;
+        case Opcode::TAKE_LOCAL:
+            os << "    " << slot(next) << " = std::move(" << slot(operand) << ");\n";
+            break;
+        case Opcode::STORE_FIELD:
+            check(std::format("ctx.storeField({}, {}, {})", operand, slot(top - 1), slot(top)));
+            break;
+        case Opcode::LOAD_FIELD:
+            check(std::format("ctx.loadField({}, {})", operand, slot(top)));
+            break;
+        case Opcode::NEW_STRUCT:
+            os << "    " << slot(next) << " = ctx.structLayouts[" << operand << "].instantiate();\n";
+            break;
+        case Opcode::STORE_FIELD_IDX:
+            os << "    " << slot(top) << ".mutableStruct().fields[" << operand << "] = std::move(" << slot(top - 1) << ");\n"
+                << "    " << slot(top - 1) << " = std::move(" << slot(top) << ");\n";
+            break;
+        case Opcode::LOAD_FIELD_IDX:
+            // Copy out first, the struct holding it is what gets replaced
+            os << "    " << slot(top) << " = RuntimeValue(" << slot(top) << ".asStruct().fields[" << operand << "]);\n";
+            break;
+        case Opcode::LOAD_LOCAL_FIELD:
+            os << "    " << slot(next) << " = " << slot(operand >> 16) << ".asStruct().fields[" << (operand & 0xFFFF) << "];\n";
+            break;
+        case Opcode::JUMP:
+            os << "    goto pc" << operand << ";\n";
+            break;
+        case Opcode::JUMP_IF_FALSE:
+            os << "    if (!" << slot(top) << ".isTruthy()) {\n"
+                << "        goto pc" << operand << ";\n"
+                << "    }\n";
+            break;
+        case Opcode::CALL_FUNC:
+        case Opcode::TAIL_CALL:
+            raise("UndefinedFunction", "Function not found: " + instructions.calleeName(instruction).str());
+            break;
+        case Opcode::CALL_DIRECT: {
+            const uint32_t firstArg = next - argumentCount(operand, depth);
+            os << "    if (!ctx.call(" << functionName(operand) << ", s + " << firstArg << ", " << slot(firstArg) << ")) {\n"
+                << "        return false;\n"
+                << "    }\n";
+            break;
+        }
+        case Opcode::TAIL_CALL_DIRECT: {
+            const uint32_t firstArg = next - argumentCount(operand, depth);
+            if (operand != functionIndex) {
+                // Returns to the caller's `ctx.call` first, so mutual recursion doesn't nest native calls
+                os << "    {\n"
+                    << "        RuntimeValue* tailArgs = ctx.tailCall(" << functionName(operand) << ", " << functionTable.descriptors[operand].arity << ");\n";
+                for (uint32_t i = 0; i < functionTable.descriptors[operand].arity; ++i) {
+                    os << "        tailArgs[" << i << "] = std::move(" << slot(firstArg + i) << ");\n";
+                }
+                os << "    }\n"
+                    << "    return true;\n";
+                break;
+            }
+            // Loops back into the same frame, the interpreter resets the locals and checks for a collection
+            os << "    ObjectHeap::safepoint();\n";
+            for (uint32_t i = 0; i < descriptor.frameSize; ++i) {
+                if (i < descriptor.arity) {
+                    os << "    " << slot(i) << " = std::move(" << slot(firstArg + i) << ");\n";
+                } else {
+                    os << "    " << slot(i) << " = RuntimeValue();\n";
+                }
+            }
+            os << "    goto pc" << descriptor.address << ";\n";
+            break;
+        }
+        case Opcode::POP:
+            os << "    " << slot(top) << " = RuntimeValue();\n";
+            break;
+        case Opcode::RETURN_VALUE:
+            os << "    result = std::move(" << slot(top) << ");\n"
+                << "    return true;\n";
+            break;
+        case Opcode::RETURN:
+            os << "    result = RuntimeValue();\n"
+                << "    return true;\n";
+            break;
+        default:
+            raise("InvalidOpcode", "Invalid opcode");
+            break;
+    }
+}
+
+uint32_t CppTranslator::argumentCount(uint32_t functionIndex, uint32_t depth) const {
+    const uint32_t arity = functionTable.descriptors[functionIndex].arity;
+    if (arity > depth) {
+        throw std::runtime_error("[CppTranslator::argumentCount] Call to " + functionTable.node(functionIndex)->name + " has fewer operands than arguments");
+    }
+    return arity;
+}
+
+std::string CppTranslator::functionName(uint32_t functionIndex) const {
+    // Indexed, a script may define a function more than once or use a C++ keyword as a name
+    return std::format("function{}_{}", functionIndex, functionTable.node(functionIndex)->name);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+
+#include "BytecodeInstructions.h"
+#include "Common.h"
+
+class FunctionTable;
+class StructLayoutTable;
+
+// Ahead-of-time translation of compiled bytecode to a C++ translation unit, for scripts that
+// are deployed as part of a host binary (`ScriptingLang --emit-cpp`, `add_scripting_lang_aot`).
+//
+// Every script function becomes a C++ function whose instructions are straight-line code over
+// its frame's slots, with `goto`s for jumps and direct C++ calls between functions. Values stay
+// `RuntimeValue`s handled through the same API as the interpreter; the typed opcodes the
+// compiler emitted, and generic arithmetic on two ints, work on raw ints and floats instead.
+// The unit only depends on `AotRuntime.h` and defines `<namespace>::runMain()`.
+//
+// Translate the optimized bytecode, before an interpreter has run (and quickened) it.
+class CppTranslator
+{
+public:
+    CppTranslator(const BytecodeInstructionSet& instructions, const FunctionTable& functionTable, const StructLayoutTable& structLayouts);
+
+    // Writes the translation unit of the whole program. `source` only goes in its header comment.
+    void translate(std::ostream& os, const std::string& source, const std::string& namespaceName = "script");
+
+private:
+    const BytecodeInstructionSet& instructions;
+    const FunctionTable& functionTable;
+    const StructLayoutTable& structLayouts;
+
+    // Operand depth before each reachable instruction of the function at `address`
+    [[nodiscard]] std::map<uint32_t, uint32_t> operandDepths(uint32_t address) const;
+
+    void translateFunction(std::ostream& os, uint32_t functionIndex);
+
+    // Statements for the instruction at `pc`, run with `depth` operands above the frame's locals
+    void translateInstruction(std::ostream& os, uint32_t functionIndex, uint32_t pc, uint32_t depth);
+
+    // Arity of the callee at `depth` operands, throws if they can't hold its arguments
+    [[nodiscard]] uint32_t argumentCount(uint32_t functionIndex, uint32_t depth) const;
+
+    // C++ name of function descriptor `functionIndex`
+    [[nodiscard]] std::string functionName(uint32_t functionIndex) const;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory_resource>
+
+#include "Common.h"
+
+// Memory for one script run. Allocations are bumped out of a block that's kept for the life
+// of the arena, anything past it comes from the system in growing chunks. Nothing is freed
+// on its own: `release` drops every allocation at once and starts over at the block.
+class ExecutionArena
+{
+public:
+    explicit ExecutionArena(size_t blockSize) :
+        block(std::make_unique_for_overwrite<std::byte[]>(blockSize)),
+        resource(block.get(), blockSize, std::pmr::new_delete_resource()) {}
+
+    ExecutionArena(const ExecutionArena&) = delete;
+    ExecutionArena& operator=(const ExecutionArena&) = delete;
+
+    std::pmr::memory_resource* memory() { return &resource; }
+
+    // Every container allocating from the arena must be gone or empty by now
+    void release() { resource.release(); }
+
+private:
+    std::unique_ptr<std::byte[]> block;
+    std::pmr::monotonic_buffer_resource resource;
+};
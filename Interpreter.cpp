@@ -1,207 +1,798 @@
 #include "Interpreter.h"
 
+#include <algorithm>
+
+#include "BytecodeImage.h"
 #include "compiler.h"
+#include "StructLayout.h"
 #include "SymbolTable.h"
 #include "Utils.h"
 
 
 Interpreter::Interpreter(const Compiler& compiler):
-    functionTable(compiler.functionTable) {
-    bytecode = compiler.instructions;
+    Interpreter(compiler.functionTable, compiler.structLayouts, compiler.instructions) {
+    use(bytecode, bytecode);
+}
+
+Interpreter::Interpreter(BytecodeImage& image):
+    Interpreter(image.functionTable, image.structLayouts, image.tables) {
+    use(image.code, {});
+}
+
+Interpreter::Interpreter(Shared<FunctionTable> functionTable, Shared<StructLayoutTable> structLayouts, const BytecodeInstructionSet& tables):
+    globals(std::allocate_shared<SymbolTable>(std::pmr::polymorphic_allocator<>(arena.memory()), nullptr, arena.memory())),
+    functionTable(std::move(functionTable)),
+    structLayouts(std::move(structLayouts)) {
+    bytecode = tables;
+    callStack.reserve(CallStackCapacity);
+
+    heapRoots = ObjectHeap::addRoots([this] {
+        for (const auto& value : stack) {
+            ObjectHeap::mark(value);
+        }
+        for (const auto& [name, value] : globals->values()) {
+            ObjectHeap::mark(value);
+        }
+        for (uint32_t i = 0; i < bytecode.constants.size(); ++i) {
+            ObjectHeap::mark(bytecode.constants[i]);
+        }
+    });
+}
+
+Interpreter::~Interpreter() {
+    ObjectHeap::removeRoots(heapRoots);
+}
+
+void Interpreter::use(std::span<const Instruction> instructions, std::span<Instruction> writable) {
+    code = instructions;
+    writableCode = writable;
+#if INTERPRETER_JIT
+    jit = std::make_unique<Jit>(code, bytecode, *functionTable);
+#endif
 }
 
 Shared<SymbolTable> Interpreter::getTable() {
-    auto& frame = callStack.back();
-    return frame.locals;
+    return globals;
 }
 
-void Interpreter::execute() {
+ExecutionResult Interpreter::execute() {
     TIMED_FUNCTION();
-    
-    size_t pc = 0; // Program counter
-
-    size_t startAddress;
-    Shared<FunctionNode> func;
-    if (!functionTable->resolve("main", func, startAddress)) {
-        std::cerr << "Main function not found" << std::endl;
-        return;
-    }
-
-    pc = startAddress;
-    // callStack.push_back(StackFrame(startAddress));
-
-    // Variable to capture the return value
-    RuntimeValue returnValue;
-    // Flag to indicate if a return value was captured
-    bool returned = false;
-
-    executeFunction("main", pc);
-    
-    if (pc == (startAddress + 1) && callStack.empty()) {
-        // If we've returned to the start of `main` and the call stack is empty,
-        // it means `main` has finished executing
-        if (!stack.empty()) {
-            // Assume the top of the stack holds `main`'s return value
-            returnValue = stack.pop();
-            returned = true;
-        }
+
+    ExecutionResult result = runMain();
+    if (!result.ok()) {
+        std::cerr << "Runtime error: " << result.error << std::endl;
+        return result;
     }
 
-    std::cout << "Execution complete. Address: " << pc << std::endl;
-    if (returned) {
-        std::cout << "Return value of main: " << returnValue << std::endl;
+    std::cout << "Execution complete." << std::endl;
+    if (result.value.type != ValueType::None) {
+        std::cout << "Return value of main: " << result.value << std::endl;
     } else {
         std::cout << "No return value." << std::endl;
     }
+    return result;
 }
 
+ExecutionResult Interpreter::runMain() {
+    ExecutionResult result;
+    uint32_t mainIndex;
+    if (!functionTable->lookup("main", mainIndex)) {
+        result.error.raise(VMStatus::NoMain, "Main function not found");
+        return result;
+    }
 
-void Interpreter::executeInstruction(size_t& pc) {
-    auto& instruction = bytecode[pc];
-
-    switch (instruction.opcode) {
-        case Opcode::LOAD_CONST:
-            stack.push_back(instruction.operand);
-            break;
-        case Opcode::ADD:
-            executeAdd();
-            break;
-        case Opcode::SUB:
-            // Pop two operands
-            // Subtract them
-            // Push result
-            break;
-        case Opcode::MUL:
-            // Pop two operands
-            // Multiply them
-            // Push result
-            break;
-        case Opcode::DIV:
-            // Pop two operands
-            // Divide them
-            // Push result
-            break;
-        case Opcode::LOAD_VAR:
-            executeLoadVar(instruction.operand.asString());
-            break;
-        case Opcode::STORE_VAR:
-            executeStoreVar(instruction.operand.asString());
-            break;
-        case Opcode::LOAD_FIELD:
-            executeLoadField(instruction.operand.asString());
-            break;
-        case Opcode::STORE_FIELD:
-            executeStoreField(instruction.operand.asString());
-            break;
-
-        case Opcode::CALL_FUNC:
-            executeFunction(instruction.operand.asString(), pc);
-            break;
-
-        case Opcode::RETURN:
-        case Opcode::RETURN_VALUE:
-            executeReturnValue(instruction, pc);
-            break;
-        default:
-            throw std::runtime_error("Invalid opcode");
+    error = VMError();
+    size_t pc = functionTable->descriptors[mainIndex].address;
+    if (executeCall(mainIndex, pc) && run(pc)) {
+        // Every call leaves exactly one value, None for a bare `return`
+        result.value = stack.pop();
+    } else {
+        result.error = std::move(error);
     }
+    resetExecution();
+    return result;
+}
+
+void Interpreter::resetExecution() {
+    // Values and containers are destroyed while the memory they point into is still there
+    globals.reset();
+    std::pmr::vector<StackFrame>(arena.memory()).swap(callStack);
+    OperandStack(0, arena.memory()).swap(stack);
+
+    arena.release();
 
-    pc++;
+    globals = std::allocate_shared<SymbolTable>(std::pmr::polymorphic_allocator<>(arena.memory()), nullptr, arena.memory());
+    callStack.reserve(CallStackCapacity);
+    stack.reserve(ValueStackCapacity);
 }
 
-void Interpreter::executeInstructionsUntilAddress(size_t& pc, size_t address) {
-    while (pc < bytecode.size() && pc != address) {
-        executeInstruction(pc);
+
+#if INTERPRETER_INSTRUCTION_STATS
+#define VM_COUNT() ++executedInstructions
+#else
+#define VM_COUNT() (void)0
+#endif
+
+// Specialized version of generic arithmetic `opcode` for operands of these types, `opcode` if there's none
+static Opcode quickenedOpcode(Opcode opcode, ValueType left, ValueType right) {
+    if (left != right) {
+        return opcode;
+    }
+
+    switch (opcode) {
+#define QUICKENED_OPCODE(op) \
+        case Opcode::op: \
+            if (left == ValueType::Int) return Opcode::op##_INT_INT; \
+            if (left == ValueType::Float) return Opcode::op##_FLOAT_FLOAT; \
+            return opcode;
+        QUICKENED_OPCODE(ADD)
+        QUICKENED_OPCODE(SUB)
+        QUICKENED_OPCODE(MUL)
+        QUICKENED_OPCODE(DIV)
+        QUICKENED_OPCODE(EQ)
+        QUICKENED_OPCODE(NEQ)
+        QUICKENED_OPCODE(LT)
+        QUICKENED_OPCODE(LTE)
+        QUICKENED_OPCODE(GT)
+        QUICKENED_OPCODE(GTE)
+#undef QUICKENED_OPCODE
+        case Opcode::MOD:
+            // Float modulus throws, it's left to the generic version
+            return left == ValueType::Int ? Opcode::MOD_INT_INT : opcode;
+        default:
+            return opcode;
     }
 }
 
-void Interpreter::executeAdd() {
-    RuntimeValue right = stack.pop();
-    RuntimeValue left = stack.pop();
+#if INTERPRETER_THREADED_DISPATCH
+#define VM_HANDLER(op) op_##op:
+#define VM_DISPATCH() \
+    VM_COUNT(); \
+    goto *(threaded ? threadedCode[pc] : handlers[static_cast<size_t>(code[pc].opcode)])
+#else
+#define VM_HANDLER(op) case Opcode::op:
+#define VM_DISPATCH() \
+    VM_COUNT(); \
+    continue
+#endif
+
+#define VM_NEXT() \
+    ++pc; \
+    VM_DISPATCH()
+
+// Replaces the opcode of the instruction at `pc`, keeping the threaded code in sync. Only
+// reached with writable code, read-only code never quickens.
+#if INTERPRETER_THREADED_DISPATCH
+#define VM_REWRITE(newOpcode) \
+    writableCode[pc].opcode = (newOpcode); \
+    threadedCode[pc] = handlers[static_cast<size_t>(code[pc].opcode)]
+#else
+#define VM_REWRITE(newOpcode) \
+    writableCode[pc].opcode = (newOpcode)
+#endif
+
+// Leaves the dispatch loop through its fault path when a helper has raised an error
+#define VM_CHECK(call) \
+    if (!(call)) [[unlikely]] { \
+        goto fault; \
+    }
+
+// Typed operations work on the values in place, the compiler has already proven both are `T`
+#define VM_TYPED_ARITHMETIC(op, T, expression) \
+    VM_HANDLER(op) { \
+        const auto right = stack.back().unchecked##T(); \
+        stack.pop_back(); \
+        auto& left = stack.back().unchecked##T(); \
+        left = (expression); \
+        VM_NEXT(); \
+    }
+
+// Integer division and modulus, typed and quickened. The only typed operations that can fail.
+#define VM_INT_DIVISION(function) \
+    if (stack.back().uncheckedInt() == 0) [[unlikely]] { \
+        VM_CHECK(error.raise(VMStatus::DivisionByZero, "Division by zero")); \
+    } \
+    const int right = stack.back().uncheckedInt(); \
+    stack.pop_back(); \
+    int& left = stack.back().uncheckedInt(); \
+    left = function(left, right); \
+    VM_NEXT()
+
+#define VM_TYPED_DIVISION(op, function) \
+    VM_HANDLER(op) { \
+        VM_INT_DIVISION(function); \
+    }
+
+// Quickened operations, same as the typed ones but they check their guess about the types first.
+// A wrong guess turns the instruction back into `generic` and runs that instead.
+#define VM_QUICKENED_ARITHMETIC(op, generic, T, expression) \
+    VM_HANDLER(op) { \
+        if (stack.back().type != ValueType::T || stack.peek(1).type != ValueType::T) [[unlikely]] { \
+            VM_REWRITE(Opcode::generic); \
+            ++writableCode[pc].operand; \
+            VM_DISPATCH(); \
+        } \
+        const auto right = stack.back().unchecked##T(); \
+        stack.pop_back(); \
+        auto& left = stack.back().unchecked##T(); \
+        left = (expression); \
+        VM_NEXT(); \
+    }
+
+#define VM_QUICKENED_DIVISION(op, generic, function) \
+    VM_HANDLER(op) { \
+        if (stack.back().type != ValueType::Int || stack.peek(1).type != ValueType::Int) [[unlikely]] { \
+            VM_REWRITE(Opcode::generic); \
+            ++writableCode[pc].operand; \
+            VM_DISPATCH(); \
+        } \
+        VM_INT_DIVISION(function); \
+    }
+
+#define VM_QUICKENED_COMPARISON(op, generic, T, operator) \
+    VM_HANDLER(op) { \
+        if (stack.back().type != ValueType::T || stack.peek(1).type != ValueType::T) [[unlikely]] { \
+            VM_REWRITE(Opcode::generic); \
+            ++writableCode[pc].operand; \
+            VM_DISPATCH(); \
+        } \
+        const auto right = stack.back().unchecked##T(); \
+        stack.pop_back(); \
+        RuntimeValue& left = stack.back(); \
+        left = left.unchecked##T() operator right; \
+        VM_NEXT(); \
+    }
 
-    if (RuntimeValue::CanPerformOperation(left, ArithmeticOp::ADD, right)) {
-        stack.emplace_back(left + right);
-        return;
+// Generic operations try to quicken themselves before running, unless their guesses kept failing
+// or the code can't be written
+#define VM_QUICKEN() \
+    if (!writableCode.empty() && code[pc].operand < MaxQuickeningFailures) { \
+        VM_REWRITE(quickenedOpcode(code[pc].opcode, stack.peek(1).type, stack.back().type)); \
     }
 
-    throw std::runtime_error("Type mismatch");
+#define VM_TYPED_COMPARISON(op, T, operator) \
+    VM_HANDLER(op) { \
+        const auto right = stack.back().unchecked##T(); \
+        stack.pop_back(); \
+        RuntimeValue& left = stack.back(); \
+        left = left.unchecked##T() operator right; \
+        VM_NEXT(); \
+    }
+
+bool Interpreter::run(size_t& pc) {
+    // Calls and returns only push/pop frame headers, so the whole script runs in this one loop
+    const size_t entryDepth = callStack.size();
+    size_t basePointer = callStack.back().basePointer;
+
+#if INTERPRETER_THREADED_DISPATCH
+    static const void* const handlers[] = {
+#define OPCODE_LABEL(op, kind) &&op_##op,
+        OPCODE_LIST(OPCODE_LABEL)
+#undef OPCODE_LABEL
+    };
+
+    const bool threaded = !writableCode.empty();
+    if (threaded && threadedCode.size() != code.size()) {
+        threadedCode.clear();
+        threadedCode.reserve(code.size());
+        for (auto& instruction : code) {
+            threadedCode.push_back(handlers[static_cast<size_t>(instruction.opcode)]);
+        }
+    }
+
+    VM_DISPATCH();
+#else
+    for (;;) {
+        switch (code[pc].opcode) {
+#endif
+
+            VM_HANDLER(LOAD_CONST) {
+                stack.push_back(bytecode.constant(code[pc]));
+                VM_NEXT();
+            }
+            VM_HANDLER(ADD) {
+                VM_QUICKEN();
+                VM_CHECK(executeAdd());
+                VM_NEXT();
+            }
+            VM_HANDLER(SUB) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::SUB));
+                VM_NEXT();
+            }
+            VM_HANDLER(MUL) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::MUL));
+                VM_NEXT();
+            }
+            VM_HANDLER(DIV) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::DIV));
+                VM_NEXT();
+            }
+            VM_HANDLER(MOD) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::MOD));
+                VM_NEXT();
+            }
+            VM_HANDLER(EQ) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::EQ));
+                VM_NEXT();
+            }
+            VM_HANDLER(NEQ) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::NEQ));
+                VM_NEXT();
+            }
+            VM_HANDLER(LT) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::LT));
+                VM_NEXT();
+            }
+            VM_HANDLER(LTE) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::LTE));
+                VM_NEXT();
+            }
+            VM_HANDLER(GT) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::GT));
+                VM_NEXT();
+            }
+            VM_HANDLER(GTE) {
+                VM_QUICKEN();
+                VM_CHECK(executeBinaryOp(ArithmeticOp::GTE));
+                VM_NEXT();
+            }
+
+            VM_TYPED_ARITHMETIC(ADD_INT, Int, wrappingAdd(left, right))
+            VM_TYPED_ARITHMETIC(SUB_INT, Int, wrappingSub(left, right))
+            VM_TYPED_ARITHMETIC(MUL_INT, Int, wrappingMul(left, right))
+            VM_TYPED_DIVISION(DIV_INT, wrappingDiv)
+            VM_TYPED_DIVISION(MOD_INT, wrappingMod)
+            VM_TYPED_COMPARISON(EQ_INT, Int, ==)
+            VM_TYPED_COMPARISON(NEQ_INT, Int, !=)
+            VM_TYPED_COMPARISON(LT_INT, Int, <)
+            VM_TYPED_COMPARISON(LTE_INT, Int, <=)
+            VM_TYPED_COMPARISON(GT_INT, Int, >)
+            VM_TYPED_COMPARISON(GTE_INT, Int, >=)
+            VM_TYPED_ARITHMETIC(ADD_FLOAT, Float, left + right)
+            VM_TYPED_ARITHMETIC(SUB_FLOAT, Float, left - right)
+            VM_TYPED_ARITHMETIC(MUL_FLOAT, Float, left * right)
+            VM_TYPED_ARITHMETIC(DIV_FLOAT, Float, left / right)
+            VM_TYPED_COMPARISON(EQ_FLOAT, Float, ==)
+            VM_TYPED_COMPARISON(NEQ_FLOAT, Float, !=)
+            VM_TYPED_COMPARISON(LT_FLOAT, Float, <)
+            VM_TYPED_COMPARISON(LTE_FLOAT, Float, <=)
+            VM_TYPED_COMPARISON(GT_FLOAT, Float, >)
+            VM_TYPED_COMPARISON(GTE_FLOAT, Float, >=)
+
+            VM_QUICKENED_ARITHMETIC(ADD_INT_INT, ADD, Int, wrappingAdd(left, right))
+            VM_QUICKENED_ARITHMETIC(SUB_INT_INT, SUB, Int, wrappingSub(left, right))
+            VM_QUICKENED_ARITHMETIC(MUL_INT_INT, MUL, Int, wrappingMul(left, right))
+            VM_QUICKENED_DIVISION(DIV_INT_INT, DIV, wrappingDiv)
+            VM_QUICKENED_DIVISION(MOD_INT_INT, MOD, wrappingMod)
+            VM_QUICKENED_COMPARISON(EQ_INT_INT, EQ, Int, ==)
+            VM_QUICKENED_COMPARISON(NEQ_INT_INT, NEQ, Int, !=)
+            VM_QUICKENED_COMPARISON(LT_INT_INT, LT, Int, <)
+            VM_QUICKENED_COMPARISON(LTE_INT_INT, LTE, Int, <=)
+            VM_QUICKENED_COMPARISON(GT_INT_INT, GT, Int, >)
+            VM_QUICKENED_COMPARISON(GTE_INT_INT, GTE, Int, >=)
+            VM_QUICKENED_ARITHMETIC(ADD_FLOAT_FLOAT, ADD, Float, left + right)
+            VM_QUICKENED_ARITHMETIC(SUB_FLOAT_FLOAT, SUB, Float, left - right)
+            VM_QUICKENED_ARITHMETIC(MUL_FLOAT_FLOAT, MUL, Float, left * right)
+            VM_QUICKENED_ARITHMETIC(DIV_FLOAT_FLOAT, DIV, Float, left / right)
+            VM_QUICKENED_COMPARISON(EQ_FLOAT_FLOAT, EQ, Float, ==)
+            VM_QUICKENED_COMPARISON(NEQ_FLOAT_FLOAT, NEQ, Float, !=)
+            VM_QUICKENED_COMPARISON(LT_FLOAT_FLOAT, LT, Float, <)
+            VM_QUICKENED_COMPARISON(LTE_FLOAT_FLOAT, LTE, Float, <=)
+            VM_QUICKENED_COMPARISON(GT_FLOAT_FLOAT, GT, Float, >)
+            VM_QUICKENED_COMPARISON(GTE_FLOAT_FLOAT, GTE, Float, >=)
+
+            VM_HANDLER(CHECK_TYPE) {
+                VM_CHECK(checkType(stack.back(), static_cast<ValueType>(code[pc].operand)));
+                VM_NEXT();
+            }
+            VM_HANDLER(CHECK_LOCAL_TYPE) {
+                const uint32_t operand = code[pc].operand;
+                VM_CHECK(checkType(stack[basePointer + (operand >> 8)], static_cast<ValueType>(operand & 0xFF)));
+                VM_NEXT();
+            }
+            VM_HANDLER(CHECK_STRUCT) {
+                VM_CHECK(checkStruct(stack.back(), (*structLayouts)[code[pc].operand]));
+                VM_NEXT();
+            }
+            VM_HANDLER(CHECK_LOCAL_STRUCT) {
+                const uint32_t operand = code[pc].operand;
+                VM_CHECK(checkStruct(stack[basePointer + (operand >> 16)], (*structLayouts)[operand & 0xFFFF]));
+                VM_NEXT();
+            }
+
+            VM_HANDLER(LOAD_VAR) {
+                VM_CHECK(executeLoadVar(bytecode.name(code[pc])));
+                VM_NEXT();
+            }
+            VM_HANDLER(STORE_VAR) {
+                VM_CHECK(executeStoreVar(bytecode.name(code[pc])));
+                VM_NEXT();
+            }
+            VM_HANDLER(LOAD_LOCAL) {
+                stack.push_back(stack[basePointer + code[pc].operand]);
+                VM_NEXT();
+            }
+            VM_HANDLER(STORE_LOCAL) {
+                stack[basePointer + code[pc].operand] = stack.pop();
+                VM_NEXT();
+            }
+            VM_HANDLER(TAKE_LOCAL) {
+                stack.push_back(std::move(stack[basePointer + code[pc].operand]));
+                VM_NEXT();
+            }
+            VM_HANDLER(LOAD_FIELD) {
+                VM_CHECK(executeLoadField(bytecode.fieldCaches[code[pc].operand]));
+                VM_NEXT();
+            }
+            VM_HANDLER(STORE_FIELD) {
+                VM_CHECK(executeStoreField(bytecode.fieldCaches[code[pc].operand]));
+                VM_NEXT();
+            }
+            VM_HANDLER(NEW_STRUCT) {
+                stack.push_back((*structLayouts)[code[pc].operand].instantiate());
+                VM_NEXT();
+            }
+            VM_HANDLER(LOAD_FIELD_IDX) {
+                // Copy out first, the struct holding it is what gets replaced
+                RuntimeValue field = stack.back().asStruct().fields[code[pc].operand];
+                stack.back() = std::move(field);
+                VM_NEXT();
+            }
+            VM_HANDLER(LOAD_LOCAL_FIELD) {
+                const uint32_t operand = code[pc].operand;
+                stack.push_back(stack[basePointer + (operand >> 16)].asStruct().fields[operand & 0xFFFF]);
+                VM_NEXT();
+            }
+            VM_HANDLER(STORE_FIELD_IDX) {
+                RuntimeValue object = stack.pop();
+                object.mutableStruct().fields[code[pc].operand] = std::move(stack.back());
+                stack.back() = std::move(object);
+                VM_NEXT();
+            }
+            VM_HANDLER(JUMP) {
+                pc = code[pc].operand;
+                VM_DISPATCH();
+            }
+            VM_HANDLER(JUMP_IF_FALSE) {
+                if (stack.pop().isTruthy()) {
+                    ++pc;
+                } else {
+                    pc = code[pc].operand;
+                }
+                VM_DISPATCH();
+            }
+            VM_HANDLER(CALL_FUNC) {
+                uint32_t functionIndex;
+                VM_CHECK(resolveCallSite(bytecode.callSite(code[pc]), functionIndex));
+                VM_CHECK(executeCall(functionIndex, pc));
+                basePointer = callStack.back().basePointer;
+                VM_DISPATCH();
+            }
+            VM_HANDLER(CALL_DIRECT) {
+                if (jit && jit->call(code[pc].operand, stack)) {
+                    VM_NEXT();
+                }
+                VM_CHECK(executeCall(code[pc].operand, pc));
+                basePointer = callStack.back().basePointer;
+                VM_DISPATCH();
+            }
+            VM_HANDLER(TAIL_CALL) {
+                uint32_t functionIndex;
+                VM_CHECK(resolveCallSite(bytecode.callSite(code[pc]), functionIndex));
+                VM_CHECK(executeTailCall(functionIndex, pc));
+                VM_DISPATCH();
+            }
+            VM_HANDLER(TAIL_CALL_DIRECT) {
+                if (jit && jit->call(code[pc].operand, stack)) {
+                    // The callee's result is this function's
+                    goto returnTopOfStack;
+                }
+                VM_CHECK(executeTailCall(code[pc].operand, pc));
+                VM_DISPATCH();
+            }
+            VM_HANDLER(POP) {
+                stack.pop_back();
+                VM_NEXT();
+            }
+            VM_HANDLER(RETURN) {
+                // Drop the frame's window, a bare return still gives the caller one value
+                stack.resize(basePointer);
+                stack.emplace_back();
+                goto returnToCaller;
+            }
+            VM_HANDLER(RETURN_VALUE) {
+            returnTopOfStack:
+                RuntimeValue returnValue = stack.pop();
+                stack.resize(basePointer);
+                stack.push_back(std::move(returnValue));
+                goto returnToCaller;
+            }
+
+        returnToCaller:
+            pc = callStack.back().returnAddress;
+            callStack.pop_back();
+            if (callStack.size() < entryDepth) {
+                return true;
+            }
+            basePointer = callStack.back().basePointer;
+            VM_DISPATCH();
+
+#if !INTERPRETER_THREADED_DISPATCH
+            default:
+                error.raise(VMStatus::InvalidOpcode, "Invalid opcode");
+                goto fault;
+#endif
+
+        fault:
+            locateFault(pc);
+            return false;
+#if !INTERPRETER_THREADED_DISPATCH
+        }
+    }
+#endif
 }
 
-void Interpreter::executeLoadVar(const std::string& varName) {
-    RuntimeValue& var = getTable()->resolve(varName);
-    stack.push_back(var);
+#undef VM_TYPED_COMPARISON
+#undef VM_TYPED_DIVISION
+#undef VM_QUICKENED_DIVISION
+#undef VM_INT_DIVISION
+#undef VM_CHECK
+#undef VM_TYPED_ARITHMETIC
+#undef VM_QUICKEN
+#undef VM_QUICKENED_COMPARISON
+#undef VM_QUICKENED_ARITHMETIC
+#undef VM_REWRITE
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_HANDLER
+#undef VM_COUNT
+
+bool Interpreter::checkOperation(VMError& error, const RuntimeValue& left, ArithmeticOp op, const RuntimeValue& right) {
+    // Operators throw on anything without a result type (string arithmetic, float modulus)
+    const ValueType resultType = RuntimeValue::ResultType(left.type, op, right.type);
+    if (resultType == ValueType::None) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch,
+                           std::format("Type mismatch: {} {} {}", to_string(left.type), to_string(op), to_string(right.type)));
+    }
+    if ((op == ArithmeticOp::DIV || op == ArithmeticOp::MOD) && resultType == ValueType::Int) {
+        // Mixed operations are done on ints, a float divisor is truncated first
+        const int divisor = right.type == ValueType::Int ? right.asInt() : truncateToInt(right.asFloat());
+        if (divisor == 0) [[unlikely]] {
+            return error.raise(VMStatus::DivisionByZero, "Division by zero");
+        }
+    }
+    return true;
 }
 
-void Interpreter::executeStoreVar(const std::string& varName) {
-    if (stack.empty()) {
-        std::cerr << "Stack is empty" << std::endl;
-        return;
+bool Interpreter::executeAdd() {
+    RuntimeValue& left = stack.peek(1);
+    const RuntimeValue& right = stack.back();
+
+    if (!checkOperation(error, left, ArithmeticOp::ADD, right)) {
+        return false;
     }
 
-    auto table = getTable();
+    left = left + right;
+    stack.pop_back();
+    return true;
+}
+
+bool Interpreter::executeBinaryOp(ArithmeticOp op) {
+    RuntimeValue& left = stack.peek(1);
+    const RuntimeValue& right = stack.back();
 
-    RuntimeValue var = stack.pop();
+    if (!checkOperation(error, left, op, right)) {
+        return false;
+    }
+
+    switch (op) {
+        case ArithmeticOp::ADD: left = left + right; break;
+        case ArithmeticOp::SUB: left = left - right; break;
+        case ArithmeticOp::MUL: left = left * right; break;
+        case ArithmeticOp::DIV: left = left / right; break;
+        case ArithmeticOp::MOD: left = left % right; break;
+        case ArithmeticOp::EQ: left = left == right; break;
+        case ArithmeticOp::NEQ: left = left != right; break;
+        case ArithmeticOp::LT: left = left < right; break;
+        case ArithmeticOp::LTE: left = left <= right; break;
+        case ArithmeticOp::GT: left = left > right; break;
+        case ArithmeticOp::GTE: left = left >= right; break;
+    }
+    stack.pop_back();
+    return true;
+}
+
+bool Interpreter::checkType(const RuntimeValue& value, ValueType expected) {
+    if (value.type != expected) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected {}, got {}", to_string(expected), to_string(value.type)));
+    }
+    return true;
+}
 
-    table->define(varName, var);
+bool Interpreter::checkStruct(const RuntimeValue& value, const StructLayout& expected) {
+    if (value.type != ValueType::Struct) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected {}, got {}", expected.name.str(), to_string(value.type)));
+    }
+    const StructLayout* layout = value.asStruct().layout;
+    if (layout != &expected) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch,
+                           std::format("Type mismatch: expected {}, got {}", expected.name.str(), layout ? layout->name.str() : "Struct"));
+    }
+    return true;
 }
 
-void Interpreter::executeLoadField(const std::string& fieldName) {
-    auto& object = stack.back().asStruct();
+bool Interpreter::executeLoadVar(const std::string& varName) {
+    const RuntimeValue* var = getTable()->resolve(varName);
+    if (!var) [[unlikely]] {
+        return error.raise(VMStatus::UndefinedVariable, "Undefined variable: " + varName);
+    }
+    stack.push_back(*var);
+    return true;
+}
 
-    stack.push_back(object[fieldName]);
+bool Interpreter::executeStoreVar(const std::string& varName) {
+    if (stack.empty()) [[unlikely]] {
+        return error.raise(VMStatus::StackUnderflow, "No value to store in variable: " + varName);
+    }
+    getTable()->define(varName, stack.pop());
+    return true;
 }
 
-void Interpreter::executeStoreField(const std::string& fieldName) {
-    auto fieldValue = stack.pop();
-    auto& object = stack.back().asStruct();
-    object[fieldName] = fieldValue;
+bool Interpreter::executeLoadField(FieldCache& cache) {
+    if (stack.back().type != ValueType::Struct) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected Struct, got {}", to_string(stack.back().type)));
+    }
+    const RuntimeStruct& object = stack.back().asStruct();
+    uint32_t index;
+    if (!resolveField(cache, object, index)) {
+        return false;
+    }
+    RuntimeValue field = object.fields[index];
+    stack.back() = std::move(field);
+    return true;
 }
 
-void Interpreter::executeFunction(const std::string& funcName, size_t& pc) {
-    size_t startAddress;
-    Shared<FunctionNode> func;
-    if (!functionTable->resolve(funcName, func, startAddress)) {
-        std::cerr << "Function not found: " << funcName << std::endl;
-        return;
+bool Interpreter::executeStoreField(FieldCache& cache) {
+    if (stack.back().type != ValueType::Struct) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected Struct, got {}", to_string(stack.back().type)));
+    }
+    uint32_t index;
+    if (!resolveField(cache, stack.back().asStruct(), index)) {
+        return false;
+    }
+    // Struct typed fields only hold their declared layout, the compiler couldn't check this one
+    if (const StructLayout* fieldLayout = stack.back().asStruct().layout->fieldLayouts[index]) {
+        if (!checkStruct(stack.peek(1), *fieldLayout)) {
+            return false;
+        }
     }
 
-    size_t returnAddress = pc + 1;
+    RuntimeValue object = stack.pop();
+    object.mutableStruct().fields[index] = std::move(stack.back());
+    stack.back() = std::move(object);
+    return true;
+}
 
-    // std::cout << "Calling function: " << funcName << " at address: " << startAddress << std::endl;
+bool Interpreter::resolveField(FieldCache& cache, const RuntimeStruct& object, uint32_t& outIndex) {
+    if (cache.find(object.layout, outIndex)) {
+        return true;
+    }
 
-    auto& frame = callStack.emplace_back(returnAddress);
-    frame.locals = getTable()->createChild();
+    const InternedString& fieldName = bytecode.names[cache.name];
+    if (!object.layout || !object.layout->fieldIndex(fieldName, outIndex)) [[unlikely]] {
+        return error.raise(VMStatus::UnknownField, "Struct has no field named " + fieldName.str());
+    }
+    cache.remember(object.layout, outIndex);
+    return true;
+}
 
-    for (auto it = func->parameters.rbegin(); it != func->parameters.rend(); ++it) {
-        RuntimeValue arg = stack.pop();
-        frame.locals->define(it->second, arg); // Parameter name and argument value
+bool Interpreter::resolveCallSite(const CallSite& site, uint32_t& outIndex) {
+    const InternedString& name = bytecode.names[site.name];
+    if (!functionTable->lookup(name, outIndex)) [[unlikely]] {
+        return error.raise(VMStatus::UndefinedFunction, "Function not found: " + name.str());
+    }
+    // The callee's frame starts `arity` values down, any other count would take it into the caller's
+    const uint16_t arity = functionTable->descriptors[outIndex].arity;
+    if (arity != site.argumentCount) [[unlikely]] {
+        return error.raise(VMStatus::ArityMismatch, std::format("Function {} takes {} arguments, called with {}", name.str(), arity, site.argumentCount));
     }
+    return true;
+}
 
-    pc = startAddress; // Jump to the function's starting address
+bool Interpreter::executeCall(uint32_t functionIndex, size_t& pc) {
+    // Calls are the collector's safepoints, every live value is on the stack or in a global
+    ObjectHeap::safepoint();
+    if (!checkArguments(functionIndex)) [[unlikely]] {
+        return false;
+    }
+    const FunctionDescriptor& func = functionTable->descriptors[functionIndex];
+
+    // Arguments were pushed in order and stay where they are as the first slots,
+    // the remaining locals are reserved right above them
+    const size_t basePointer = stack.size() - func.arity;
+    const size_t frameEnd = basePointer + func.frameSize;
+    if (!reserveFrame(frameEnd + func.maxStack, functionIndex)) {
+        return false;
+    }
+    stack.resize(frameEnd);
 
-    while (pc < bytecode.size()) {
-        executeInstruction(pc);
+    callStack.emplace_back(pc + 1, basePointer, functionIndex);
 
-        if (bytecode[pc].opcode == Opcode::RETURN || bytecode[pc].opcode == Opcode::RETURN_VALUE) {
-            break;
-        }
+    pc = func.address; // Jump to the function's starting address
+    return true;
+}
+
+bool Interpreter::executeTailCall(uint32_t functionIndex, size_t& pc) {
+    ObjectHeap::safepoint();
+    if (!checkArguments(functionIndex)) [[unlikely]] {
+        return false;
     }
-    
-    // What do we actually do here to execute the function & handle responses?
-    // executeInstructionsUntilAddress(pc, returnAddress);
+    const FunctionDescriptor& func = functionTable->descriptors[functionIndex];
+    StackFrame& frame = callStack.back();
 
-    pc = callStack.back().returnAddress;
-    callStack.pop_back();
+    // Slide the arguments down over the current frame's slots, then reset the callee's locals
+    const size_t argsStart = stack.size() - func.arity;
+    std::move(stack.begin() + static_cast<ptrdiff_t>(argsStart), stack.end(), stack.begin() + static_cast<ptrdiff_t>(frame.basePointer));
+    stack.resize(frame.basePointer + func.arity);
 
-    // std::cout << "Returned from function: " << funcName << " at address: " << startAddress << std::endl;
+    const size_t frameEnd = frame.basePointer + func.frameSize;
+    if (!reserveFrame(frameEnd + func.maxStack, functionIndex)) {
+        return false;
+    }
+    stack.resize(frameEnd);
+
+    frame.functionId = functionIndex;
+
+    pc = func.address;
+    return true;
 }
 
-void Interpreter::executeReturnValue(const Instruction& InstructionType, size_t& pc) {
-    pc = callStack.back().returnAddress;
+bool Interpreter::reserveFrame(size_t frameEnd, uint32_t functionIndex) {
+    if (frameEnd <= stack.capacity()) {
+        return true;
+    }
 
-    // std::cout << "Hit return" << std::endl;
+    // Only deep recursion gets here, slots are addressed by index so growing is safe
+    if (frameEnd > MaxValueStackSize) [[unlikely]] {
+        return error.raise(VMStatus::StackOverflow, "Stack overflow calling function: " + functionTable->node(functionIndex)->name);
+    }
+    stack.reserve(std::min(std::max(stack.capacity() * 2, frameEnd), MaxValueStackSize));
+    return true;
+}
 
-    if (InstructionType.opcode == Opcode::RETURN_VALUE) {
-        // RuntimeValue returnValue = stack.pop();
+bool Interpreter::checkArguments(uint32_t functionIndex) {
+    size_t operandBase = 0;
+    if (!callStack.empty()) {
+        const StackFrame& caller = callStack.back();
+        operandBase = caller.basePointer + functionTable->descriptors[caller.functionId].frameSize;
+    }
+    const uint16_t arity = functionTable->descriptors[functionIndex].arity;
+    if (stack.size() - operandBase < arity) [[unlikely]] {
+        return error.raise(VMStatus::ArityMismatch, std::format("Function {} takes {} arguments, called with {}",
+            functionTable->node(functionIndex)->name, arity, stack.size() - operandBase));
+    }
+    return true;
+}
+
+void Interpreter::locateFault(size_t pc) {
+    const Instruction& instruction = code[pc];
+    error.opcode = to_string(instruction.opcode);
+    error.pc = static_cast<uint32_t>(pc);
+    if (!callStack.empty()) {
+        error.function = functionTable->node(callStack.back().functionId)->name;
+    }
+    // Contexts are written as "[function:line]: " prefixes
+    error.location = bytecode.debugContext(instruction);
+    while (!error.location.empty() && (error.location.back() == ' ' || error.location.back() == ':')) {
+        error.location.pop_back();
     }
 }
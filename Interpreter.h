@@ -1,53 +1,233 @@
 #pragma once
 
+#include <span>
+
 #include "BytecodeInstructions.h"
 #include "Common.h"
+#include "ExecutionArena.h"
+#include "Jit.h"
 #include "StackFrame.h"
-
+#include "VMError.h"
+
+// Dispatch engine used by `Interpreter::run`:
+// 1 = direct threaded code (computed goto, GCC/Clang only), 0 = `switch` loop.
+// Can be forced from the build with `-DINTERPRETER_THREADED_DISPATCH=0`.
+#ifndef INTERPRETER_THREADED_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+#define INTERPRETER_THREADED_DISPATCH 1
+#else
+#define INTERPRETER_THREADED_DISPATCH 0
+#endif
+#endif
+
+// Counts dispatched instructions in `executedInstructions`, used by `--bench`.
+// Off by default since it costs an increment on every dispatch.
+#ifndef INTERPRETER_INSTRUCTION_STATS
+#define INTERPRETER_INSTRUCTION_STATS 0
+#endif
+
+// Bounds checks on every `OperandStack` access: 1 = throw on underflow, out of range slots
+// and pushes past the reserved capacity, 0 = unchecked. On by default in debug builds.
+#ifndef INTERPRETER_CHECKED_STACK
+#ifdef NDEBUG
+#define INTERPRETER_CHECKED_STACK 0
+#else
+#define INTERPRETER_CHECKED_STACK 1
+#endif
+#endif
+
+class BytecodeImage;
 class Compiler;
 class FunctionTable;
-
-class OperandStack : public std::vector<RuntimeValue>
+struct FunctionDescriptor;
+class StructLayout;
+class StructLayoutTable;
+class SymbolTable;
+
+// The interpreter's single value stack: call frames' locals and operands both live here.
+// Capacity is reserved up front and each call makes room for its frame plus the deepest its
+// operands get (`FunctionDescriptor::maxStack`), so pushes never reallocate. It only grows
+// at a call when deep recursion needs more.
+class OperandStack : public std::pmr::vector<RuntimeValue>
 {
+    using Base = std::pmr::vector<RuntimeValue>;
+
 public:
+    OperandStack(size_t capacity, std::pmr::memory_resource* memory) : Base(memory) {
+        reserve(capacity);
+    }
+
+    RuntimeValue& operator[](size_t index) {
+        check(index < size(), "Stack slot out of range");
+        return Base::operator[](index);
+    }
+
+    // Value `depth` places below the top, `peek(0)` is the top
+    RuntimeValue& peek(size_t depth) {
+        check(depth < size(), "Stack underflow");
+        return Base::operator[](size() - 1 - depth);
+    }
+
+    RuntimeValue& back() { return peek(0); }
+
+    template <typename... Args>
+    RuntimeValue& emplace_back(Args&&... args) {
+        check(size() < capacity(), "Stack push past reserved capacity");
+        return Base::emplace_back(std::forward<Args>(args)...);
+    }
+
+    void push_back(const RuntimeValue& value) { emplace_back(value); }
+    void push_back(RuntimeValue&& value) { emplace_back(std::move(value)); }
+
+    void pop_back() {
+        check(!empty(), "Stack underflow");
+        Base::pop_back();
+    }
+
     RuntimeValue pop() {
-        auto value = back();
-        pop_back();
+        auto value = std::move(back());
+        Base::pop_back();
         return value;
     }
+
+private:
+    static void check([[maybe_unused]] bool condition, [[maybe_unused]] const char* message) {
+#if INTERPRETER_CHECKED_STACK
+        if (!condition) [[unlikely]] {
+            throw std::runtime_error(message);
+        }
+#endif
+    }
 };
 
 class Interpreter
 {
 public:
-    // Shared<SymbolTable> table;
+    // Number of values (locals + operands, across all frames) the value stack starts with
+    static constexpr size_t ValueStackCapacity = 64 * 1024;
+    // Number of frames the call stack starts with
+    static constexpr size_t CallStackCapacity = 1024;
+    // Block kept by the arena: both stacks at their starting capacity, plus room for globals
+    static constexpr size_t ArenaBlockSize = ValueStackCapacity * sizeof(RuntimeValue) + CallStackCapacity * sizeof(StackFrame) + 64 * 1024;
+    // Growth limit, calls beyond it fail with a stack overflow
+    static constexpr size_t MaxValueStackSize = 16 * 1024 * 1024;
+    // After this many wrong guesses an instruction is left generic, its operand types keep changing
+    static constexpr uint32_t MaxQuickeningFailures = 4;
+
+private:
+    // Memory of a run: the value and call stacks and the globals, released when `runMain` is done.
+    // Declared first, everything allocating from it has to be destroyed before it.
+    ExecutionArena arena = ExecutionArena(ArenaBlockSize);
+
+public:
+    // Variables that weren't resolved to a frame slot
+    Shared<SymbolTable> globals;
 
     Shared<FunctionTable> functionTable;
 
+    Shared<StructLayoutTable> structLayouts;
+
+    // Operand tables of the program, and its instructions when it came from a `Compiler`
     BytecodeInstructionSet bytecode;
-    OperandStack stack;
-    std::vector<StackFrame> callStack; // Call stack
+    // The instructions being run, either `bytecode`'s or a loaded image's
+    std::span<const Instruction> code;
+    // `code` when it may be written, generic arithmetic is then rewritten in place to
+    // type-specific opcodes as it runs. Empty for an image, whose mapping is read-only.
+    std::span<Instruction> writableCode;
+    OperandStack stack = OperandStack(ValueStackCapacity, arena.memory());
+    std::pmr::vector<StackFrame> callStack = std::pmr::vector<StackFrame>(arena.memory()); // Call stack
+
+    // Runs hot functions natively, null when built without INTERPRETER_JIT or turned off
+    std::unique_ptr<Jit> jit;
+
+    // Dispatched instructions, only counted when built with INTERPRETER_INSTRUCTION_STATS
+    uint64_t executedInstructions = 0;
 
     Interpreter(const Compiler& compiler);
+    // Runs the instructions in place from `image`, which has to outlive the interpreter
+    explicit Interpreter(BytecodeImage& image);
+    ~Interpreter();
+
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
 
     Shared<SymbolTable> getTable();
 
-    void execute();
+    // Runs `main` and prints what it returned, or the error that stopped it
+    ExecutionResult execute();
+
+    // Calls `main` and returns its result, the stacks and globals are reset either way
+    ExecutionResult runMain();
+
+    // Runs instructions from `pc` until the frame on top of `callStack` returns,
+    // including every call it makes along the way. False if a fault stopped it.
+    bool run(size_t& pc);
+
+    // Checks that `op` is defined for these operands (and doesn't divide by zero), raising
+    // the fault in `error` if not. Shared with `RegisterInterpreter`.
+    static bool checkOperation(VMError& error, const RuntimeValue& left, ArithmeticOp op, const RuntimeValue& right);
+
+    // Binary operations write their result over the left operand and drop the right one,
+    // neither is copied off the stack
+    bool executeAdd();
+
+    bool executeBinaryOp(ArithmeticOp op);
+
+    // Fails unless `value` has the type the compiler relies on
+    bool checkType(const RuntimeValue& value, ValueType expected);
+
+    // Fails unless `value` is a struct with `expected` layout
+    bool checkStruct(const RuntimeValue& value, const StructLayout& expected);
+
+    bool executeLoadVar(const std::string& varName);
+
+    bool executeStoreVar(const std::string& varName);
+
+    bool executeLoadField(FieldCache& cache);
+
+    bool executeStoreField(FieldCache& cache);
+
+    // Looks up the callee of a late-bound call, failing unless it takes the arguments the call pushed
+    bool resolveCallSite(const CallSite& site, uint32_t& outIndex);
+
+    // Pushes a frame for function descriptor `functionIndex` and moves `pc` to its entry
+    bool executeCall(uint32_t functionIndex, size_t& pc);
+
+    // Replaces the current frame with one for `functionIndex`, keeping its return address
+    bool executeTailCall(uint32_t functionIndex, size_t& pc);
+
+private:
+    // Id of the stack, globals and constants as `ObjectHeap` roots
+    uint32_t heapRoots;
+
+    Interpreter(Shared<FunctionTable> functionTable, Shared<StructLayoutTable> structLayouts, const BytecodeInstructionSet& tables);
+
+    // Runs `instructions` from now on, they index into `bytecode`'s operand tables. `writable`
+    // is either the same instructions, which are then quickened, or empty.
+    void use(std::span<const Instruction> instructions, std::span<Instruction> writable);
 
-    
-    void executeInstruction(size_t& pc);
-    void executeInstructionsUntilAddress(size_t& pc, size_t address);
+    VMError error;
 
-    void executeAdd();
+    // Index of the field `cache` names in `object`, from the cache when its layout has been seen
+    // before. False if `object` has no such field.
+    bool resolveField(FieldCache& cache, const RuntimeStruct& object, uint32_t& outIndex);
 
-    void executeLoadVar(const std::string& varName);
+    // Fills in where the fault raised in `error` happened, the instruction at `pc`
+    void locateFault(size_t pc);
 
-    void executeStoreVar(const std::string& varName);
+    // Empties the stacks and globals and releases the arena, ready for the next run
+    void resetExecution();
 
-    void executeLoadField(const std::string& fieldName);
+    // Makes sure the value stack can hold a frame and its operands, ending at `frameEnd`
+    bool reserveFrame(size_t frameEnd, uint32_t functionIndex);
 
-    void executeStoreField(const std::string& fieldName);
+    // Fails unless the current frame's operands hold the callee's arguments, so its frame never
+    // starts inside the caller's locals
+    bool checkArguments(uint32_t functionIndex);
 
-    void executeFunction(const std::string& funcName, size_t& pc);
-    void executeReturnValue(const Instruction& InstructionType, size_t& pc);
+#if INTERPRETER_THREADED_DISPATCH
+    // Handler address for each instruction in `writableCode`, built on the first `run`. Read-only
+    // code dispatches on its opcodes instead, so an image needs no memory per instruction.
+    std::vector<const void*> threadedCode;
+#endif
 };
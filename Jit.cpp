@@ -0,0 +1,616 @@
+#include "Jit.h"
+
+#if INTERPRETER_JIT
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <map>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Interpreter.h"
+#include "SymbolTable.h"
+
+namespace
+{
+    // Operation an arithmetic opcode performs and the operand type it's specialized for,
+    // None for the generic form
+    bool decodeArithmetic(Opcode opcode, ArithmeticOp& outOp, ValueType& outType) {
+        switch (opcode) {
+#define JIT_INT_ARITHMETIC(op) \
+            case Opcode::op: outOp = ArithmeticOp::op; outType = ValueType::None; return true; \
+            case Opcode::op##_INT: \
+            case Opcode::op##_INT_INT: outOp = ArithmeticOp::op; outType = ValueType::Int; return true;
+#define JIT_ARITHMETIC(op) \
+            JIT_INT_ARITHMETIC(op) \
+            case Opcode::op##_FLOAT: \
+            case Opcode::op##_FLOAT_FLOAT: outOp = ArithmeticOp::op; outType = ValueType::Float; return true;
+            JIT_ARITHMETIC(ADD)
+            JIT_ARITHMETIC(SUB)
+            JIT_ARITHMETIC(MUL)
+            JIT_ARITHMETIC(DIV)
+            JIT_INT_ARITHMETIC(MOD)
+            JIT_ARITHMETIC(EQ)
+            JIT_ARITHMETIC(NEQ)
+            JIT_ARITHMETIC(LT)
+            JIT_ARITHMETIC(LTE)
+            JIT_ARITHMETIC(GT)
+            JIT_ARITHMETIC(GTE)
+#undef JIT_ARITHMETIC
+#undef JIT_INT_ARITHMETIC
+            default:
+                return false;
+        }
+    }
+
+    bool isComparison(ArithmeticOp op) {
+        return op != ArithmeticOp::ADD && op != ArithmeticOp::SUB && op != ArithmeticOp::MUL && op != ArithmeticOp::DIV && op != ArithmeticOp::MOD;
+    }
+
+    // Types native code keeps in a 32-bit slot
+    bool isNative(ValueType type) {
+        return type == ValueType::Int || type == ValueType::Float || type == ValueType::Bool;
+    }
+
+    // Static types at an instruction, before it runs
+    struct FrameTypes
+    {
+        std::vector<ValueType> slots;
+        std::vector<ValueType> stack;
+    };
+
+    // x86-64 machine code of one function. Every value lives in an 8-byte slot at `[rsp + 8 * slot]`,
+    // the frame's locals first and its operands above them. Templates load their operands into
+    // eax/ecx (xmm0/xmm1 for floats) and store the result back.
+    class CodeBuffer
+    {
+    public:
+        std::vector<uint8_t> code;
+
+        void bytes(std::initializer_list<uint8_t> values) { code.insert(code.end(), values); }
+
+        void imm32(uint32_t value) {
+            for (int i = 0; i < 4; ++i) {
+                code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+
+        void imm64(uint64_t value) {
+            imm32(static_cast<uint32_t>(value));
+            imm32(static_cast<uint32_t>(value >> 32));
+        }
+
+        // `[rsp + disp32]` operand with register `reg` in the ModRM byte
+        void slotOperand(uint8_t reg, uint32_t slot) {
+            bytes({static_cast<uint8_t>(0x84 | reg << 3), 0x24});
+            imm32(slot * 8);
+        }
+
+        // mov eax/ecx, [slot]
+        void loadInt(uint8_t reg, uint32_t slot) { bytes({0x8B}); slotOperand(reg, slot); }
+        // mov [slot], eax
+        void storeInt(uint32_t slot) { bytes({0x89}); slotOperand(0, slot); }
+        // movss xmm0/xmm1, [slot]
+        void loadFloat(uint8_t reg, uint32_t slot) { bytes({0xF3, 0x0F, 0x10}); slotOperand(reg, slot); }
+        // movss [slot], xmm0
+        void storeFloat(uint32_t slot) { bytes({0xF3, 0x0F, 0x11}); slotOperand(0, slot); }
+
+        // jmp/jcc rel32 with the displacement left to `patch`, returns where it goes
+        size_t jump() { bytes({0xE9}); return placeholder(); }
+        size_t jumpIfZero() { bytes({0x0F, 0x84}); return placeholder(); }
+        size_t jumpIfNotZero() { bytes({0x0F, 0x85}); return placeholder(); }
+
+        void patch(size_t at, size_t target) {
+            const auto displacement = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+            std::memcpy(code.data() + at, &displacement, 4);
+        }
+
+        // setcc al with `condition`, then movzx eax, al
+        void setBool(uint8_t condition) { bytes({0x0F, condition, 0xC0, 0x0F, 0xB6, 0xC0}); }
+
+    private:
+        size_t placeholder() {
+            imm32(0);
+            return code.size() - 4;
+        }
+    };
+
+    // setcc opcodes
+    constexpr uint8_t SetEqual = 0x94, SetNotEqual = 0x95, SetLess = 0x9C, SetLessEqual = 0x9E, SetGreater = 0x9F, SetGreaterEqual = 0x9D;
+    constexpr uint8_t SetAbove = 0x97, SetAboveEqual = 0x93, SetParity = 0x9A, SetNoParity = 0x9B;
+
+    // Same results as `wrappingAdd` and friends in the interpreters: add, sub and imul wrap
+    void emitIntOp(CodeBuffer& out, ArithmeticOp op, size_t& divisionCheck) {
+        switch (op) {
+            case ArithmeticOp::ADD: out.bytes({0x01, 0xC8}); break; // add eax, ecx
+            case ArithmeticOp::SUB: out.bytes({0x29, 0xC8}); break; // sub eax, ecx
+            case ArithmeticOp::MUL: out.bytes({0x0F, 0xAF, 0xC1}); break; // imul eax, ecx
+            case ArithmeticOp::DIV:
+            case ArithmeticOp::MOD: {
+                // Zero divisors bail out for the interpreter to report. idiv traps on INT_MIN / -1,
+                // so a -1 divisor is done like `wrappingDiv`/`wrappingMod`: negate, or 0
+                out.bytes({0x85, 0xC9}); // test ecx, ecx
+                divisionCheck = out.jumpIfZero();
+                out.bytes({0x83, 0xF9, 0xFF}); // cmp ecx, -1
+                out.bytes({0x75, 0x04}); // jne over the next two instructions
+                if (op == ArithmeticOp::DIV) {
+                    out.bytes({0xF7, 0xD8, 0xEB, 0x03}); // neg eax; jmp over the idiv
+                    out.bytes({0x99, 0xF7, 0xF9}); // cdq; idiv ecx
+                } else {
+                    out.bytes({0x31, 0xC0, 0xEB, 0x05}); // xor eax, eax; jmp over the idiv
+                    out.bytes({0x99, 0xF7, 0xF9, 0x89, 0xD0}); // cdq; idiv ecx; mov eax, edx
+                }
+                break;
+            }
+            default: {
+                out.bytes({0x39, 0xC8}); // cmp eax, ecx
+                static constexpr uint8_t conditions[] = {SetEqual, SetNotEqual, SetLess, SetLessEqual, SetGreater, SetGreaterEqual};
+                out.setBool(conditions[static_cast<int>(op) - static_cast<int>(ArithmeticOp::EQ)]);
+                break;
+            }
+        }
+    }
+
+    void emitFloatOp(CodeBuffer& out, ArithmeticOp op) {
+        // ucomiss sets CF/ZF like an unsigned compare and PF for NaN, so ordered comparisons
+        // are written as "above" with the operands in the right order
+        const auto compare = [&](bool swapped, uint8_t condition) {
+            out.bytes({0x0F, 0x2E, static_cast<uint8_t>(swapped ? 0xC8 : 0xC1)}); // ucomiss xmm1, xmm0 / xmm0, xmm1
+            out.setBool(condition);
+        };
+        switch (op) {
+            case ArithmeticOp::ADD: out.bytes({0xF3, 0x0F, 0x58, 0xC1}); break; // addss xmm0, xmm1
+            case ArithmeticOp::SUB: out.bytes({0xF3, 0x0F, 0x5C, 0xC1}); break; // subss xmm0, xmm1
+            case ArithmeticOp::MUL: out.bytes({0xF3, 0x0F, 0x59, 0xC1}); break; // mulss xmm0, xmm1
+            case ArithmeticOp::DIV: out.bytes({0xF3, 0x0F, 0x5E, 0xC1}); break; // divss xmm0, xmm1
+            case ArithmeticOp::LT: compare(true, SetAbove); break;
+            case ArithmeticOp::LTE: compare(true, SetAboveEqual); break;
+            case ArithmeticOp::GT: compare(false, SetAbove); break;
+            case ArithmeticOp::GTE: compare(false, SetAboveEqual); break;
+            case ArithmeticOp::EQ:
+            case ArithmeticOp::NEQ: {
+                const bool equal = op == ArithmeticOp::EQ;
+                out.bytes({0x0F, 0x2E, 0xC1}); // ucomiss xmm0, xmm1
+                out.bytes({0x0F, equal ? SetEqual : SetNotEqual, 0xC0}); // setcc al
+                out.bytes({0x0F, equal ? SetNoParity : SetParity, 0xC1}); // setcc cl
+                out.bytes({static_cast<uint8_t>(equal ? 0x20 : 0x08), 0xC8}); // and/or al, cl
+                out.bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+Jit::Jit(std::span<const Instruction> code, const BytecodeInstructionSet& bytecode, const FunctionTable& functionTable):
+    code(code),
+    bytecode(bytecode),
+    functionTable(functionTable),
+    functions(functionTable.descriptors.size()),
+    entries(std::make_unique<NativeFunction[]>(functionTable.descriptors.size())) {}
+
+Jit::~Jit() {
+    for (const auto& [memory, size] : codeBlocks) {
+        munmap(memory, size);
+    }
+}
+
+bool Jit::call(uint32_t functionIndex, OperandStack& stack) {
+    Function& function = functions[functionIndex];
+    const FunctionDescriptor& descriptor = functionTable.descriptors[functionIndex];
+    const size_t argsStart = stack.size() - descriptor.arity;
+
+    if (function.state != State::Compiled) {
+        if (function.state != State::Interpreted || ++function.calls < HotCallCount) {
+            return false;
+        }
+        std::vector<ValueType> argTypes;
+        for (size_t i = argsStart; i < stack.size(); ++i) {
+            argTypes.push_back(stack[i].type);
+        }
+        if (!compile(functionIndex, argTypes)) {
+            return false;
+        }
+    }
+
+    uint64_t args[MaxSlots];
+    for (uint32_t i = 0; i < descriptor.arity; ++i) {
+        RuntimeValue& value = stack[argsStart + i];
+        if (value.type != function.paramTypes[i]) {
+            return false;
+        }
+        switch (value.type) {
+            case ValueType::Int: args[i] = static_cast<uint32_t>(value.asInt()); break;
+            case ValueType::Float: args[i] = std::bit_cast<uint32_t>(value.asFloat()); break;
+            default: args[i] = value.asBool(); break;
+        }
+    }
+
+    const uint64_t result = entries[functionIndex](args, MaxNativeDepth);
+    if (result >> 32) {
+        // Nothing was changed, the interpreter makes the call instead
+        if (++function.bailouts >= MaxBailouts) {
+            function.state = State::Failed;
+            entries[functionIndex] = nullptr;
+        }
+        return false;
+    }
+
+    stack.resize(argsStart);
+    const auto bits = static_cast<uint32_t>(result);
+    switch (descriptor.returnType) {
+        case ValueType::Int: stack.emplace_back(static_cast<int>(bits)); break;
+        case ValueType::Float: stack.emplace_back(std::bit_cast<float>(bits)); break;
+        default: stack.emplace_back(bits != 0); break;
+    }
+    return true;
+}
+
+bool Jit::compile(uint32_t functionIndex, const std::vector<ValueType>& paramTypes) {
+    Function& function = functions[functionIndex];
+    const FunctionDescriptor& descriptor = functionTable.descriptors[functionIndex];
+    const uint32_t frameSize = descriptor.frameSize;
+
+    const auto reject = [&] {
+        function.state = State::Failed;
+        return false;
+    };
+
+    // Calls to it made while it's being compiled (recursion) rely on these
+    function.state = State::Compiling;
+    function.paramTypes = paramTypes;
+    if (!isNative(descriptor.returnType) || frameSize > MaxSlots || !std::ranges::all_of(paramTypes, isNative)) {
+        return reject();
+    }
+
+    // Types at every reachable instruction, joined until nothing changes
+    std::map<uint32_t, FrameTypes> types;
+    std::vector<uint32_t> worklist;
+    const auto flowTo = [&](uint32_t target, const FrameTypes& state) {
+        auto [it, inserted] = types.try_emplace(target, state);
+        if (!inserted) {
+            FrameTypes& existing = it->second;
+            if (existing.stack != state.stack) {
+                return false;
+            }
+            bool changed = false;
+            for (size_t i = 0; i < existing.slots.size(); ++i) {
+                if (existing.slots[i] != state.slots[i] && existing.slots[i] != ValueType::None) {
+                    existing.slots[i] = ValueType::None;
+                    changed = true;
+                }
+            }
+            if (!changed) {
+                return true;
+            }
+        }
+        worklist.push_back(target);
+        return true;
+    };
+    // Callee compiled (or being compiled) for these argument types
+    const auto callable = [&](uint32_t callee, const std::vector<ValueType>& argTypes) {
+        switch (functions[callee].state) {
+            case State::Interpreted: return compile(callee, argTypes);
+            case State::Compiling:
+            case State::Compiled: return functions[callee].paramTypes == argTypes;
+            default: return false;
+        }
+    };
+
+    FrameTypes entry;
+    entry.slots.assign(frameSize, ValueType::None);
+    std::ranges::copy(paramTypes, entry.slots.begin());
+    flowTo(descriptor.address, entry);
+
+    while (!worklist.empty()) {
+        const uint32_t pc = worklist.back();
+        worklist.pop_back();
+        FrameTypes state = types.at(pc);
+        const Instruction& instruction = code[pc];
+        auto& stack = state.stack;
+
+        ArithmeticOp op;
+        ValueType expected;
+        if (decodeArithmetic(instruction.opcode, op, expected)) {
+            const ValueType left = stack[stack.size() - 2], right = stack.back();
+            if (left != right || (left != ValueType::Int && left != ValueType::Float)
+                || (expected != ValueType::None && left != expected) || (op == ArithmeticOp::MOD && left != ValueType::Int)) {
+                return reject();
+            }
+            stack.pop_back();
+            stack.back() = isComparison(op) ? ValueType::Bool : left;
+            if (!flowTo(pc + 1, state)) {
+                return reject();
+            }
+            continue;
+        }
+
+        bool next = true;
+        switch (instruction.opcode) {
+            case Opcode::LOAD_CONST: {
+                const ValueType type = bytecode.constant(instruction).type;
+                if (!isNative(type)) {
+                    return reject();
+                }
+                stack.push_back(type);
+                break;
+            }
+            case Opcode::CHECK_TYPE:
+                // Proven statically, or the check could fail and native code can't raise it
+                if (stack.back() != static_cast<ValueType>(instruction.operand)) {
+                    return reject();
+                }
+                break;
+            case Opcode::CHECK_LOCAL_TYPE:
+                if (state.slots[instruction.operand >> 8] != static_cast<ValueType>(instruction.operand & 0xFF)) {
+                    return reject();
+                }
+                break;
+            case Opcode::LOAD_LOCAL:
+                if (!isNative(state.slots[instruction.operand])) {
+                    return reject();
+                }
+                stack.push_back(state.slots[instruction.operand]);
+                break;
+            case Opcode::STORE_LOCAL:
+                state.slots[instruction.operand] = stack.back();
+                stack.pop_back();
+                break;
+            case Opcode::POP:
+                stack.pop_back();
+                break;
+            case Opcode::JUMP:
+                next = false;
+                if (!flowTo(instruction.operand, state)) {
+                    return reject();
+                }
+                break;
+            case Opcode::JUMP_IF_FALSE:
+                if (stack.back() != ValueType::Int && stack.back() != ValueType::Bool) {
+                    return reject();
+                }
+                stack.pop_back();
+                if (!flowTo(instruction.operand, state)) {
+                    return reject();
+                }
+                break;
+            case Opcode::CALL_DIRECT:
+            case Opcode::TAIL_CALL_DIRECT: {
+                const uint32_t callee = instruction.operand;
+                const FunctionDescriptor& calleeDescriptor = functionTable.descriptors[callee];
+                const std::vector<ValueType> argTypes(stack.end() - calleeDescriptor.arity, stack.end());
+                stack.resize(stack.size() - calleeDescriptor.arity);
+
+                if (instruction.opcode == Opcode::TAIL_CALL_DIRECT && callee == functionIndex) {
+                    // Becomes a jump back to the start, with the locals reset like the interpreter does
+                    FrameTypes restart;
+                    restart.slots.assign(frameSize, ValueType::None);
+                    std::ranges::copy(argTypes, restart.slots.begin());
+                    next = false;
+                    if (!flowTo(descriptor.address, restart)) {
+                        return reject();
+                    }
+                    break;
+                }
+                if (!callable(callee, argTypes)) {
+                    return reject();
+                }
+                if (instruction.opcode == Opcode::TAIL_CALL_DIRECT) {
+                    // Called and returned from
+                    next = false;
+                    if (calleeDescriptor.returnType != descriptor.returnType) {
+                        return reject();
+                    }
+                } else {
+                    stack.push_back(calleeDescriptor.returnType);
+                }
+                break;
+            }
+            case Opcode::RETURN_VALUE:
+                next = false;
+                if (stack.back() != descriptor.returnType) {
+                    return reject();
+                }
+                break;
+            default:
+                // Globals, strings, structs, late-bound calls and bare returns stay interpreted
+                return reject();
+        }
+        if (next && !flowTo(pc + 1, state)) {
+            return reject();
+        }
+    }
+
+    // Generate code for the reachable instructions in address order, so each one falls through
+    // to the next. Slots are rounded to an odd count to keep calls 16-byte aligned.
+    size_t maxDepth = 0;
+    for (const auto& [pc, state] : types) {
+        maxDepth = std::max(maxDepth, state.stack.size() + 1);
+    }
+    if (frameSize + maxDepth > MaxSlots) {
+        return reject();
+    }
+
+    CodeBuffer out;
+    const auto slots = static_cast<uint32_t>(frameSize + maxDepth) | 1;
+    std::vector<size_t> bailJumps;
+    std::vector<size_t> returnJumps;
+    std::vector<std::pair<size_t, uint32_t>> branches;
+    std::map<uint32_t, size_t> offsets;
+
+    out.bytes({0x55, 0x48, 0x89, 0xE5, 0x53}); // push rbp; mov rbp, rsp; push rbx
+    out.bytes({0x48, 0x81, 0xEC}); // sub rsp, slots * 8
+    out.imm32(slots * 8);
+    out.bytes({0x48, 0x85, 0xF6}); // test rsi, rsi
+    bailJumps.push_back(out.jumpIfZero());
+    out.bytes({0x48, 0x8D, 0x5E, 0xFF}); // lea rbx, [rsi - 1]
+    for (uint32_t i = 0; i < paramTypes.size(); ++i) {
+        out.bytes({0x8B, 0x87}); // mov eax, [rdi + 8 * i]
+        out.imm32(i * 8);
+        out.storeInt(i);
+    }
+    const size_t body = out.code.size();
+
+    // Calls `callee` with the arguments at the top `depth` operands, result in eax
+    const auto emitCall = [&](uint32_t callee, uint32_t depth) {
+        const uint32_t arity = functionTable.descriptors[callee].arity;
+        out.bytes({0x48, 0x8D, 0xBC, 0x24}); // lea rdi, [rsp + 8 * firstArg]
+        out.imm32((frameSize + depth - arity) * 8);
+        out.bytes({0x48, 0x89, 0xDE}); // mov rsi, rbx
+        out.bytes({0x48, 0xB8}); // mov rax, &entries[callee]
+        out.imm64(reinterpret_cast<uint64_t>(&entries[callee]));
+        out.bytes({0x48, 0x8B, 0x00, 0x48, 0x85, 0xC0}); // mov rax, [rax]; test rax, rax
+        bailJumps.push_back(out.jumpIfZero());
+        out.bytes({0xFF, 0xD0}); // call rax
+        out.bytes({0x48, 0x89, 0xC2, 0x48, 0xC1, 0xEA, 0x20}); // mov rdx, rax; shr rdx, 32
+        bailJumps.push_back(out.jumpIfNotZero());
+    };
+
+    for (const auto& [pc, state] : types) {
+        offsets[pc] = out.code.size();
+        const Instruction& instruction = code[pc];
+        const auto depth = static_cast<uint32_t>(state.stack.size());
+        const uint32_t top = frameSize + depth - 1;
+
+        ArithmeticOp op;
+        ValueType expected;
+        if (decodeArithmetic(instruction.opcode, op, expected)) {
+            if (state.stack.back() == ValueType::Int) {
+                out.loadInt(0, top - 1);
+                out.loadInt(1, top);
+                size_t divisionCheck = 0;
+                emitIntOp(out, op, divisionCheck);
+                if (divisionCheck) {
+                    bailJumps.push_back(divisionCheck);
+                }
+            } else {
+                out.loadFloat(0, top - 1);
+                out.loadFloat(1, top);
+                emitFloatOp(out, op);
+            }
+            if (state.stack.back() == ValueType::Float && !isComparison(op)) {
+                out.storeFloat(top - 1);
+            } else {
+                out.storeInt(top - 1);
+            }
+            continue;
+        }
+
+        switch (instruction.opcode) {
+            case Opcode::LOAD_CONST: {
+                const RuntimeValue& constant = bytecode.constant(instruction);
+                uint32_t bits;
+                switch (constant.type) {
+                    case ValueType::Int: bits = static_cast<uint32_t>(constant.asInt()); break;
+                    case ValueType::Float: bits = std::bit_cast<uint32_t>(constant.asFloat()); break;
+                    default: bits = constant.asBool(); break;
+                }
+                out.bytes({0xB8}); // mov eax, bits
+                out.imm32(bits);
+                out.storeInt(top + 1);
+                break;
+            }
+            case Opcode::LOAD_LOCAL:
+                out.loadInt(0, instruction.operand);
+                out.storeInt(top + 1);
+                break;
+            case Opcode::STORE_LOCAL:
+                out.loadInt(0, top);
+                out.storeInt(instruction.operand);
+                break;
+            case Opcode::JUMP:
+                branches.emplace_back(out.jump(), instruction.operand);
+                break;
+            case Opcode::JUMP_IF_FALSE:
+                out.loadInt(0, top);
+                out.bytes({0x85, 0xC0}); // test eax, eax
+                branches.emplace_back(out.jumpIfZero(), instruction.operand);
+                break;
+            case Opcode::CALL_DIRECT:
+                emitCall(instruction.operand, depth);
+                out.storeInt(frameSize + depth - functionTable.descriptors[instruction.operand].arity);
+                break;
+            case Opcode::TAIL_CALL_DIRECT:
+                if (instruction.operand == functionIndex) {
+                    for (uint32_t i = 0; i < descriptor.arity; ++i) {
+                        out.loadInt(0, frameSize + depth - descriptor.arity + i);
+                        out.storeInt(i);
+                    }
+                    out.patch(out.jump(), body);
+                } else {
+                    emitCall(instruction.operand, depth);
+                    returnJumps.push_back(out.jump());
+                }
+                break;
+            case Opcode::RETURN_VALUE:
+                out.loadInt(0, top);
+                returnJumps.push_back(out.jump());
+                break;
+            default:
+                // CHECK_TYPE/CHECK_LOCAL_TYPE were proven, POP only moves the depth
+                break;
+        }
+    }
+
+    const size_t bail = out.code.size();
+    out.bytes({0x48, 0xB8}); // mov rax, 1 << 32
+    out.imm64(uint64_t(1) << 32);
+    const size_t epilogue = out.code.size();
+    out.bytes({0x48, 0x81, 0xC4}); // add rsp, slots * 8
+    out.imm32(slots * 8);
+    out.bytes({0x5B, 0x5D, 0xC3}); // pop rbx; pop rbp; ret
+
+    for (const size_t at : bailJumps) {
+        out.patch(at, bail);
+    }
+    for (const size_t at : returnJumps) {
+        out.patch(at, epilogue);
+    }
+    for (const auto& [at, target] : branches) {
+        out.patch(at, offsets.at(target));
+    }
+
+    void* code = install(out.code);
+    if (!code) {
+        return reject();
+    }
+    entries[functionIndex] = reinterpret_cast<NativeFunction>(code);
+    function.state = State::Compiled;
+    return true;
+}
+
+void* Jit::install(const std::vector<uint8_t>& code) {
+    const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t size = (code.size() + pageSize - 1) / pageSize * pageSize;
+
+    // Written first, then made executable, never both at once
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return nullptr;
+    }
+    codeBlocks.emplace_back(memory, size);
+    return memory;
+}
+
+#else
+
+// Built without native code, every call is left to the interpreter
+Jit::Jit(std::span<const Instruction> code, const BytecodeInstructionSet& bytecode, const FunctionTable& functionTable):
+    code(code),
+    bytecode(bytecode),
+    functionTable(functionTable) {}
+
+Jit::~Jit() = default;
+
+bool Jit::call(uint32_t, OperandStack&) {
+    return false;
+}
+
+#endif
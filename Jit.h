@@ -0,0 +1,100 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "BytecodeInstructions.h"
+#include "Common.h"
+
+// Native code for hot functions in `Interpreter`: 1 = on, 0 = every call is interpreted.
+// Only available on x86-64 with POSIX `mmap`, can be turned off with `-DINTERPRETER_JIT=0`.
+#ifndef INTERPRETER_JIT
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define INTERPRETER_JIT 1
+#else
+#define INTERPRETER_JIT 0
+#endif
+#endif
+
+class FunctionTable;
+class OperandStack;
+
+// Baseline template JIT for the stack VM.
+//
+// Functions that only work on ints, floats and bools in their own frame (no globals, strings,
+// structs or late-bound calls) are translated to x86-64 once they've been called `HotCallCount`
+// times. Each instruction becomes a fixed template over the frame's slots, which live in the
+// native stack frame; there's no register allocation. Types come from running the bytecode
+// abstractly from the argument types of the call that made the function hot, so generic and
+// quickened operations compile as long as their operands always have the same type. Calls
+// with other argument types, and functions using anything else, stay interpreted.
+//
+// Compiled functions have no side effects, so when native code can't finish a call (division
+// by zero, native recursion deeper than `MaxNativeDepth`, a callee that went back to the
+// interpreter) it bails out and the interpreter runs the call again from the start, producing
+// the real result or error. A function that keeps bailing out is interpreted for good.
+class Jit
+{
+public:
+    static constexpr uint32_t HotCallCount = 1000;
+    // Nested native calls before bailing out, keeps deep recursion off the machine stack
+    static constexpr uint32_t MaxNativeDepth = 4096;
+    static constexpr uint32_t MaxBailouts = 16;
+    // Largest frame (locals + operands) that's compiled
+    static constexpr uint32_t MaxSlots = 64;
+
+    // `code` are the instructions the interpreter runs, `bytecode` has their operand tables
+    Jit(std::span<const Instruction> code, const BytecodeInstructionSet& bytecode, const FunctionTable& functionTable);
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Counts a call to `functionIndex` with its arguments on top of `stack`, and runs it natively
+    // if it's compiled (or just became hot). On success the arguments are replaced by the result,
+    // false leaves the stack as it was for the interpreter to make the call.
+    bool call(uint32_t functionIndex, OperandStack& stack);
+
+private:
+    // Takes the argument slots and the calls left before `MaxNativeDepth`. The result's bits
+    // are in the low half, the high half is non-zero if the call bailed out.
+    using NativeFunction = uint64_t (*)(const uint64_t* args, uint64_t depth);
+
+    enum class State : uint8_t
+    {
+        Interpreted,
+        Compiling,
+        Compiled,
+        // Not compilable, or bailed out too often
+        Failed,
+    };
+
+    struct Function
+    {
+        State state = State::Interpreted;
+        uint32_t calls = 0;
+        uint32_t bailouts = 0;
+        // Argument types the code was compiled for, checked on every call
+        std::vector<ValueType> paramTypes;
+    };
+
+    std::span<const Instruction> code;
+    const BytecodeInstructionSet& bytecode;
+    const FunctionTable& functionTable;
+
+    std::vector<Function> functions;
+    // Entry of each compiled function, null otherwise. Native calls load their callee's entry
+    // from here, so the table never moves.
+    std::unique_ptr<NativeFunction[]> entries;
+
+    // Executable mappings, unmapped with the JIT
+    std::vector<std::pair<void*, size_t>> codeBlocks;
+
+    // Compiles `functionIndex` for arguments of `paramTypes`, compiling the functions it calls
+    // first. False (and the function marked Failed) if it can't be compiled.
+    bool compile(uint32_t functionIndex, const std::vector<ValueType>& paramTypes);
+
+    // Copies `code` into a new executable mapping
+    void* install(const std::vector<uint8_t>& code);
+};
@@ -118,6 +118,29 @@ Token Lexer::nextToken() {
             }
             advance();
             return tok(TokenType::Equals, "=");
+        case '!':
+            if (peek() == '=') {
+                advance(2);
+                return tok(TokenType::NotEquals, "!=");
+            }
+            break;
+        case '<':
+            if (peek() == '=') {
+                advance(2);
+                return tok(TokenType::LessThanEquals, "<=");
+            }
+            advance();
+            return tok(TokenType::LessThan, "<");
+        case '>':
+            if (peek() == '=') {
+                advance(2);
+                return tok(TokenType::GreaterThanEquals, ">=");
+            }
+            advance();
+            return tok(TokenType::GreaterThan, ">");
+        case '%':
+            advance();
+            return tok(TokenType::Percent, "%");
         default: break;
         // Add more as needed
         }
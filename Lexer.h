@@ -29,6 +29,12 @@ enum class TokenType
     ReturnKeyword,
     Equals,
     EqualsEquals,
+    NotEquals,
+    LessThan,
+    LessThanEquals,
+    GreaterThan,
+    GreaterThanEquals,
+    Percent,
     Plus,
     PlusPlus,
     Minus,
@@ -62,6 +68,12 @@ inline const char* to_string(TokenType e) {
     case TokenType::ReturnKeyword: return "ReturnKeyword";
     case TokenType::Equals: return "Equals";
     case TokenType::EqualsEquals: return "EqualsEquals";
+    case TokenType::NotEquals: return "NotEquals";
+    case TokenType::LessThan: return "LessThan";
+    case TokenType::LessThanEquals: return "LessThanEquals";
+    case TokenType::GreaterThan: return "GreaterThan";
+    case TokenType::GreaterThanEquals: return "GreaterThanEquals";
+    case TokenType::Percent: return "Percent";
     case TokenType::Plus: return "Plus";
     case TokenType::PlusPlus: return "PlusPlus";
     case TokenType::Minus: return "Minus";
@@ -0,0 +1,253 @@
+#include "ObjectHeap.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "RuntimeValue.h"
+#include "Utils.h"
+
+namespace
+{
+    enum class Phase
+    {
+        Idle,
+        Marking,
+        Sweeping,
+    };
+
+    struct HeapState
+    {
+        ObjectHeap::Config config;
+        ObjectHeap::Stats stats;
+
+        // Free blocks of each size class, linked through their first word
+        std::array<void*, ObjectHeap::MaxSmallSize / ObjectHeap::Granularity + 1> freeLists = {};
+
+        // Every object the collector owns, survivors of a sweep are relinked in front
+        HeapObject* objects = nullptr;
+        size_t bytesSinceCollection = 0;
+        // `bytesSinceCollection` that starts the next collection
+        size_t threshold = ObjectHeap::Config().initialThreshold;
+
+        std::unordered_map<uint32_t, std::function<void()>> roots;
+        uint32_t nextRootsId = 0;
+
+        Phase phase = Phase::Idle;
+        // Marked objects whose fields haven't been marked yet
+        std::vector<HeapObject*> markStack;
+        // Objects left to sweep, detached from `objects` when sweeping starts
+        HeapObject* unswept = nullptr;
+    };
+
+    // Never destroyed, like the string table, values in other static objects may outlive it
+    HeapState& state() {
+        static auto* heap = new HeapState();
+        return *heap;
+    }
+
+    size_t sizeClass(size_t size) {
+        return (size + ObjectHeap::Granularity - 1) / ObjectHeap::Granularity;
+    }
+}
+
+void* ObjectHeap::allocate(size_t size) {
+    auto& heap = state();
+    size = std::max(sizeClass(size), size_t(1)) * Granularity;
+
+    heap.stats.bytesAllocated += size;
+    heap.stats.liveBytes += size;
+    heap.bytesSinceCollection += size;
+    if (heap.bytesSinceCollection >= heap.threshold) {
+        collectionPending = true;
+    }
+
+    if (size > MaxSmallSize) {
+        return ::operator new(size);
+    }
+
+    void*& freeList = heap.freeLists[size / Granularity];
+    if (!freeList) {
+        // Carve a new chunk into blocks of this size
+        auto* chunk = static_cast<std::byte*>(::operator new(ChunkSize));
+        for (size_t offset = 0; offset + size <= ChunkSize; offset += size) {
+            *reinterpret_cast<void**>(chunk + offset) = freeList;
+            freeList = chunk + offset;
+        }
+    }
+
+    void* block = freeList;
+    freeList = *static_cast<void**>(block);
+    return block;
+}
+
+void ObjectHeap::deallocate(void* memory, size_t size) {
+    auto& heap = state();
+    size = std::max(sizeClass(size), size_t(1)) * Granularity;
+    heap.stats.liveBytes -= size;
+
+    if (size > MaxSmallSize) {
+        ::operator delete(memory);
+        return;
+    }
+
+    void*& freeList = heap.freeLists[size / Granularity];
+    *static_cast<void**>(memory) = freeList;
+    freeList = memory;
+}
+
+void ObjectHeap::adopt(StructObject* object) {
+    auto& heap = state();
+    object->next = heap.objects;
+    heap.objects = object;
+    ++heap.stats.liveObjects;
+}
+
+uint32_t ObjectHeap::addRoots(std::function<void()> scanRoots) {
+    auto& heap = state();
+    const uint32_t id = heap.nextRootsId++;
+    heap.roots.emplace(id, std::move(scanRoots));
+    return id;
+}
+
+void ObjectHeap::removeRoots(uint32_t id) {
+    state().roots.erase(id);
+}
+
+void ObjectHeap::mark(const RuntimeValue& value) {
+    if (value.type != ValueType::Struct) {
+        return;
+    }
+
+    auto* object = value.object<StructObject>();
+    if (!object->marked) {
+        object->marked = true;
+        state().markStack.push_back(object);
+    }
+}
+
+void ObjectHeap::remark(HeapObject* object) {
+    state().markStack.push_back(object);
+}
+
+void ObjectHeap::configure(const Config& config) {
+    auto& heap = state();
+    heap.config = config;
+    heap.threshold = config.initialThreshold;
+}
+
+const ObjectHeap::Stats& ObjectHeap::stats() {
+    return state().stats;
+}
+
+void ObjectHeap::printStats(std::ostream& os) {
+    const Stats& stats = state().stats;
+    os << "GC: " << stats.collections << " collections, " << stats.bytesAllocated << " bytes allocated, "
+        << stats.liveBytes << " bytes in " << stats.liveObjects << " live objects, max pause "
+        << TimeStat::FormatStatTimeDuration(stats.maxPause) << ", total "
+        << TimeStat::FormatStatTimeDuration(stats.totalPause) << std::endl;
+}
+
+// Works through the collector's phases until the collection is done or `deadline` passes
+static bool runPhases(HeapState& heap, std::chrono::steady_clock::time_point deadline) {
+    // Checking the clock is slow compared to marking or freeing one object
+    constexpr int ObjectsPerClockCheck = 64;
+    int untilClockCheck = ObjectsPerClockCheck;
+    const auto outOfTime = [&] {
+        if (--untilClockCheck > 0) {
+            return false;
+        }
+        untilClockCheck = ObjectsPerClockCheck;
+        return std::chrono::steady_clock::now() >= deadline;
+    };
+    const auto scanRoots = [&] {
+        for (auto& [id, scan] : heap.roots) {
+            scan();
+        }
+    };
+    const auto drainMarkStack = [&](bool bounded) {
+        while (!heap.markStack.empty()) {
+            if (bounded && outOfTime()) {
+                return false;
+            }
+            auto* object = static_cast<StructObject*>(heap.markStack.back());
+            heap.markStack.pop_back();
+            for (const auto& field : object->fields.fields) {
+                ObjectHeap::mark(field);
+            }
+        }
+        return true;
+    };
+
+    if (heap.phase == Phase::Idle) {
+        heap.phase = Phase::Marking;
+        scanRoots();
+    }
+
+    if (heap.phase == Phase::Marking) {
+        if (!drainMarkStack(true)) {
+            return false;
+        }
+        // Roots changed while marking was spread over several steps, anything new they hold is
+        // only reachable from them. Stores into objects were caught by the write barrier.
+        scanRoots();
+        drainMarkStack(false);
+
+        heap.phase = Phase::Sweeping;
+        heap.unswept = heap.objects;
+        heap.objects = nullptr;
+    }
+
+    while (heap.unswept) {
+        if (outOfTime()) {
+            return false;
+        }
+        HeapObject* object = heap.unswept;
+        heap.unswept = object->next;
+        if (object->marked) {
+            object->marked = false;
+            object->next = heap.objects;
+            heap.objects = object;
+        } else {
+            auto* structObject = static_cast<StructObject*>(object);
+            structObject->~StructObject();
+            ObjectHeap::deallocate(structObject, sizeof(StructObject));
+            --heap.stats.liveObjects;
+        }
+    }
+
+    heap.phase = Phase::Idle;
+    return true;
+}
+
+void ObjectHeap::step() {
+    auto& heap = state();
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = heap.config.incremental ? start + heap.config.pauseBudget : std::chrono::steady_clock::time_point::max();
+
+    marking = true;
+    const bool finished = runPhases(heap, deadline);
+    // Only stores made while marking is still in progress need the barrier
+    marking = heap.phase == Phase::Marking;
+
+    if (finished) {
+        ++heap.stats.collections;
+        heap.bytesSinceCollection = 0;
+        heap.threshold = std::max(heap.config.initialThreshold, heap.stats.liveBytes);
+        collectionPending = false;
+    }
+
+    const auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    heap.stats.maxPause = std::max(heap.stats.maxPause, pause);
+    heap.stats.totalPause += pause;
+}
+
+void ObjectHeap::collect() {
+    auto& heap = state();
+    const bool incremental = heap.config.incremental;
+    heap.config.incremental = false;
+    step();
+    heap.config.incremental = incremental;
+}
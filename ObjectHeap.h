@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+
+class RuntimeValue;
+struct StructObject;
+
+// Header of every object owned by `ObjectHeap`
+struct HeapObject
+{
+    // Next object in the heap's list of all objects
+    HeapObject* next = nullptr;
+    bool marked = false;
+    // Set once a second value refers to the object and never cleared (a one-bit reference
+    // count). A shared object is copied before it's written to.
+    bool shared = false;
+};
+
+// Garbage collected heap for struct objects (strings are refcounted, see `StringHeap`).
+//
+// Values only point at their objects, copying or dropping a value never touches a count.
+// Memory comes from free lists segregated by size, and a mark-sweep collector frees the
+// objects no root reaches. Roots are registered by whoever holds values the collector can't
+// see otherwise: the interpreters' stacks, globals and constants, and struct layout defaults.
+//
+// Collections only run at safepoints (calls), where every live value is reachable from a
+// root. In incremental mode each safepoint does at most `pauseBudget` of work; stores into
+// objects that were already marked put them back on the mark stack, and the roots are
+// scanned again before sweeping.
+class ObjectHeap
+{
+public:
+    struct Config
+    {
+        bool incremental = false;
+        // Longest a single incremental step should take
+        std::chrono::microseconds pauseBudget = std::chrono::microseconds(500);
+        // Bytes allocated before the first collection, later ones start at twice the live size
+        size_t initialThreshold = 1024 * 1024;
+    };
+
+    struct Stats
+    {
+        // Total over the process, freed memory included
+        size_t bytesAllocated = 0;
+        size_t liveBytes = 0;
+        size_t liveObjects = 0;
+        uint64_t collections = 0;
+        std::chrono::nanoseconds maxPause = std::chrono::nanoseconds::zero();
+        std::chrono::nanoseconds totalPause = std::chrono::nanoseconds::zero();
+    };
+
+    // Blocks up to `MaxSmallSize` are rounded up to a multiple of `Granularity` and come from
+    // that size's free list, larger ones from operator new
+    static constexpr size_t Granularity = 16;
+    static constexpr size_t MaxSmallSize = 512;
+    // Free lists are refilled a chunk at a time, chunks are never returned
+    static constexpr size_t ChunkSize = 64 * 1024;
+
+    static void* allocate(size_t size);
+    static void deallocate(void* memory, size_t size);
+
+    // Hands a `StructObject` constructed in memory from `allocate` to the collector
+    static void adopt(StructObject* object);
+
+    // `scanRoots` calls `mark` for every value it holds, returns an id for `removeRoots`
+    static uint32_t addRoots(std::function<void()> scanRoots);
+    static void removeRoots(uint32_t id);
+
+    static void mark(const RuntimeValue& value);
+
+    // Runs a collection (or in incremental mode, a step of one) once enough has been allocated
+    static void safepoint() {
+        if (collectionPending) [[unlikely]] {
+            step();
+        }
+    }
+
+    // Finishes the current collection or runs a full one, ignoring the pause budget
+    static void collect();
+
+    // Must be called before writing to `object`, keeps incremental marking correct
+    static void writeBarrier(HeapObject* object) {
+        if (marking && object->marked) [[unlikely]] {
+            remark(object);
+        }
+    }
+
+    static void configure(const Config& config);
+    static const Stats& stats();
+
+    static void printStats(std::ostream& os);
+
+private:
+    static inline bool collectionPending = false;
+    static inline bool marking = false;
+
+    static void step();
+    static void remark(HeapObject* object);
+};
+
+// Allocates from `ObjectHeap`'s size classes, used for struct field storage
+template <typename T>
+class HeapAllocator
+{
+public:
+    using value_type = T;
+
+    HeapAllocator() = default;
+    template <typename U>
+    HeapAllocator(const HeapAllocator<U>&) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(ObjectHeap::allocate(count * sizeof(T))); }
+    void deallocate(T* memory, size_t count) { ObjectHeap::deallocate(memory, count * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const HeapAllocator<U>&) const { return true; }
+};
@@ -48,6 +48,11 @@ class Parser
             token.type == TokenType::StringKeyword;
     }
 
+    // A type keyword, or a struct name followed by the declared name (`Point p`)
+    bool startsDeclaration() {
+        return isType(currentToken) || (currentToken.type == TokenType::Identifier && peek().type == TokenType::Identifier);
+    }
+
 public:
     explicit Parser(Shared<Lexer> lexer) :
         lexer(std::move(lexer)) {
@@ -67,7 +72,7 @@ public:
                 continue;
             }
 
-            if (isType(currentToken)) {
+            if (startsDeclaration()) {
                 Shared<AstNode> node = parseFunctionOrVariable();
                 if (node != nullptr) {
                     if (auto functionNode = std::dynamic_pointer_cast<FunctionNode>(node)) {
@@ -201,6 +206,10 @@ public:
 #pragma region "Statement Parsing"
 
     Shared<AstNode> parseStatement() {
+        if (startsDeclaration()) {
+            return parseVariableDeclaration();
+        }
+
         switch (currentToken.type) {
             case TokenType::Identifier:
                 return parseAssignment();
@@ -214,6 +223,26 @@ public:
         }
     }
 
+    /**
+     * int a;
+     * int a = 5;
+     * Point p;
+     */
+    Shared<VariableDeclarationNode> parseVariableDeclaration() {
+        Token type = currentToken;
+        advance(); // Move to the name
+        std::string name = currentToken.value;
+        expect(TokenType::Identifier);
+
+        auto node = std::make_shared<VariableDeclarationNode>(name, type);
+        if (match(TokenType::Equals)) {
+            node->initializer = parseExpression();
+        }
+        expect(TokenType::Semicolon);
+
+        return node;
+    }
+
     Shared<ReturnStatementNode> parseReturnStatement() {
         expect(TokenType::ReturnKeyword);
 
@@ -279,9 +308,10 @@ public:
         }
 
         // It's a variable declaration
-        advance(); // Move to ';'
-        // expect(TokenType::Semicolon);
-        return std::make_shared<VariableDeclarationNode>(identifier, type);
+        currentToken = startToken;
+        lexer->returnTo(startToken.lexerState);
+
+        return parseVariableDeclaration();
     }
 
     Shared<AstNode> parseIfStatement() {
@@ -453,15 +483,25 @@ public:
     static int getPrecedence(TokenType type) {
         // Return the operator precedence
         switch (type) {
+            case TokenType::EqualsEquals:
+            case TokenType::NotEquals:
+                return 1;
+            case TokenType::LessThan:
+            case TokenType::LessThanEquals:
+            case TokenType::GreaterThan:
+            case TokenType::GreaterThanEquals:
+                return 2;
             case TokenType::Plus:
             case TokenType::Minus:
-                return 1;
+                return 3;
             case TokenType::Star:
             case TokenType::Slash:
-                return 2;
+            case TokenType::Percent:
+                return 4;
             // Add more operators and their precedence as needed
             default:
-                return 0;
+                // Not a binary operator, ends the expression (e.g. the `=` of an assignment)
+                return -1;
         }
     }
 
@@ -0,0 +1,82 @@
+#include "RegisterBytecode.h"
+
+RegisterInstructionSet& RegisterInstructionSet::push(RegisterOpcode opcode, uint16_t a, uint16_t b, uint16_t c) {
+    push_back(RegisterInstruction(opcode, a, b, c));
+    return *this;
+}
+
+uint16_t RegisterInstructionSet::addConstant(const RuntimeValue& value) {
+    const uint32_t index = constants.add(value);
+    if (index > UINT16_MAX) {
+        throw std::runtime_error("Too many constants for a 16-bit register operand");
+    }
+    return static_cast<uint16_t>(index);
+}
+
+uint16_t RegisterInstructionSet::addName(const std::string& name) {
+    if (const auto it = nameIndices.find(name); it != nameIndices.end()) {
+        return it->second;
+    }
+    if (names.size() > UINT16_MAX) {
+        throw std::runtime_error("Too many names for a 16-bit register operand");
+    }
+
+    const auto index = static_cast<uint16_t>(names.size());
+    names.push_back(name);
+    nameIndices.emplace(name, index);
+    return index;
+}
+
+void RegisterInstructionSet::dump() {
+    std::cout << "------------ " << size() << " register instructions, " << size() * sizeof(RegisterInstruction) << " bytes, "
+        << constants.size() << " constants" << std::endl;
+    for (size_t pc = 0; pc < size(); ++pc) {
+        auto& instruction = (*this)[pc];
+        std::cout << std::setw(4) << pc << ": " << to_string(instruction.opcode);
+        switch (instruction.opcode) {
+            case RegisterOpcode::LOAD_CONST:
+                std::cout << " r" << instruction.a << ", " << constants[instruction.b];
+                break;
+            case RegisterOpcode::LOAD_GLOBAL:
+            case RegisterOpcode::STORE_GLOBAL:
+            case RegisterOpcode::CALL_NAMED:
+            case RegisterOpcode::TAIL_CALL_NAMED:
+                std::cout << " r" << instruction.a << ", " << names[instruction.b];
+                break;
+            case RegisterOpcode::LOAD_FIELD:
+                std::cout << " r" << instruction.a << ", r" << instruction.b << "." << names[instruction.c];
+                break;
+            case RegisterOpcode::STORE_FIELD:
+                std::cout << " r" << instruction.a << "." << names[instruction.b] << ", r" << instruction.c;
+                break;
+            case RegisterOpcode::CHECK_TYPE:
+                std::cout << " r" << instruction.a << ", " << to_string(static_cast<ValueType>(instruction.b));
+                break;
+            case RegisterOpcode::CHECK_STRUCT:
+                std::cout << " r" << instruction.a << ", layout#" << instruction.b;
+                break;
+            case RegisterOpcode::JUMP:
+                std::cout << " @" << instruction.target();
+                break;
+            case RegisterOpcode::JUMP_IF_FALSE:
+                std::cout << " r" << instruction.a << ", @" << instruction.target();
+                break;
+            case RegisterOpcode::CALL:
+            case RegisterOpcode::TAIL_CALL:
+                std::cout << " r" << instruction.a << ", fn#" << instruction.b;
+                break;
+            case RegisterOpcode::MOVE:
+                std::cout << " r" << instruction.a << ", r" << instruction.b;
+                break;
+            case RegisterOpcode::RETURN:
+                std::cout << " r" << instruction.a;
+                break;
+            case RegisterOpcode::RETURN_NONE:
+                break;
+            default:
+                std::cout << " r" << instruction.a << ", r" << instruction.b << ", r" << instruction.c;
+                break;
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Common.h"
+#include "ConstantPool.h"
+#include "RuntimeValue.h"
+
+// Three-address opcodes for the register VM. `R[x]` is register x of the current frame,
+// `K[x]` a constant pool entry, `N[x]` an entry of the names table and `fn[x]` a function
+// descriptor. Jump targets use the 32-bit `target()` made of `b` and `c`.
+#define REGISTER_OPCODE_LIST(X) \
+    /* R[a] = K[b] */ \
+    X(LOAD_CONST) \
+    /* R[a] = R[b] */ \
+    X(MOVE) \
+    /* R[a] = globals[N[b]] */ \
+    X(LOAD_GLOBAL) \
+    /* globals[N[b]] = R[a] */ \
+    X(STORE_GLOBAL) \
+    \
+    /* R[a] = R[b] op R[c] */ \
+    X(ADD) \
+    X(SUB) \
+    X(MUL) \
+    X(DIV) \
+    X(MOD) \
+    X(EQ) \
+    X(NEQ) \
+    X(LT) \
+    X(LTE) \
+    X(GT) \
+    X(GTE) \
+    \
+    /* R[a] = R[b].N[c] */ \
+    X(LOAD_FIELD) \
+    /* R[a].N[b] = R[c] */ \
+    X(STORE_FIELD) \
+    /* R[a] = new instance of struct layout b */ \
+    X(NEW_STRUCT) \
+    \
+    /* Fails unless R[a] has type b, a `ValueType` */ \
+    X(CHECK_TYPE) \
+    /* Fails unless R[a] is an instance of struct layout b */ \
+    X(CHECK_STRUCT) \
+    \
+    /* pc = target */ \
+    X(JUMP) \
+    /* if R[a] is falsy: pc = target */ \
+    X(JUMP_IF_FALSE) \
+    \
+    /* R[a] = fn[b](R[a], ..., R[a + arity - 1]), the callee's registers start at R[a] */ \
+    X(CALL) \
+    /* Same as CALL, callee looked up by name N[b] on every call (late bound), c is the argument count */ \
+    X(CALL_NAMED) \
+    /* return fn[b](R[a], ...), reusing the current frame */ \
+    X(TAIL_CALL) \
+    X(TAIL_CALL_NAMED) \
+    /* return R[a] */ \
+    X(RETURN) \
+    /* return None */ \
+    X(RETURN_NONE)
+
+enum class RegisterOpcode : uint8_t
+{
+#define REGISTER_OPCODE_ENUM(op) op,
+    REGISTER_OPCODE_LIST(REGISTER_OPCODE_ENUM)
+#undef REGISTER_OPCODE_ENUM
+};
+
+inline const char* to_string(RegisterOpcode e) {
+    switch (e) {
+#define REGISTER_OPCODE_NAME(op) case RegisterOpcode::op: return #op;
+        REGISTER_OPCODE_LIST(REGISTER_OPCODE_NAME)
+#undef REGISTER_OPCODE_NAME
+        default: return "unknown";
+    }
+}
+
+class RegisterInstruction
+{
+public:
+    RegisterOpcode opcode;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    [[nodiscard]] uint32_t target() const { return static_cast<uint32_t>(b) | static_cast<uint32_t>(c) << 16; }
+
+    void setTarget(uint32_t address) {
+        b = static_cast<uint16_t>(address & 0xFFFF);
+        c = static_cast<uint16_t>(address >> 16);
+    }
+};
+
+static_assert(sizeof(RegisterInstruction) == 8, "RegisterInstruction should stay 8 bytes");
+
+class RegisterInstructionSet : public std::vector<RegisterInstruction>
+{
+public:
+    RegisterInstructionSet& push(RegisterOpcode opcode, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+
+    uint16_t addConstant(const RuntimeValue& value);
+    uint16_t addName(const std::string& name);
+
+    void dump();
+
+    // Operand tables, shared by all instructions in the set
+    ConstantPool constants;
+    std::vector<InternedString> names;
+
+private:
+    std::unordered_map<std::string, uint16_t> nameIndices;
+};
@@ -0,0 +1,429 @@
+#include "RegisterCompiler.h"
+
+#include "StructLayout.h"
+#include "SymbolTable.h"
+#include "Utils.h"
+
+RegisterCompiler::RegisterCompiler() {
+    functionTable = std::make_shared<FunctionTable>();
+    structLayouts = std::make_shared<StructLayoutTable>();
+}
+
+void RegisterCompiler::compileProgram(const Shared<ProgramNode>& program) {
+    TIMED_FUNCTION();
+    structLayouts->define(program);
+    types.infer(program);
+    // Execution starts at `main`, so like with the stack VM only functions produce code
+    for (auto& stmt : program->statements) {
+        if (const auto n = std::dynamic_pointer_cast<FunctionNode>(stmt)) {
+            compileFunction(n);
+        }
+    }
+    link();
+}
+
+void RegisterCompiler::link() {
+    for (auto& instruction : instructions) {
+        if (instruction.opcode != RegisterOpcode::CALL_NAMED && instruction.opcode != RegisterOpcode::TAIL_CALL_NAMED)
+            continue;
+
+        uint32_t index;
+        if (functionTable->lookup(instructions.names[instruction.b], index) && index <= UINT16_MAX) {
+            const uint16_t arity = functionTable->descriptors[index].arity;
+            if (arity != instruction.c) {
+                throw std::runtime_error(std::format("Function {} takes {} arguments, called with {}", instructions.names[instruction.b].str(), arity, instruction.c));
+            }
+            instruction.opcode = instruction.opcode == RegisterOpcode::CALL_NAMED ? RegisterOpcode::CALL : RegisterOpcode::TAIL_CALL;
+            instruction.b = static_cast<uint16_t>(index);
+        }
+    }
+}
+
+void RegisterCompiler::compileFunction(const Shared<FunctionNode>& node) {
+    const size_t startAddress = instructions.size();
+
+    scope = std::make_shared<FunctionScope>();
+    functionTypes = &types.function(node.get());
+    for (const auto& param : node->parameters) {
+        scope->declare(param.second);
+    }
+    declareLocals(node->body);
+    if (scope->size() > UINT16_MAX) {
+        throw std::runtime_error("Too many locals in function: " + node->name);
+    }
+
+    // Parameters are the first registers, check what the caller passed like the stack VM does
+    for (const auto& param : node->parameters) {
+        uint32_t slot, layoutIndex;
+        scope->resolve(param.second, slot);
+        const auto it = functionTypes->declared.find(param.second);
+        if (it != functionTypes->declared.end() && it->second != ValueType::None) {
+            instructions.push(RegisterOpcode::CHECK_TYPE, static_cast<uint16_t>(slot), static_cast<uint16_t>(it->second));
+        }
+        if (declaredLayout(param.second, layoutIndex)) {
+            instructions.push(RegisterOpcode::CHECK_STRUCT, static_cast<uint16_t>(slot), static_cast<uint16_t>(layoutIndex));
+        }
+    }
+
+    nextRegister = static_cast<uint16_t>(scope->size());
+    frameSize = nextRegister;
+
+    compileBlock(node->body);
+
+    if (node->body->statements.empty() || !std::dynamic_pointer_cast<ReturnStatementNode>(node->body->statements.back())) {
+        instructions.push(RegisterOpcode::RETURN_NONE);
+    }
+
+    // A frame needs at least one register for the value it returns
+    functionTable->define(node, startAddress, std::max<uint16_t>(frameSize, 1));
+    scope = nullptr;
+    functionTypes = nullptr;
+}
+
+void RegisterCompiler::compileStatement(const Shared<AstNode>& node) {
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        return compileBlock(n);
+    }
+    if (const auto n = std::dynamic_pointer_cast<AssignmentNode>(node)) {
+        return compileAssignment(n);
+    }
+    if (const auto n = std::dynamic_pointer_cast<ReturnStatementNode>(node)) {
+        return compileReturnStatement(n);
+    }
+    if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        return compileIfStatement(n);
+    }
+    if (const auto n = std::dynamic_pointer_cast<VariableDeclarationNode>(node)) {
+        return compileVariableDeclaration(n);
+    }
+    if (const auto n = std::dynamic_pointer_cast<ExprNode>(node)) {
+        // Evaluated for its side effects, the result register is simply released
+        compileExpression(n);
+        return;
+    }
+    throw std::runtime_error("[RegisterCompiler::compileStatement] Unknown/Unhandled node type: " + std::string(node->name));
+}
+
+void RegisterCompiler::compileBlock(const Shared<BlockNode>& node) {
+    for (auto& stmt : node->statements) {
+        const uint16_t mark = nextRegister;
+        compileStatement(stmt);
+        nextRegister = mark;
+    }
+}
+
+void RegisterCompiler::compileAssignment(const Shared<AssignmentNode>& node) {
+    if (!node->rhs) {
+        return;
+    }
+
+    if (const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(node->lhs)) {
+        uint32_t slot;
+        if (scope->resolve(lhsVar->identifier, slot)) {
+            // Computed straight into the local's register
+            compileExpression(node->rhs, static_cast<int>(slot));
+            compileTypeGuard(lhsVar->identifier, node->rhs, static_cast<uint16_t>(slot));
+        } else {
+            instructions.push(RegisterOpcode::STORE_GLOBAL, compileExpression(node->rhs), instructions.addName(lhsVar->identifier));
+        }
+        return;
+    }
+
+    if (const auto lhsMemberAccess = std::dynamic_pointer_cast<MemberAccessNode>(node->lhs)) {
+        compileStoreMember(lhsMemberAccess, compileExpression(node->rhs), node->rhs);
+    }
+}
+
+void RegisterCompiler::compileVariableDeclaration(const Shared<VariableDeclarationNode>& node) {
+    uint32_t layoutIndex;
+    const bool isStruct = structLayouts->lookup(node->type->typeName, layoutIndex);
+    // Declarations of unknown types don't hold anything until they're assigned
+    if (!isStruct && valueTypeFromName(node->type->typeName) == ValueType::None) {
+        return;
+    }
+
+    uint32_t slot;
+    scope->resolve(node->name, slot);
+    if (node->initializer) {
+        compileExpression(node->initializer, static_cast<int>(slot));
+        compileTypeGuard(node->name, node->initializer, static_cast<uint16_t>(slot));
+    } else if (isStruct) {
+        instructions.push(RegisterOpcode::NEW_STRUCT, static_cast<uint16_t>(slot), static_cast<uint16_t>(layoutIndex));
+    } else {
+        instructions.push(RegisterOpcode::LOAD_CONST, static_cast<uint16_t>(slot), instructions.addConstant(RuntimeValue(node->type->typeName, {})));
+    }
+}
+
+void RegisterCompiler::compileReturnStatement(const Shared<ReturnStatementNode>& node) {
+    if (const auto call = std::dynamic_pointer_cast<FunctionCallNode>(node->expression)) {
+        const uint16_t base = compileArguments(call->arguments);
+        instructions.push(RegisterOpcode::TAIL_CALL_NAMED, base, instructions.addName(call->functionName), static_cast<uint16_t>(call->arguments.size()));
+        return;
+    }
+
+    if (node->expression) {
+        instructions.push(RegisterOpcode::RETURN, compileExpression(node->expression));
+    } else {
+        instructions.push(RegisterOpcode::RETURN_NONE);
+    }
+}
+
+void RegisterCompiler::compileIfStatement(const Shared<IfStatementNode>& node) {
+    const uint16_t mark = nextRegister;
+    const uint16_t condition = compileExpression(node->condition);
+    nextRegister = mark;
+
+    const size_t jumpToElse = instructions.size();
+    instructions.push(RegisterOpcode::JUMP_IF_FALSE, condition);
+    compileBlock(node->thenBranch);
+
+    if (node->elseBranch) {
+        const size_t jumpToEnd = instructions.size();
+        instructions.push(RegisterOpcode::JUMP);
+
+        instructions[jumpToElse].setTarget(static_cast<uint32_t>(instructions.size()));
+        compileBlock(node->elseBranch);
+        instructions[jumpToEnd].setTarget(static_cast<uint32_t>(instructions.size()));
+    } else {
+        instructions[jumpToElse].setTarget(static_cast<uint32_t>(instructions.size()));
+    }
+}
+
+uint16_t RegisterCompiler::compileExpression(const Shared<ExprNode>& node, int target) {
+    const auto loadConstant = [&](const RuntimeValue& value) {
+        const uint16_t dst = target >= 0 ? static_cast<uint16_t>(target) : allocateRegister();
+        instructions.push(RegisterOpcode::LOAD_CONST, dst, instructions.addConstant(value));
+        return dst;
+    };
+
+    if (const auto n = std::dynamic_pointer_cast<FloatNode>(node)) {
+        return loadConstant(n->value);
+    }
+    if (const auto n = std::dynamic_pointer_cast<IntNode>(node)) {
+        return loadConstant(n->value);
+    }
+    if (const auto n = std::dynamic_pointer_cast<BooleanNode>(node)) {
+        return loadConstant(n->value);
+    }
+    if (const auto n = std::dynamic_pointer_cast<StringNode>(node)) {
+        return loadConstant(n->value);
+    }
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        uint32_t slot;
+        if (scope && scope->resolve(n->identifier, slot)) {
+            if (target < 0 || static_cast<uint32_t>(target) == slot) {
+                return static_cast<uint16_t>(slot);
+            }
+            instructions.push(RegisterOpcode::MOVE, static_cast<uint16_t>(target), static_cast<uint16_t>(slot));
+            return static_cast<uint16_t>(target);
+        }
+
+        const uint16_t dst = target >= 0 ? static_cast<uint16_t>(target) : allocateRegister();
+        instructions.push(RegisterOpcode::LOAD_GLOBAL, dst, instructions.addName(n->identifier));
+        return dst;
+    }
+    if (const auto n = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+        return compileBinaryOp(n, target);
+    }
+    if (const auto n = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+        return compileFunctionCall(n, target);
+    }
+    if (const auto n = std::dynamic_pointer_cast<MemberAccessNode>(node)) {
+        return compileMemberAccess(n, target);
+    }
+
+    throw std::runtime_error("[RegisterCompiler::compileExpression] Unknown/Unhandled node type: " + std::string(node->name));
+}
+
+uint16_t RegisterCompiler::compileBinaryOp(const Shared<BinaryOpNode>& node, int target) {
+    RegisterOpcode opcode;
+    switch (node->op) {
+        case TokenType::Plus:
+        case TokenType::PlusPlus:
+            opcode = RegisterOpcode::ADD;
+            break;
+        case TokenType::Minus:
+        case TokenType::MinusMinus:
+            opcode = RegisterOpcode::SUB;
+            break;
+        case TokenType::Star: opcode = RegisterOpcode::MUL; break;
+        case TokenType::Slash: opcode = RegisterOpcode::DIV; break;
+        case TokenType::Percent: opcode = RegisterOpcode::MOD; break;
+        case TokenType::EqualsEquals: opcode = RegisterOpcode::EQ; break;
+        case TokenType::NotEquals: opcode = RegisterOpcode::NEQ; break;
+        case TokenType::LessThan: opcode = RegisterOpcode::LT; break;
+        case TokenType::LessThanEquals: opcode = RegisterOpcode::LTE; break;
+        case TokenType::GreaterThan: opcode = RegisterOpcode::GT; break;
+        case TokenType::GreaterThanEquals: opcode = RegisterOpcode::GTE; break;
+        default:
+            throw std::runtime_error("Invalid binary operator: " + std::string(to_string(node->op)));
+    }
+
+    const uint16_t mark = nextRegister;
+    const uint16_t left = compileExpression(node->left);
+    const uint16_t right = compileExpression(node->right);
+
+    // Operands are read before the result is written, so the result may reuse their temporaries
+    nextRegister = mark;
+    const uint16_t dst = target >= 0 ? static_cast<uint16_t>(target) : allocateRegister();
+    instructions.push(opcode, dst, left, right);
+    return dst;
+}
+
+uint16_t RegisterCompiler::compileFunctionCall(const Shared<FunctionCallNode>& node, int target) {
+    const uint16_t mark = nextRegister;
+    const uint16_t base = compileArguments(node->arguments);
+    instructions.push(RegisterOpcode::CALL_NAMED, base, instructions.addName(node->functionName), static_cast<uint16_t>(node->arguments.size()));
+
+    // The result comes back in `base`, the argument registers above it are free again
+    nextRegister = mark;
+    if (target >= 0) {
+        if (static_cast<uint16_t>(target) != base) {
+            instructions.push(RegisterOpcode::MOVE, static_cast<uint16_t>(target), base);
+        }
+        return static_cast<uint16_t>(target);
+    }
+    return allocateRegister();
+}
+
+uint16_t RegisterCompiler::compileMemberAccess(const Shared<MemberAccessNode>& node, int target) {
+    const uint16_t mark = nextRegister;
+    const uint16_t object = compileExpression(node->object);
+
+    nextRegister = mark;
+    const uint16_t dst = target >= 0 ? static_cast<uint16_t>(target) : allocateRegister();
+    instructions.push(RegisterOpcode::LOAD_FIELD, dst, object, instructions.addName(node->member));
+    return dst;
+}
+
+void RegisterCompiler::compileStoreMember(const Shared<MemberAccessNode>& node, uint16_t valueRegister, const Shared<ExprNode>& value) {
+    const uint16_t member = instructions.addName(node->member);
+
+    // STORE_FIELD checks struct typed fields, a value known to have the wrong layout doesn't compile
+    const StructLayout* layout = staticLayout(node->object);
+    uint32_t index;
+    if (layout && value && layout->fieldIndex(node->member, index)) {
+        const StructLayout* fieldLayout = layout->fieldLayouts[index];
+        const StructLayout* valueLayout = staticLayout(value);
+        if (fieldLayout && valueLayout && valueLayout != fieldLayout) {
+            throw std::runtime_error(std::format("Cannot assign {} to {} field '{}'", valueLayout->name.str(), fieldLayout->name.str(), node->member));
+        }
+    }
+
+    if (const auto varNode = std::dynamic_pointer_cast<VariableNode>(node->object)) {
+        uint32_t slot;
+        if (scope->resolve(varNode->identifier, slot)) {
+            instructions.push(RegisterOpcode::STORE_FIELD, static_cast<uint16_t>(slot), member, valueRegister);
+            return;
+        }
+
+        const uint16_t name = instructions.addName(varNode->identifier);
+        const uint16_t object = allocateRegister();
+        instructions.push(RegisterOpcode::LOAD_GLOBAL, object, name);
+        instructions.push(RegisterOpcode::STORE_FIELD, object, member, valueRegister);
+        instructions.push(RegisterOpcode::STORE_GLOBAL, object, name);
+        return;
+    }
+
+    // `a.b.c = v`: structs are values, so update a copy of `a.b` and store that back into `a`
+    const uint16_t object = compileExpression(node->object);
+    instructions.push(RegisterOpcode::STORE_FIELD, object, member, valueRegister);
+    if (const auto parent = std::dynamic_pointer_cast<MemberAccessNode>(node->object)) {
+        compileStoreMember(parent, object, nullptr);
+    }
+}
+
+void RegisterCompiler::compileTypeGuard(const std::string& name, const Shared<ExprNode>& value, uint16_t valueRegister) {
+    uint32_t layoutIndex;
+    if (declaredLayout(name, layoutIndex)) {
+        const StructLayout& layout = (*structLayouts)[layoutIndex];
+        const StructLayout* valueLayout = staticLayout(value);
+        if (!valueLayout) {
+            instructions.push(RegisterOpcode::CHECK_STRUCT, valueRegister, static_cast<uint16_t>(layoutIndex));
+        } else if (valueLayout != &layout) {
+            throw std::runtime_error(std::format("Cannot assign {} to {} variable '{}'", valueLayout->name.str(), layout.name.str(), name));
+        }
+        return;
+    }
+
+    const auto it = functionTypes->declared.find(name);
+    if (it == functionTypes->declared.end() || it->second == ValueType::None) {
+        return;
+    }
+
+    const ValueType valueType = types.typeOf(value, *functionTypes);
+    if (valueType == ValueType::None) {
+        instructions.push(RegisterOpcode::CHECK_TYPE, valueRegister, static_cast<uint16_t>(it->second));
+    } else if (valueType != it->second) {
+        throw std::runtime_error(std::format("Cannot assign {} to {} variable '{}'", to_string(valueType), to_string(it->second), name));
+    }
+}
+
+const StructLayout* RegisterCompiler::staticLayout(const Shared<ExprNode>& node) const {
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        uint32_t slot, layoutIndex;
+        if (scope && scope->resolve(n->identifier, slot) && declaredLayout(n->identifier, layoutIndex)) {
+            return &(*structLayouts)[layoutIndex];
+        }
+        return nullptr;
+    }
+    if (const auto n = std::dynamic_pointer_cast<MemberAccessNode>(node)) {
+        uint32_t index;
+        const StructLayout* layout = staticLayout(n->object);
+        if (layout && layout->fieldIndex(n->member, index)) {
+            return layout->fieldLayouts[index];
+        }
+    }
+    return nullptr;
+}
+
+bool RegisterCompiler::declaredLayout(const std::string& name, uint32_t& outIndex) const {
+    if (!functionTypes) {
+        return false;
+    }
+    const auto it = functionTypes->structs.find(name);
+    return it != functionTypes->structs.end() && structLayouts->lookup(it->second, outIndex);
+}
+
+uint16_t RegisterCompiler::allocateRegister() {
+    if (nextRegister == UINT16_MAX) {
+        throw std::runtime_error("Expression needs too many registers");
+    }
+
+    const uint16_t reg = nextRegister++;
+    frameSize = std::max(frameSize, nextRegister);
+    return reg;
+}
+
+uint16_t RegisterCompiler::compileArguments(const std::vector<Shared<ExprNode>>& arguments) {
+    // Reserve the whole block first so nested expressions get temporaries above it,
+    // a call without arguments still needs `base` for its result
+    const uint16_t base = nextRegister;
+    for (size_t i = 0; i < std::max<size_t>(arguments.size(), 1); ++i) {
+        allocateRegister();
+    }
+
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        compileExpression(arguments[i], static_cast<int>(base + i));
+    }
+    return base;
+}
+
+void RegisterCompiler::declareLocals(const Shared<AstNode>& node) {
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        for (auto& stmt : n->statements) {
+            declareLocals(stmt);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        declareLocals(n->thenBranch);
+        if (n->elseBranch) {
+            declareLocals(n->elseBranch);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<AssignmentNode>(node)) {
+        if (const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(n->lhs)) {
+            scope->declare(lhsVar->identifier);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<VariableDeclarationNode>(node)) {
+        scope->declare(n->name);
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Ast.h"
+#include "Common.h"
+#include "compiler.h"
+#include "RegisterBytecode.h"
+
+class FunctionTable;
+class StructLayoutTable;
+
+// Compiles a program to three-address register bytecode for `RegisterInterpreter`.
+//
+// Each function gets a window of registers: parameters first, then every local it assigns,
+// then temporaries for intermediate values. Temporaries are handed out in stack order and
+// released at the end of each statement. Operands that are already in a register (params
+// and locals) are used in place, so `a + b` is a single `ADD` with no loads.
+class RegisterCompiler
+{
+public:
+    Shared<FunctionTable> functionTable = {};
+
+    Shared<StructLayoutTable> structLayouts = {};
+
+    RegisterInstructionSet instructions = {};
+
+    // Registers of the function being compiled, null at the top level
+    Shared<FunctionScope> scope = nullptr;
+
+    // Declared types are enforced the same way as by `Compiler`
+    TypeInference types;
+    // Types of the function being compiled, null at the top level
+    const TypeInference::FunctionTypes* functionTypes = nullptr;
+
+    RegisterCompiler();
+
+    void compileProgram(const Shared<ProgramNode>& program);
+
+    // Binds CALL_NAMED/TAIL_CALL_NAMED to function descriptors, same as `Compiler::link`
+    void link();
+
+    void compileFunction(const Shared<FunctionNode>& node);
+
+    void compileStatement(const Shared<AstNode>& node);
+
+    void compileBlock(const Shared<BlockNode>& node);
+
+    void compileAssignment(const Shared<AssignmentNode>& node);
+
+    void compileVariableDeclaration(const Shared<VariableDeclarationNode>& node);
+
+    void compileReturnStatement(const Shared<ReturnStatementNode>& node);
+
+    void compileIfStatement(const Shared<IfStatementNode>& node);
+
+    // Compiles `node` and returns the register holding its value.
+    // With a `target` the value always ends up in that register.
+    uint16_t compileExpression(const Shared<ExprNode>& node, int target = -1);
+
+    uint16_t compileBinaryOp(const Shared<BinaryOpNode>& node, int target);
+
+    uint16_t compileFunctionCall(const Shared<FunctionCallNode>& node, int target);
+
+    uint16_t compileMemberAccess(const Shared<MemberAccessNode>& node, int target);
+
+    // Stores `valueRegister` (computed from `value`, null if it has no static layout) into
+    // `node`, writing modified struct copies back to their owner
+    void compileStoreMember(const Shared<MemberAccessNode>& node, uint16_t valueRegister, const Shared<ExprNode>& value);
+
+    // Emits a CHECK_TYPE/CHECK_STRUCT of `valueRegister` after a store of `value` to `name`
+    // when `name` has a declared type and `value` isn't known to have it, throws if it's known not to
+    void compileTypeGuard(const std::string& name, const Shared<ExprNode>& value, uint16_t valueRegister);
+
+    // Layout of the struct `node` is known to evaluate to, null if it isn't known
+    [[nodiscard]] const StructLayout* staticLayout(const Shared<ExprNode>& node) const;
+
+    // Layout `name` is declared with in the current function, e.g. `Point p`
+    bool declaredLayout(const std::string& name, uint32_t& outIndex) const;
+
+private:
+    // Next free temporary and the high-water mark of the function being compiled
+    uint16_t nextRegister = 0;
+    uint16_t frameSize = 0;
+
+    uint16_t allocateRegister();
+
+    // Places call arguments in consecutive registers, returns the first one
+    uint16_t compileArguments(const std::vector<Shared<ExprNode>>& arguments);
+
+    // Gives every variable assigned or declared anywhere in `node` a register
+    void declareLocals(const Shared<AstNode>& node);
+};
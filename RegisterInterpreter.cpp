@@ -0,0 +1,404 @@
+#include "RegisterInterpreter.h"
+
+#include <algorithm>
+
+#include "RegisterCompiler.h"
+#include "StructLayout.h"
+#include "SymbolTable.h"
+#include "Utils.h"
+
+RegisterInterpreter::RegisterInterpreter(const RegisterCompiler& compiler):
+    globals(std::make_shared<SymbolTable>()),
+    functionTable(compiler.functionTable),
+    structLayouts(compiler.structLayouts) {
+    bytecode = compiler.instructions;
+    callStack.reserve(1024);
+
+    heapRoots = ObjectHeap::addRoots([this] {
+        // Registers past the end of every frame window only hold what returned frames left behind
+        size_t liveEnd = 0;
+        for (const StackFrame& frame : callStack) {
+            liveEnd = std::max(liveEnd, frame.basePointer + functionTable->descriptors[frame.functionId].frameSize);
+        }
+        for (size_t i = 0; i < liveEnd; ++i) {
+            ObjectHeap::mark(registers[i]);
+        }
+        for (const auto& [name, value] : globals->values()) {
+            ObjectHeap::mark(value);
+        }
+        for (uint32_t i = 0; i < bytecode.constants.size(); ++i) {
+            ObjectHeap::mark(bytecode.constants[i]);
+        }
+    });
+}
+
+RegisterInterpreter::~RegisterInterpreter() {
+    ObjectHeap::removeRoots(heapRoots);
+}
+
+ExecutionResult RegisterInterpreter::execute() {
+    TIMED_FUNCTION();
+
+    ExecutionResult result = runMain();
+    if (!result.ok()) {
+        std::cerr << "Runtime error: " << result.error << std::endl;
+        return result;
+    }
+
+    std::cout << "Execution complete." << std::endl;
+    if (result.value.type != ValueType::None) {
+        std::cout << "Return value of main: " << result.value << std::endl;
+    } else {
+        std::cout << "No return value." << std::endl;
+    }
+    return result;
+}
+
+ExecutionResult RegisterInterpreter::runMain() {
+    ExecutionResult result;
+    uint32_t mainIndex;
+    if (!functionTable->lookup("main", mainIndex)) {
+        result.error.raise(VMStatus::NoMain, "Main function not found");
+        return result;
+    }
+
+    error = VMError();
+    size_t pc;
+    if (enterFrame(mainIndex, 0, 0, pc) && run(pc)) {
+        result.value = std::move(registers[0]);
+    } else {
+        result.error = std::move(error);
+        // A fault leaves the frames it stopped in behind
+        callStack.clear();
+    }
+    return result;
+}
+
+bool RegisterInterpreter::executeBinaryOp(ArithmeticOp op, RuntimeValue& dst, const RuntimeValue& left, const RuntimeValue& right) {
+    if (!Interpreter::checkOperation(error, left, op, right)) {
+        return false;
+    }
+
+    // `dst` may be one of the operands, each operator builds a new value before it's assigned
+    switch (op) {
+        case ArithmeticOp::ADD: dst = left + right; break;
+        case ArithmeticOp::SUB: dst = left - right; break;
+        case ArithmeticOp::MUL: dst = left * right; break;
+        case ArithmeticOp::DIV: dst = left / right; break;
+        case ArithmeticOp::MOD: dst = left % right; break;
+        case ArithmeticOp::EQ: dst = left == right; break;
+        case ArithmeticOp::NEQ: dst = left != right; break;
+        case ArithmeticOp::LT: dst = left < right; break;
+        case ArithmeticOp::LTE: dst = left <= right; break;
+        case ArithmeticOp::GT: dst = left > right; break;
+        case ArithmeticOp::GTE: dst = left >= right; break;
+    }
+    return true;
+}
+
+bool RegisterInterpreter::fieldIndex(const RuntimeValue& object, const InternedString& name, uint32_t& outIndex) {
+    if (object.type != ValueType::Struct) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected Struct, got {}", to_string(object.type)));
+    }
+    const StructLayout* layout = object.asStruct().layout;
+    if (!layout || !layout->fieldIndex(name, outIndex)) [[unlikely]] {
+        return error.raise(VMStatus::UnknownField, "Struct has no field named " + name.str());
+    }
+    return true;
+}
+
+#if INTERPRETER_INSTRUCTION_STATS
+#define VM_COUNT() ++executedInstructions
+#else
+#define VM_COUNT() (void)0
+#endif
+
+#if INTERPRETER_THREADED_DISPATCH
+#define VM_HANDLER(op) op_##op:
+#define VM_DISPATCH() \
+    VM_COUNT(); \
+    goto *threadedCode[pc]
+#else
+#define VM_HANDLER(op) case RegisterOpcode::op:
+#define VM_DISPATCH() \
+    VM_COUNT(); \
+    continue
+#endif
+
+#define VM_NEXT() \
+    ++pc; \
+    VM_DISPATCH()
+
+// Leaves the dispatch loop through its fault path when a helper has raised an error
+#define VM_CHECK(call) \
+    if (!(call)) [[unlikely]] { \
+        goto fault; \
+    }
+
+// Registers of the current frame
+#define R(x) frame[x]
+
+#define VM_BINARY_OP(op) \
+    VM_HANDLER(op) { \
+        const auto& instruction = bytecode[pc]; \
+        VM_CHECK(executeBinaryOp(ArithmeticOp::op, R(instruction.a), R(instruction.b), R(instruction.c))); \
+        VM_NEXT(); \
+    }
+
+bool RegisterInterpreter::run(size_t& pc) {
+    const size_t entryDepth = callStack.size();
+    // Only valid until the register file grows, which only happens when a call reserves its frame
+    RuntimeValue* frame = registers.data() + callStack.back().basePointer;
+    // Callee looked up by the call handlers
+    uint32_t functionIndex;
+
+#if INTERPRETER_THREADED_DISPATCH
+    static const void* const handlers[] = {
+#define REGISTER_OPCODE_LABEL(op) &&op_##op,
+        REGISTER_OPCODE_LIST(REGISTER_OPCODE_LABEL)
+#undef REGISTER_OPCODE_LABEL
+    };
+
+    if (threadedCode.size() != bytecode.size()) {
+        threadedCode.clear();
+        threadedCode.reserve(bytecode.size());
+        for (auto& instruction : bytecode) {
+            threadedCode.push_back(handlers[static_cast<size_t>(instruction.opcode)]);
+        }
+    }
+
+    VM_DISPATCH();
+#else
+    for (;;) {
+        switch (bytecode[pc].opcode) {
+#endif
+
+            VM_HANDLER(LOAD_CONST) {
+                const auto& instruction = bytecode[pc];
+                R(instruction.a) = bytecode.constants[instruction.b];
+                VM_NEXT();
+            }
+            VM_HANDLER(MOVE) {
+                const auto& instruction = bytecode[pc];
+                R(instruction.a) = R(instruction.b);
+                VM_NEXT();
+            }
+            VM_HANDLER(LOAD_GLOBAL) {
+                const auto& instruction = bytecode[pc];
+                const RuntimeValue* value = globals->resolve(bytecode.names[instruction.b]);
+                if (!value) [[unlikely]] {
+                    VM_CHECK(error.raise(VMStatus::UndefinedVariable, "Undefined variable: " + bytecode.names[instruction.b].str()));
+                }
+                R(instruction.a) = *value;
+                VM_NEXT();
+            }
+            VM_HANDLER(STORE_GLOBAL) {
+                const auto& instruction = bytecode[pc];
+                globals->define(bytecode.names[instruction.b], R(instruction.a));
+                VM_NEXT();
+            }
+
+            VM_BINARY_OP(ADD)
+            VM_BINARY_OP(SUB)
+            VM_BINARY_OP(MUL)
+            VM_BINARY_OP(DIV)
+            VM_BINARY_OP(MOD)
+            VM_BINARY_OP(EQ)
+            VM_BINARY_OP(NEQ)
+            VM_BINARY_OP(LT)
+            VM_BINARY_OP(LTE)
+            VM_BINARY_OP(GT)
+            VM_BINARY_OP(GTE)
+
+            VM_HANDLER(LOAD_FIELD) {
+                const auto& instruction = bytecode[pc];
+                uint32_t index;
+                VM_CHECK(fieldIndex(R(instruction.b), bytecode.names[instruction.c], index));
+                // Copy out first, `a` may be the register holding the struct
+                RuntimeValue field = R(instruction.b).asStruct().fields[index];
+                R(instruction.a) = std::move(field);
+                VM_NEXT();
+            }
+            VM_HANDLER(STORE_FIELD) {
+                const auto& instruction = bytecode[pc];
+                uint32_t index;
+                VM_CHECK(fieldIndex(R(instruction.a), bytecode.names[instruction.b], index));
+                // Struct typed fields only hold their declared layout
+                if (const StructLayout* fieldLayout = R(instruction.a).asStruct().layout->fieldLayouts[index]) {
+                    VM_CHECK(checkStruct(R(instruction.c), *fieldLayout));
+                }
+                R(instruction.a).mutableStruct().fields[index] = R(instruction.c);
+                VM_NEXT();
+            }
+            VM_HANDLER(NEW_STRUCT) {
+                const auto& instruction = bytecode[pc];
+                R(instruction.a) = (*structLayouts)[instruction.b].instantiate();
+                VM_NEXT();
+            }
+            VM_HANDLER(CHECK_TYPE) {
+                VM_CHECK(checkType(R(bytecode[pc].a), static_cast<ValueType>(bytecode[pc].b)));
+                VM_NEXT();
+            }
+            VM_HANDLER(CHECK_STRUCT) {
+                VM_CHECK(checkStruct(R(bytecode[pc].a), (*structLayouts)[bytecode[pc].b]));
+                VM_NEXT();
+            }
+            VM_HANDLER(JUMP) {
+                pc = bytecode[pc].target();
+                VM_DISPATCH();
+            }
+            VM_HANDLER(JUMP_IF_FALSE) {
+                const auto& instruction = bytecode[pc];
+                if (R(instruction.a).isTruthy()) {
+                    ++pc;
+                } else {
+                    pc = instruction.target();
+                }
+                VM_DISPATCH();
+            }
+            VM_HANDLER(CALL) {
+                const auto& instruction = bytecode[pc];
+                const size_t basePointer = callStack.back().basePointer + instruction.a;
+                VM_CHECK(enterFrame(instruction.b, basePointer, pc + 1, pc));
+                frame = registers.data() + basePointer;
+                VM_DISPATCH();
+            }
+            VM_HANDLER(CALL_NAMED) {
+                const auto& instruction = bytecode[pc];
+                if (!functionTable->lookup(bytecode.names[instruction.b], functionIndex)) [[unlikely]] {
+                    VM_CHECK(error.raise(VMStatus::UndefinedFunction, "Function not found: " + bytecode.names[instruction.b].str()));
+                }
+                VM_CHECK(checkArity(functionIndex, instruction.c));
+                const size_t basePointer = callStack.back().basePointer + instruction.a;
+                VM_CHECK(enterFrame(functionIndex, basePointer, pc + 1, pc));
+                frame = registers.data() + basePointer;
+                VM_DISPATCH();
+            }
+            VM_HANDLER(TAIL_CALL) {
+                functionIndex = bytecode[pc].b;
+            tailCall:
+                ObjectHeap::safepoint();
+                const FunctionDescriptor& func = functionTable->descriptors[functionIndex];
+                StackFrame& current = callStack.back();
+
+                // Slide the arguments down to the start of the window, then reset the callee's locals
+                std::move(frame + bytecode[pc].a, frame + bytecode[pc].a + func.arity, frame);
+                VM_CHECK(reserveFrame(current.basePointer + func.frameSize, functionIndex));
+                frame = registers.data() + current.basePointer;
+                std::fill(frame + func.arity, frame + func.frameSize, RuntimeValue());
+
+                current.functionId = functionIndex;
+                pc = func.address;
+                VM_DISPATCH();
+            }
+            VM_HANDLER(TAIL_CALL_NAMED) {
+                if (!functionTable->lookup(bytecode.names[bytecode[pc].b], functionIndex)) [[unlikely]] {
+                    VM_CHECK(error.raise(VMStatus::UndefinedFunction, "Function not found: " + bytecode.names[bytecode[pc].b].str()));
+                }
+                VM_CHECK(checkArity(functionIndex, bytecode[pc].c));
+                goto tailCall;
+            }
+            VM_HANDLER(RETURN) {
+                R(0) = std::move(R(bytecode[pc].a));
+                goto returnToCaller;
+            }
+            VM_HANDLER(RETURN_NONE) {
+                R(0) = RuntimeValue();
+                goto returnToCaller;
+            }
+
+        returnToCaller:
+            pc = callStack.back().returnAddress;
+            callStack.pop_back();
+            if (callStack.size() < entryDepth) {
+                return true;
+            }
+            frame = registers.data() + callStack.back().basePointer;
+            VM_DISPATCH();
+
+#if !INTERPRETER_THREADED_DISPATCH
+            default:
+                error.raise(VMStatus::InvalidOpcode, "Invalid opcode");
+                goto fault;
+#endif
+
+        fault:
+            locateFault(pc);
+            return false;
+#if !INTERPRETER_THREADED_DISPATCH
+        }
+    }
+#endif
+}
+
+#undef VM_BINARY_OP
+#undef VM_CHECK
+#undef R
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_HANDLER
+#undef VM_COUNT
+
+bool RegisterInterpreter::checkType(const RuntimeValue& value, ValueType expected) {
+    if (value.type != expected) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected {}, got {}", to_string(expected), to_string(value.type)));
+    }
+    return true;
+}
+
+bool RegisterInterpreter::checkStruct(const RuntimeValue& value, const StructLayout& expected) {
+    if (value.type != ValueType::Struct) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch, std::format("Type mismatch: expected {}, got {}", expected.name.str(), to_string(value.type)));
+    }
+    const StructLayout* layout = value.asStruct().layout;
+    if (layout != &expected) [[unlikely]] {
+        return error.raise(VMStatus::TypeMismatch,
+                           std::format("Type mismatch: expected {}, got {}", expected.name.str(), layout ? layout->name.str() : "Struct"));
+    }
+    return true;
+}
+
+bool RegisterInterpreter::checkArity(uint32_t functionIndex, uint16_t argumentCount) {
+    const uint16_t arity = functionTable->descriptors[functionIndex].arity;
+    if (arity != argumentCount) [[unlikely]] {
+        return error.raise(VMStatus::ArityMismatch, std::format("Function {} takes {} arguments, called with {}", functionTable->node(functionIndex)->name, arity, argumentCount));
+    }
+    return true;
+}
+
+bool RegisterInterpreter::enterFrame(uint32_t functionIndex, size_t basePointer, size_t returnAddress, size_t& outAddress) {
+    // Calls are the collector's safepoints, every live value is in a register or a global
+    ObjectHeap::safepoint();
+    const FunctionDescriptor& func = functionTable->descriptors[functionIndex];
+
+    if (!reserveFrame(basePointer + func.frameSize, functionIndex)) {
+        return false;
+    }
+    // Registers past the arguments still hold whatever a previous frame left there
+    std::fill(registers.begin() + static_cast<ptrdiff_t>(basePointer + func.arity),
+              registers.begin() + static_cast<ptrdiff_t>(basePointer + func.frameSize), RuntimeValue());
+
+    callStack.emplace_back(returnAddress, basePointer, functionIndex);
+    outAddress = func.address;
+    return true;
+}
+
+bool RegisterInterpreter::reserveFrame(size_t frameEnd, uint32_t functionIndex) {
+    if (frameEnd <= registers.size()) {
+        return true;
+    }
+
+    if (frameEnd > MaxRegisterFileSize) [[unlikely]] {
+        return error.raise(VMStatus::StackOverflow, "Stack overflow calling function: " + functionTable->node(functionIndex)->name);
+    }
+    registers.resize(std::min(std::max(registers.size() * 2, frameEnd), MaxRegisterFileSize));
+    return true;
+}
+
+void RegisterInterpreter::locateFault(size_t pc) {
+    error.opcode = to_string(bytecode[pc].opcode);
+    error.pc = static_cast<uint32_t>(pc);
+    if (!callStack.empty()) {
+        error.function = functionTable->node(callStack.back().functionId)->name;
+    }
+}
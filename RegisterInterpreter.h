@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Common.h"
+#include "Interpreter.h"
+#include "RegisterBytecode.h"
+#include "StackFrame.h"
+
+class RegisterCompiler;
+class FunctionTable;
+class StructLayoutTable;
+class SymbolTable;
+
+// Runs `RegisterCompiler` output. Frames are windows of one register file: a call's window
+// starts at the caller's argument block, so arguments become the callee's first registers
+// without being copied and the result is left in the first register of the window.
+class RegisterInterpreter
+{
+public:
+    // Number of registers (across all frames) the register file starts with
+    static constexpr size_t RegisterFileSize = 64 * 1024;
+    // Growth limit, calls beyond it fail with a stack overflow
+    static constexpr size_t MaxRegisterFileSize = 16 * 1024 * 1024;
+
+    Shared<SymbolTable> globals;
+
+    Shared<FunctionTable> functionTable;
+
+    Shared<StructLayoutTable> structLayouts;
+
+    RegisterInstructionSet bytecode;
+    std::vector<RuntimeValue> registers = std::vector<RuntimeValue>(RegisterFileSize);
+    std::vector<StackFrame> callStack;
+
+    // Dispatched instructions, only counted when built with INTERPRETER_INSTRUCTION_STATS
+    uint64_t executedInstructions = 0;
+
+    RegisterInterpreter(const RegisterCompiler& compiler);
+    ~RegisterInterpreter();
+
+    RegisterInterpreter(const RegisterInterpreter&) = delete;
+    RegisterInterpreter& operator=(const RegisterInterpreter&) = delete;
+
+    // Runs `main` and prints what it returned, or the error that stopped it
+    ExecutionResult execute();
+
+    // Calls `main` and returns its result
+    ExecutionResult runMain();
+
+    // Runs instructions from `pc` until the frame on top of `callStack` returns.
+    // False if a fault stopped it.
+    bool run(size_t& pc);
+
+private:
+    // Id of the registers, globals and constants as `ObjectHeap` roots
+    uint32_t heapRoots;
+
+    VMError error;
+
+    // Pushes a frame for `functionIndex` whose window starts at `basePointer` and sets `outAddress`
+    // to its entry
+    bool enterFrame(uint32_t functionIndex, size_t basePointer, size_t returnAddress, size_t& outAddress);
+
+    // Fails unless `functionIndex` takes the `argumentCount` arguments a late-bound call passes
+    bool checkArity(uint32_t functionIndex, uint16_t argumentCount);
+
+    // Makes sure the register file can hold a frame ending at `frameEnd`
+    bool reserveFrame(size_t frameEnd, uint32_t functionIndex);
+
+    // Fails unless `value` has the type the compiler relies on
+    bool checkType(const RuntimeValue& value, ValueType expected);
+
+    // Fails unless `value` is a struct with `expected` layout
+    bool checkStruct(const RuntimeValue& value, const StructLayout& expected);
+
+    bool executeBinaryOp(ArithmeticOp op, RuntimeValue& dst, const RuntimeValue& left, const RuntimeValue& right);
+
+    // Index of field `name` in struct `object`, false if it isn't a struct or has no such field
+    bool fieldIndex(const RuntimeValue& object, const InternedString& name, uint32_t& outIndex);
+
+    // Fills in where the fault raised in `error` happened, the instruction at `pc`
+    void locateFault(size_t pc);
+
+#if INTERPRETER_THREADED_DISPATCH
+    std::vector<const void*> threadedCode;
+#endif
+};
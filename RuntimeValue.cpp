@@ -3,34 +3,80 @@
 #include <algorithm>
 #include <iostream>
 
-RuntimeValue::RuntimeValue(): type(ValueType::None), data() {}
+RuntimeValue::RuntimeValue(): type(ValueType::None) {}
 
-RuntimeValue::RuntimeValue(std::string typeName, std::any inData) {
+RuntimeValue::RuntimeValue(std::string typeName, std::any inData): type(ValueType::None) {
     std::ranges::transform(typeName, typeName.begin(), ::tolower);
 
     if (typeName == "string") {
-        type = ValueType::String;
-        data = inData.has_value() ? std::any_cast<std::string>(inData) : std::string();
+        *this = RuntimeValue(inData.has_value() ? std::any_cast<std::string>(inData) : std::string());
     } else if (typeName == "int") {
-        type = ValueType::Int;
-        data = inData.has_value() ? std::any_cast<int>(inData) : 0;
+        *this = RuntimeValue(inData.has_value() ? std::any_cast<int>(inData) : 0);
     } else if (typeName == "float") {
-        type = ValueType::Float;
-        data = inData.has_value() ? std::any_cast<float>(inData) : 0.0f;
+        *this = RuntimeValue(inData.has_value() ? std::any_cast<float>(inData) : 0.0f);
     } else if (typeName == "bool") {
-        type = ValueType::Bool;
-        data = inData.has_value() ? std::any_cast<bool>(inData) : false;
+        *this = RuntimeValue(inData.has_value() ? std::any_cast<bool>(inData) : false);
     } else if (typeName == "struct") {
-        type = ValueType::Struct;
-        data = inData.has_value() ? std::any_cast<RuntimeStruct>(inData) : RuntimeStruct();
+        *this = RuntimeValue(inData.has_value() ? std::any_cast<RuntimeStruct>(inData) : RuntimeStruct());
     } else {
         throw std::runtime_error("Invalid type name: " + typeName);
     }
 }
 
+RuntimeValue::RuntimeValue(std::string value): type(ValueType::String) {
+    setObject(StringHeap::intern(value));
+}
+
+RuntimeValue::RuntimeValue(const InternedString& value): type(ValueType::String) {
+    StringHeap::retain(value.get());
+    setObject(value.get());
+}
+
+static StructObject* newStructObject(RuntimeStruct fields) {
+    auto* object = new (ObjectHeap::allocate(sizeof(StructObject))) StructObject(std::move(fields));
+    ObjectHeap::adopt(object);
+    return object;
+}
+
+RuntimeValue::RuntimeValue(RuntimeStruct value): type(ValueType::Struct) {
+    setObject(newStructObject(std::move(value)));
+}
+
+void RuntimeValue::copyObject() {
+    if (type == ValueType::String) {
+        StringHeap::retain(object<StringObject>());
+    } else {
+        object<StructObject>()->shared = true;
+    }
+}
+
+void RuntimeValue::releaseObject() {
+    if (type == ValueType::String) {
+        StringHeap::release(object<StringObject>());
+    }
+    // Struct objects are freed by the collector once nothing reaches them
+}
+
+void RuntimeValue::unshareStruct() {
+    // Field values are copied, nested structs stay shared until they're written to themselves.
+    // The old object is left to the collector, other values may still use it.
+    setObject(newStructObject(object<StructObject>()->fields));
+}
+
 template <typename T>
 bool RuntimeValue::is() const { return type == getValueType<T>(); }
 
+bool RuntimeValue::isTruthy() const {
+    switch (type) {
+        case ValueType::Bool: return asBool();
+        case ValueType::Int: return asInt() != 0;
+        case ValueType::Float: return asFloat() != 0.0f;
+        case ValueType::String: return !asString().empty();
+        case ValueType::Struct: return true;
+        default: return false;
+    }
+}
+
 template <typename T>
 bool RuntimeValue::BothAre(const RuntimeValue& lhs, const RuntimeValue& rhs) { return lhs.is<T>() && rhs.is<T>(); }
 
@@ -47,6 +93,34 @@ bool RuntimeValue::BothAreEither(const RuntimeValue& lhs, const RuntimeValue& rh
     return false;
 }
 
+namespace
+{
+    // `std::plus<>` and friends, except that ints wrap instead of overflowing
+    struct WrappingPlus
+    {
+        int operator()(int lhs, int rhs) const { return wrappingAdd(lhs, rhs); }
+        float operator()(float lhs, float rhs) const { return lhs + rhs; }
+    };
+
+    struct WrappingMinus
+    {
+        int operator()(int lhs, int rhs) const { return wrappingSub(lhs, rhs); }
+        float operator()(float lhs, float rhs) const { return lhs - rhs; }
+    };
+
+    struct WrappingMultiplies
+    {
+        int operator()(int lhs, int rhs) const { return wrappingMul(lhs, rhs); }
+        float operator()(float lhs, float rhs) const { return lhs * rhs; }
+    };
+
+    struct WrappingDivides
+    {
+        int operator()(int lhs, int rhs) const { return wrappingDiv(lhs, rhs); }
+        float operator()(float lhs, float rhs) const { return lhs / rhs; }
+    };
+}
+
 template <typename Op>
 RuntimeValue RuntimeValue::performOperation(const RuntimeValue& lhs, const RuntimeValue& rhs, Op operation) {
     if (BothAre<int>(lhs, rhs)) {
@@ -88,9 +162,9 @@ RuntimeValue RuntimeValue::performOperation(const RuntimeValue& lhs, const Runti
     // Handle type promotion so it's less annoying to work with
     if (BothAreEither<int, float>(lhs, rhs)) {
         if (lhs.is<int>() && rhs.is<float>())
-            return RuntimeValue(operation(lhs.get<int>(), static_cast<int>(rhs.get<float>())));
+            return RuntimeValue(operation(lhs.get<int>(), truncateToInt(rhs.get<float>())));
         if (lhs.is<float>() && rhs.is<int>())
-            return RuntimeValue(operation(static_cast<int>(lhs.get<float>()), rhs.get<int>()));
+            return RuntimeValue(operation(truncateToInt(lhs.get<float>()), rhs.get<int>()));
     }
 
     // Allow conversion of bool <-> int
@@ -105,19 +179,30 @@ RuntimeValue RuntimeValue::performOperation(const RuntimeValue& lhs, const Runti
     throw std::runtime_error("Unsupported type combination for operation");
 }
 
-RuntimeValue operator+(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, std::plus<>()); }
+RuntimeValue operator+(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, WrappingPlus()); }
 
-RuntimeValue operator-(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, std::minus<>()); }
+RuntimeValue operator-(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, WrappingMinus()); }
 
-RuntimeValue operator*(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, std::multiplies<>()); }
+RuntimeValue operator*(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, WrappingMultiplies()); }
 
-RuntimeValue operator/(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, std::divides<>()); }
+RuntimeValue operator/(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, WrappingDivides()); }
 
 RuntimeValue operator%(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performModulusOperation(lhs, rhs); }
 
-RuntimeValue operator==(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, std::equal_to<>()); }
+// Equal strings are always the same interned object
+RuntimeValue operator==(const RuntimeValue& lhs, const RuntimeValue& rhs) {
+    if (RuntimeValue::BothAre<std::string>(lhs, rhs)) {
+        return lhs.object<StringObject>() == rhs.object<StringObject>();
+    }
+    return RuntimeValue::performOperation(lhs, rhs, std::equal_to<>());
+}
 
-RuntimeValue operator!=(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, std::not_equal_to<>()); }
+RuntimeValue operator!=(const RuntimeValue& lhs, const RuntimeValue& rhs) {
+    if (RuntimeValue::BothAre<std::string>(lhs, rhs)) {
+        return lhs.object<StringObject>() != rhs.object<StringObject>();
+    }
+    return RuntimeValue::performOperation(lhs, rhs, std::not_equal_to<>());
+}
 
 RuntimeValue operator<(const RuntimeValue& lhs, const RuntimeValue& rhs) { return RuntimeValue::performOperation(lhs, rhs, std::less<>()); }
 
@@ -151,9 +236,34 @@ bool RuntimeValue::CanPerformOperation(const RuntimeValue& lhs, ArithmeticOp op,
     }
 }
 
+ValueType RuntimeValue::ResultType(ValueType lhs, ArithmeticOp op, ValueType rhs) {
+    const bool lhsNumeric = lhs == ValueType::Int || lhs == ValueType::Float;
+    const bool rhsNumeric = rhs == ValueType::Int || rhs == ValueType::Float;
+    if (lhs == ValueType::String && rhs == ValueType::String && (op == ArithmeticOp::EQ || op == ArithmeticOp::NEQ)) {
+        return ValueType::Bool;
+    }
+    // Other string operations pass `CanPerformOperation` but `performOperation` has no string support
+    if (!lhsNumeric || !rhsNumeric) {
+        return ValueType::None;
+    }
+
+    switch (op) {
+        case ArithmeticOp::MOD:
+            return lhs == ValueType::Int && rhs == ValueType::Int ? ValueType::Int : ValueType::None;
+        case ArithmeticOp::ADD:
+        case ArithmeticOp::SUB:
+        case ArithmeticOp::MUL:
+        case ArithmeticOp::DIV:
+            // Mixed int/float operations are done on ints
+            return lhs == ValueType::Float && rhs == ValueType::Float ? ValueType::Float : ValueType::Int;
+        default:
+            return ValueType::Bool;
+    }
+}
+
 RuntimeValue RuntimeValue::performModulusOperation(const RuntimeValue& lhs, const RuntimeValue& rhs) {
     if (BothAre<int>(lhs, rhs)) {
-        return RuntimeValue(std::modulus<>()(lhs.get<int>(), rhs.get<int>()));
+        return RuntimeValue(wrappingMod(lhs.get<int>(), rhs.get<int>()));
     }
     throw std::runtime_error("Modulus operation is only valid for integers");
 }
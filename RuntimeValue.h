@@ -7,19 +7,10 @@
 #include <iostream>
 
 
-#define DEFINE_GETTER(type, isConst) \
-template <typename T> \
-type get() isConst { \
-if (is<T>()) return std::get<T>(data); \
-\
-throw std::runtime_error("Type mismatch"); \
-}
-
-#define DEFINE_TYPE(defType, name, valueType) \
-RuntimeValue(defType value) : type(valueType), data(value) {} \
-defType name() const { return std::get<defType>(data); } \
-defType& name() { return std::get<defType>(data); } \
-/*operator defType& () { return name(); }*/ 
+#define DEFINE_TYPE(defType, name, member, valueType) \
+RuntimeValue(defType value) : type(valueType) { payload.member = value; } \
+defType name() const { expectType(valueType); return payload.member; } \
+defType& name() { expectType(valueType); return payload.member; }
 
 enum class ArithmeticOp
 {
@@ -36,7 +27,69 @@ enum class ArithmeticOp
     GTE,
 };
 
-enum class ValueType
+// Operator symbol, for error messages
+inline const char* to_string(ArithmeticOp e) {
+    switch (e) {
+        case ArithmeticOp::ADD: return "+";
+        case ArithmeticOp::SUB: return "-";
+        case ArithmeticOp::MUL: return "*";
+        case ArithmeticOp::DIV: return "/";
+        case ArithmeticOp::MOD: return "%";
+        case ArithmeticOp::EQ: return "==";
+        case ArithmeticOp::NEQ: return "!=";
+        case ArithmeticOp::LT: return "<";
+        case ArithmeticOp::LTE: return "<=";
+        case ArithmeticOp::GT: return ">";
+        case ArithmeticOp::GTE: return ">=";
+        default: return "unknown";
+    }
+}
+
+// Script ints are 32-bit two's complement and arithmetic on them never traps: +, - and *
+// wrap around, and INT_MIN / -1 wraps to INT_MIN with a remainder of 0. Only a zero divisor is
+// an error, callers check for it first. Every VM, the JIT and translated code use these.
+inline int wrappingAdd(int lhs, int rhs) { return static_cast<int>(static_cast<uint32_t>(lhs) + static_cast<uint32_t>(rhs)); }
+inline int wrappingSub(int lhs, int rhs) { return static_cast<int>(static_cast<uint32_t>(lhs) - static_cast<uint32_t>(rhs)); }
+inline int wrappingMul(int lhs, int rhs) { return static_cast<int>(static_cast<uint32_t>(lhs) * static_cast<uint32_t>(rhs)); }
+inline int wrappingDiv(int lhs, int rhs) { return rhs == -1 ? wrappingSub(0, lhs) : lhs / rhs; }
+inline int wrappingMod(int lhs, int rhs) { return rhs == -1 ? 0 : lhs % rhs; }
+
+// Float operand of a mixed int/float operation as an int: truncated, saturated to the int
+// range, NaN is 0
+inline int truncateToInt(float value) {
+    if (value != value) {
+        return 0;
+    }
+    if (value >= 2147483648.0f) {
+        return INT32_MAX;
+    }
+    if (value <= -2147483648.0f) {
+        return INT32_MIN;
+    }
+    return static_cast<int>(value);
+}
+
+// Operation a binary expression's operator token performs, false for anything else
+inline bool toArithmeticOp(TokenType token, ArithmeticOp& outOp) {
+    switch (token) {
+        case TokenType::Plus:
+        case TokenType::PlusPlus: outOp = ArithmeticOp::ADD; return true;
+        case TokenType::Minus:
+        case TokenType::MinusMinus: outOp = ArithmeticOp::SUB; return true;
+        case TokenType::Star: outOp = ArithmeticOp::MUL; return true;
+        case TokenType::Slash: outOp = ArithmeticOp::DIV; return true;
+        case TokenType::Percent: outOp = ArithmeticOp::MOD; return true;
+        case TokenType::EqualsEquals: outOp = ArithmeticOp::EQ; return true;
+        case TokenType::NotEquals: outOp = ArithmeticOp::NEQ; return true;
+        case TokenType::LessThan: outOp = ArithmeticOp::LT; return true;
+        case TokenType::LessThanEquals: outOp = ArithmeticOp::LTE; return true;
+        case TokenType::GreaterThan: outOp = ArithmeticOp::GT; return true;
+        case TokenType::GreaterThanEquals: outOp = ArithmeticOp::GTE; return true;
+        default: return false;
+    }
+}
+
+enum class ValueType : uint8_t
 {
     None,
     Int,
@@ -60,6 +113,15 @@ inline const char* to_string(ValueType e) {
     }
 }
 
+// Type named by a declaration (`int a`, parameter types...), None for anything that isn't a primitive
+inline ValueType valueTypeFromName(const std::string& typeName) {
+    if (typeName == "int") return ValueType::Int;
+    if (typeName == "float") return ValueType::Float;
+    if (typeName == "bool") return ValueType::Bool;
+    if (typeName == "string") return ValueType::String;
+    return ValueType::None;
+}
+
 // Forward declaration of template function getValueType
 template <typename T>
 constexpr ValueType getValueType() { return ValueType::None; }
@@ -78,58 +140,111 @@ GET_VALUE_TYPE(RuntimeStruct, ValueType::Struct)
 
 #undef GET_VALUE_TYPE
 
+// Heap part of a struct value, owned by `ObjectHeap`. Copies of a struct share one object, a
+// copy that's written to while shared gets its own first (copy-on-write), so structs still
+// behave as values.
+struct StructObject : HeapObject
+{
+    RuntimeStruct fields;
+
+    explicit StructObject(RuntimeStruct fields) : fields(std::move(fields)) {}
+};
+
+// A value in 8 bytes: ints, floats and bools are stored inline, strings and structs as a
+// pointer to their heap object (strings are `StringHeap` objects). The pointer is split over `payload` and `objectHigh`,
+// which holds bits 32-47; user space addresses on x86-64 and AArch64 fit in 48 bits.
 class RuntimeValue
 {
 private:
-    using ValueData = std::variant<
-        // nullptr type
-        std::monostate,
-        int,
-        float,
-        std::string,
-        bool,
-        void*,
-        RuntimeStruct
-        //
-    >;
+    union Payload
+    {
+        int intValue;
+        float floatValue;
+        bool boolValue;
+        // Low half of a heap object's address
+        uint32_t objectLow;
+    };
+
+    Payload payload = {.objectLow = 0};
+    uint16_t objectHigh = 0;
 
 public:
     ValueType type;
-    ValueData data;
 
     RuntimeValue();
     RuntimeValue(std::string typeName, std::any inData);
 
-    RuntimeValue(const RuntimeValue& other)        : type(other.type),          data(other.data) {}
+    RuntimeValue(const RuntimeValue& other) : payload(other.payload), objectHigh(other.objectHigh), type(other.type) {
+        if (isHeapObject()) {
+            copyObject();
+        }
+    }
 
-    RuntimeValue(RuntimeValue&& other) noexcept        : type(other.type),          data(std::move(other.data)) {}
+    RuntimeValue(RuntimeValue&& other) noexcept : payload(other.payload), objectHigh(other.objectHigh), type(other.type) {
+        other.type = ValueType::None;
+    }
+
+    ~RuntimeValue() {
+        if (isHeapObject()) {
+            releaseObject();
+        }
+    }
 
     RuntimeValue& operator=(const RuntimeValue& other) {
         if (this == &other)
             return *this;
-        type = other.type;
-        data = other.data;
-        return *this;
+        return *this = RuntimeValue(other);
     }
 
     RuntimeValue& operator=(RuntimeValue&& other) noexcept {
         if (this == &other)
             return *this;
+        if (isHeapObject()) {
+            releaseObject();
+        }
+        payload = other.payload;
+        objectHigh = other.objectHigh;
         type = other.type;
-        data = std::move(other.data);
+        other.type = ValueType::None;
         return *this;
     }
 
-    DEFINE_TYPE(std::monostate, asNone, ValueType::None)
-    DEFINE_TYPE(int, asInt, ValueType::Int)
-    DEFINE_TYPE(float, asFloat, ValueType::Float)
-    DEFINE_TYPE(std::string, asString, ValueType::String)
-    DEFINE_TYPE(bool, asBool, ValueType::Bool)
-    // DEFINE_TYPE(void*, asPointer, ValueType::Pointer)
-    DEFINE_TYPE(RuntimeStruct, asStruct, ValueType::Struct)
+    DEFINE_TYPE(int, asInt, intValue, ValueType::Int)
+    DEFINE_TYPE(float, asFloat, floatValue, ValueType::Float)
+    DEFINE_TYPE(bool, asBool, boolValue, ValueType::Bool)
+    RuntimeValue(std::string value);
+    RuntimeValue(const InternedString& value);
+    const std::string& asString() const {
+        expectType(ValueType::String);
+        return object<StringObject>()->value;
+    }
+    RuntimeValue(RuntimeStruct value);
+    const RuntimeStruct& asStruct() const {
+        expectType(ValueType::Struct);
+        return object<StructObject>()->fields;
+    }
+    // Struct for writing, unshared from other copies of this value first
+    RuntimeStruct& mutableStruct() {
+        expectType(ValueType::Struct);
+        if (object<StructObject>()->shared) {
+            unshareStruct();
+        }
+        ObjectHeap::writeBarrier(object<StructObject>());
+        return object<StructObject>()->fields;
+    }
+
+    template <typename T>
+    T get() const {
+        if constexpr (std::is_same_v<T, std::string>) return asString();
+        else if constexpr (std::is_same_v<T, int>) return asInt();
+        else if constexpr (std::is_same_v<T, float>) return asFloat();
+        else if constexpr (std::is_same_v<T, bool>) return asBool();
+        else return asStruct();
+    }
 
-    DEFINE_GETTER(T,)
-    DEFINE_GETTER(T, const)
+    // Access without a type check, only for values the compiler has proven to be of that type
+    int& uncheckedInt() { return payload.intValue; }
+    float& uncheckedFloat() { return payload.floatValue; }
 
 #pragma region "Type Tests"
 
@@ -139,6 +254,9 @@ public:
     template <typename T>
     [[nodiscard]] bool is() const;
 
+    // Whether the value counts as true for a conditional jump
+    [[nodiscard]] bool isTruthy() const;
+
     template <typename T>
     static bool BothAre(const RuntimeValue& lhs, const RuntimeValue& rhs);
 
@@ -169,15 +287,48 @@ public:
 
     static bool CanPerformOperation(const RuntimeValue& lhs, ArithmeticOp op, const RuntimeValue& rhs);
 
+    // Type of `lhs op rhs` for operands of these types, None unless the operation always succeeds
+    static ValueType ResultType(ValueType lhs, ArithmeticOp op, ValueType rhs);
+
 #pragma endregion
 
     void print(std::ostream& os) const;
 
 private:
+    friend class ObjectHeap;
+
+    [[nodiscard]] bool isHeapObject() const { return type == ValueType::String || type == ValueType::Struct; }
+
+    void expectType(ValueType expected) const {
+        if (type != expected) [[unlikely]] {
+            throw std::runtime_error("Type mismatch");
+        }
+    }
+
+    template <typename T>
+    T* object() const {
+        return reinterpret_cast<T*>(static_cast<uintptr_t>(objectHigh) << 32 | payload.objectLow);
+    }
+
+    void setObject(const void* object) {
+        const auto address = reinterpret_cast<uintptr_t>(object);
+        payload.objectLow = static_cast<uint32_t>(address);
+        objectHigh = static_cast<uint16_t>(static_cast<uint64_t>(address) >> 32);
+    }
+
+    // Gives a copy its share of the heap object: a string reference, or marks a struct as shared
+    void copyObject();
+    void releaseObject();
+
+    // Replaces the shared struct object with a private copy
+    void unshareStruct();
+
     static RuntimeValue performModulusOperation(const RuntimeValue& lhs, const RuntimeValue& rhs);
 
     template <typename Op>
     static RuntimeValue performOperation(const RuntimeValue& lhs, const RuntimeValue& rhs, Op operation);
 };
 
+static_assert(sizeof(RuntimeValue) == 8, "RuntimeValue should stay 8 bytes");
+
 std::ostream& operator<<(std::ostream& os, const RuntimeValue& value);
@@ -1,12 +1,13 @@
 #include "RuntimeValue_Struct.h"
 #include "RuntimeValue.h"
+#include "StructLayout.h"
 #include <iostream>
 
 
 void RuntimeStruct::print(std::ostream& os) const {
     os << "RuntimeStruct: {";
-    for (auto& kv : *this) {
-        os << kv.first << ": " << kv.second << ", ";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        os << layout->fieldNames[i] << ": " << fields[i] << ", ";
     }
     os << "}";
 }
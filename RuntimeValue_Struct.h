@@ -1,12 +1,23 @@
 #pragma once
 #include <string>
-#include <unordered_map>
+#include <vector>
+
+#include "ObjectHeap.h"
+#include "StringHeap.h"
 
 class RuntimeValue;
+class StructLayout;
+
+// Field storage of struct objects, allocated from the collected heap's size classes
+using StructFields = std::vector<RuntimeValue, HeapAllocator<RuntimeValue>>;
 
-class RuntimeStruct : public std::unordered_map<std::string, RuntimeValue>
+// A struct instance: one value per field, in the order given by its layout
+class RuntimeStruct
 {
 public:
+    const StructLayout* layout = nullptr;
+    StructFields fields;
+
     void print(std::ostream& os) const;
 };
 
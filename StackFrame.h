@@ -2,17 +2,16 @@
 
 #include "Common.h"
 
-class SymbolTable;
-
+// Call frame header. The frame's parameters and locals aren't stored here, they're
+// the window `[basePointer, basePointer + frameSize)` of the interpreter's value stack,
+// with the caller's arguments left in place as the first slots.
 class StackFrame
 {
 public:
-    // Local variables
-    Shared<SymbolTable> locals = nullptr;
     // Address to return to after function call
     size_t returnAddress = 0;
-
-    StackFrame();
-
-    StackFrame(size_t returnAddress);
+    // Index of the frame's first slot on the value stack
+    size_t basePointer = 0;
+    // Index of the called function in `FunctionTable::descriptors`
+    uint32_t functionId = 0;
 };
@@ -0,0 +1,31 @@
+#include "StringHeap.h"
+
+// Keyed by a view of the object's own characters. Never destroyed, values in other
+// static objects may still release their strings during exit.
+static std::unordered_map<std::string_view, StringObject*>& strings() {
+    static auto* table = new std::unordered_map<std::string_view, StringObject*>();
+    return *table;
+}
+
+StringObject* StringHeap::intern(std::string_view value) {
+    auto& table = strings();
+    if (const auto it = table.find(value); it != table.end()) {
+        retain(it->second);
+        return it->second;
+    }
+
+    auto* string = new StringObject{.hash = std::hash<std::string_view>()(value), .value = std::string(value)};
+    table.emplace(string->value, string);
+    return string;
+}
+
+void StringHeap::release(StringObject* string) {
+    if (--string->refCount == 0) {
+        strings().erase(string->value);
+        delete string;
+    }
+}
+
+size_t StringHeap::size() {
+    return strings().size();
+}
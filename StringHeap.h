@@ -0,0 +1,72 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// An immutable string, shared by reference count. Every live string is interned, so two
+// objects never hold the same characters: string equality is a pointer compare.
+struct StringObject
+{
+    uint32_t refCount = 1;
+    // Cached, so maps keyed by strings never rehash the characters
+    const size_t hash;
+    const std::string value;
+};
+
+// Owner of all `StringObject`s: identifiers, literals and any string a script creates
+class StringHeap
+{
+public:
+    // Returns the object holding `value` with a new reference to it, creating it if needed
+    static StringObject* intern(std::string_view value);
+
+    static void retain(StringObject* string) { ++string->refCount; }
+
+    // Drops a reference, the object is freed and forgotten with the last one
+    static void release(StringObject* string);
+
+    // Number of live strings
+    static size_t size();
+};
+
+// Owning handle to an interned string, e.g. a field or variable name.
+// Hashing uses the cached hash and equality the object's address.
+class InternedString
+{
+    StringObject* object;
+
+public:
+    InternedString(std::string_view value) : object(StringHeap::intern(value)) {}
+    InternedString(const std::string& value) : object(StringHeap::intern(value)) {}
+    InternedString(const char* value) : object(StringHeap::intern(value)) {}
+
+    InternedString(const InternedString& other) : object(other.object) { StringHeap::retain(object); }
+
+    InternedString& operator=(const InternedString& other) {
+        StringHeap::retain(other.object);
+        StringHeap::release(object);
+        object = other.object;
+        return *this;
+    }
+
+    ~InternedString() { StringHeap::release(object); }
+
+    [[nodiscard]] const std::string& str() const { return object->value; }
+    operator const std::string&() const { return object->value; }
+
+    [[nodiscard]] size_t hash() const { return object->hash; }
+    [[nodiscard]] StringObject* get() const { return object; }
+
+    bool operator==(const InternedString& other) const { return object == other.object; }
+
+    struct Hash
+    {
+        size_t operator()(const InternedString& string) const { return string.hash(); }
+    };
+};
+
+inline std::ostream& operator<<(std::ostream& os, const InternedString& string) {
+    return os << string.str();
+}
@@ -0,0 +1,121 @@
+#include "StructLayout.h"
+
+#include <algorithm>
+
+StructLayout::StructLayout(const StructNode& node): name(node.name) {
+    for (const auto& fieldName : node.fieldOrder) {
+        addField(fieldName, node.fields.at(fieldName)->type->typeName);
+    }
+}
+
+StructLayout::StructLayout(const std::string& name, const std::vector<std::string>& fieldNames, const std::vector<std::string>& fieldTypes): name(name) {
+    for (size_t i = 0; i < fieldNames.size(); ++i) {
+        addField(fieldNames[i], fieldTypes[i]);
+    }
+}
+
+void StructLayout::addField(const std::string& fieldName, const std::string& typeName) {
+    indices.emplace(fieldName, static_cast<uint32_t>(fieldNames.size()));
+    fieldNames.emplace_back(fieldName);
+    fieldTypes.push_back(typeName);
+    fieldLayouts.push_back(nullptr);
+}
+
+bool StructLayout::fieldIndex(const InternedString& fieldName, uint32_t& outIndex) const {
+    const auto it = indices.find(fieldName);
+    if (it == indices.end())
+        return false;
+
+    outIndex = it->second;
+    return true;
+}
+
+RuntimeValue StructLayout::instantiate() const {
+    return RuntimeValue(RuntimeStruct{this, defaults});
+}
+
+StructLayoutTable::StructLayoutTable() {
+    heapRoots = ObjectHeap::addRoots([this] {
+        for (const auto& layout : layouts) {
+            for (const auto& value : layout->defaults) {
+                ObjectHeap::mark(value);
+            }
+        }
+    });
+}
+
+StructLayoutTable::~StructLayoutTable() {
+    ObjectHeap::removeRoots(heapRoots);
+}
+
+void StructLayoutTable::define(const Shared<ProgramNode>& program) {
+    std::vector<Shared<StructLayout>> newLayouts;
+    for (auto& stmt : program->statements) {
+        if (const auto n = std::dynamic_pointer_cast<StructNode>(stmt)) {
+            newLayouts.push_back(std::make_shared<StructLayout>(*n));
+        }
+    }
+    define(newLayouts);
+}
+
+void StructLayoutTable::define(const std::vector<Shared<StructLayout>>& newLayouts) {
+    const size_t first = layouts.size();
+    for (const auto& layout : newLayouts) {
+        // A redefinition replaces the earlier layout, same as functions
+        const auto [it, inserted] = indices.try_emplace(layout->name, static_cast<uint32_t>(layouts.size()));
+        if (inserted) {
+            layouts.push_back(layout);
+        } else {
+            layouts[it->second] = layout;
+        }
+    }
+
+    for (size_t i = first; i < layouts.size(); ++i) {
+        StructLayout& layout = *layouts[i];
+        for (size_t field = 0; field < layout.size(); ++field) {
+            layout.fieldLayouts[field] = find(layout.fieldTypes[field]);
+        }
+    }
+
+    std::vector<const StructLayout*> building;
+    for (size_t i = first; i < layouts.size(); ++i) {
+        buildDefaults(*layouts[i], building);
+    }
+}
+
+bool StructLayoutTable::lookup(const std::string& structName, uint32_t& outIndex) const {
+    const auto it = indices.find(structName);
+    if (it == indices.end())
+        return false;
+
+    outIndex = it->second;
+    return true;
+}
+
+const StructLayout* StructLayoutTable::find(const std::string& typeName) const {
+    uint32_t index;
+    return lookup(typeName, index) ? layouts[index].get() : nullptr;
+}
+
+void StructLayoutTable::buildDefaults(StructLayout& layout, std::vector<const StructLayout*>& building) {
+    if (layout.defaults.size() == layout.size()) {
+        return;
+    }
+    if (std::ranges::find(building, &layout) != building.end()) {
+        throw std::runtime_error("Struct contains itself: " + layout.name.str());
+    }
+
+    building.push_back(&layout);
+    layout.defaults.clear();
+    for (size_t field = 0; field < layout.size(); ++field) {
+        if (const StructLayout* fieldLayout = layout.fieldLayouts[field]) {
+            buildDefaults(*layouts[indices.at(fieldLayout->name)], building);
+            layout.defaults.push_back(fieldLayout->instantiate());
+        } else if (valueTypeFromName(layout.fieldTypes[field]) != ValueType::None) {
+            layout.defaults.emplace_back(layout.fieldTypes[field], std::any());
+        } else {
+            layout.defaults.emplace_back();
+        }
+    }
+    building.pop_back();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Ast.h"
+#include "Common.h"
+#include "RuntimeValue.h"
+
+// Field order of a struct type, built from its `StructNode`. Instances store their fields
+// in this order, so a field whose layout is known at compile time is just an array index.
+class StructLayout
+{
+    std::unordered_map<InternedString, uint32_t, InternedString::Hash> indices;
+
+public:
+    InternedString name;
+    std::vector<InternedString> fieldNames;
+    // Declared type name of each field
+    std::vector<std::string> fieldTypes;
+    // Layout of each struct typed field, null for the others
+    std::vector<const StructLayout*> fieldLayouts;
+    // Field values of a new instance: the declared type's default, nested structs are instantiated too
+    StructFields defaults;
+
+    explicit StructLayout(const StructNode& node);
+    // Layout of a struct that isn't in an AST, e.g. one from translated C++ (`CppTranslator`)
+    StructLayout(const std::string& name, const std::vector<std::string>& fieldNames, const std::vector<std::string>& fieldTypes);
+
+    bool fieldIndex(const InternedString& fieldName, uint32_t& outIndex) const;
+
+    [[nodiscard]] size_t size() const { return fieldNames.size(); }
+
+    // New instance with every field set to its default
+    [[nodiscard]] RuntimeValue instantiate() const;
+
+private:
+    void addField(const std::string& fieldName, const std::string& typeName);
+};
+
+class StructLayoutTable
+{
+    std::unordered_map<std::string, uint32_t> indices = {};
+    // Defaults hold nested struct objects, they're roots for the collector
+    uint32_t heapRoots;
+
+public:
+    StructLayoutTable();
+    ~StructLayoutTable();
+
+    StructLayoutTable(const StructLayoutTable&) = delete;
+    StructLayoutTable& operator=(const StructLayoutTable&) = delete;
+
+    // Indexed by the operand of NEW_STRUCT. Layouts are shared so struct values can point at them.
+    std::vector<Shared<StructLayout>> layouts = {};
+
+    // Adds a layout for every struct in `program` and links struct typed fields to their layouts
+    void define(const Shared<ProgramNode>& program);
+
+    // Adds `newLayouts` in order, replacing earlier ones of the same name, and links them
+    void define(const std::vector<Shared<StructLayout>>& newLayouts);
+
+    bool lookup(const std::string& structName, uint32_t& outIndex) const;
+
+    // Layout named `typeName`, null for primitive or unknown types
+    [[nodiscard]] const StructLayout* find(const std::string& typeName) const;
+
+    const StructLayout& operator[](uint32_t index) const { return *layouts[index]; }
+
+private:
+    // Fills in `layout.defaults`, nested layouts first
+    void buildDefaults(StructLayout& layout, std::vector<const StructLayout*>& building);
+};
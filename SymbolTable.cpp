@@ -3,26 +3,31 @@
 #include "Ast.h"
 #include "RuntimeValue.h"
 
-SymbolTable::SymbolTable(Shared<SymbolTable> parent): parent(std::move(parent)) {}
+SymbolTable::SymbolTable(Shared<SymbolTable> parent, std::pmr::memory_resource* memory):
+    symbols(memory), parent(std::move(parent)) {}
 
 Shared<SymbolTable> SymbolTable::createChild() {
-    auto child = std::make_shared<SymbolTable>(shared_from_this());
+    auto child = std::make_shared<SymbolTable>(shared_from_this(), symbols.get_allocator().resource());
 
     return child;
 }
 
 void SymbolTable::define(const std::string& name, const RuntimeValue& value) {
-    symbols.insert_or_assign(name, value);
+    if (const auto it = symbols.find(std::string_view(name)); it != symbols.end()) {
+        it->second = value;
+        return;
+    }
+    symbols.emplace(std::pmr::string(name, symbols.get_allocator()), value);
 }
 
-RuntimeValue& SymbolTable::resolve(const std::string& name) {
-    if (symbols.contains(name)) {
-        return symbols[name];
+RuntimeValue* SymbolTable::resolve(const std::string& name) {
+    if (const auto it = symbols.find(std::string_view(name)); it != symbols.end()) {
+        return &it->second;
     }
     if (parent) {
         return parent->resolve(name);
     }
-    throw std::runtime_error("[SymbolTable::resolve] Undefined variable: " + name);
+    return nullptr;
 }
 
 FunctionTable::FunctionTable(Shared<FunctionTable> parent): parent(std::move(parent)) {}
@@ -32,17 +37,46 @@ Shared<FunctionTable> FunctionTable::createChild() {
     return child;
 }
 
-void FunctionTable::define(const Shared<FunctionNode>& node, size_t address) {
-    defs.insert_or_assign(node->name, node);
-    addresses.insert_or_assign(node->name, address);
+uint32_t FunctionTable::define(const Shared<FunctionNode>& node, size_t address, size_t frameSize) {
+    if (address > UINT32_MAX || node->parameters.size() > UINT16_MAX || frameSize > UINT16_MAX) {
+        throw std::runtime_error("[FunctionTable::define] Function too large: " + node->name);
+    }
+
+    const FunctionDescriptor descriptor = {
+        static_cast<uint32_t>(address),
+        static_cast<uint16_t>(node->parameters.size()),
+        static_cast<uint16_t>(frameSize),
+    };
+
+    // Redefining a function replaces it in place so already linked call sites follow along
+    auto [it, inserted] = indices.try_emplace(node->name, static_cast<uint32_t>(descriptors.size()));
+    if (inserted) {
+        descriptors.push_back(descriptor);
+        defs.push_back(node);
+    } else {
+        descriptors[it->second] = descriptor;
+        defs[it->second] = node;
+    }
+
+    return it->second;
+}
+
+bool FunctionTable::lookup(const std::string& funcName, uint32_t& outIndex) const {
+    const auto it = indices.find(funcName);
+    if (it == indices.end())
+        return false;
+
+    outIndex = it->second;
+    return true;
 }
 
 bool FunctionTable::resolve(const std::string& funcName, Shared<FunctionNode>& outNode, size_t& outAddress) {
-    if (!defs.contains(funcName))
+    uint32_t index;
+    if (!lookup(funcName, index))
         return false;
 
-    outNode = defs[funcName];
-    outAddress = addresses[funcName];
+    outNode = defs[index];
+    outAddress = descriptors[index].address;
 
     return true;
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <memory_resource>
+#include <unordered_map>
+
 #include "Common.h"
 #include "RuntimeValue.h"
 
@@ -7,31 +10,66 @@ class FunctionNode;
 
 class SymbolTable : public std::enable_shared_from_this<SymbolTable>
 {
-    std::unordered_map<std::string, RuntimeValue> symbols;
+    // Lets names be looked up without building a key in the table's allocator
+    struct NameHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+    };
+
+    using SymbolMap = std::pmr::unordered_map<std::pmr::string, RuntimeValue, NameHash, std::equal_to<>>;
+
+    SymbolMap symbols;
     Shared<SymbolTable> parent;
 
 public:
-    SymbolTable(Shared<SymbolTable> parent = nullptr);
+    // Entries (names included) are allocated from `memory`, children use the same resource
+    SymbolTable(Shared<SymbolTable> parent = nullptr, std::pmr::memory_resource* memory = std::pmr::get_default_resource());
 
     Shared<SymbolTable> createChild();
 
     void define(const std::string& name, const RuntimeValue& value);
-    
-    RuntimeValue& resolve(const std::string& name);
+
+    // Value of `name` in this table or a parent, null if it's undefined
+    RuntimeValue* resolve(const std::string& name);
+
+    const SymbolMap& values() const { return symbols; }
+};
+
+// Everything a call needs to know about a compiled function
+struct FunctionDescriptor
+{
+    // Entry address in the program's bytecode
+    uint32_t address = 0;
+    // Number of parameters, taken from the top of the caller's stack
+    uint16_t arity = 0;
+    // Parameters + locals
+    uint16_t frameSize = 0;
+    // Deepest the operand stack gets above the frame, set by `Compiler::link`
+    uint16_t maxStack = 0;
+    // Type of every value it returns as inferred by the compiler, None if they differ or aren't known
+    ValueType returnType = ValueType::None;
 };
 
 class FunctionTable : public std::enable_shared_from_this<FunctionTable>
 {
     Shared<FunctionTable> parent;
-    std::unordered_map<std::string, Shared<FunctionNode>> defs = {};
-    std::unordered_map<std::string, size_t> addresses = {};
+    std::unordered_map<std::string, uint32_t> indices = {};
+    std::vector<Shared<FunctionNode>> defs = {};
 
 public:
+    // Indexed by the operand of CALL_DIRECT, see `Compiler::link`
+    std::vector<FunctionDescriptor> descriptors = {};
+
     FunctionTable(Shared<FunctionTable> parent = nullptr);
 
     Shared<FunctionTable> createChild();
 
-    void define(const Shared<FunctionNode>& node, size_t address);
+    uint32_t define(const Shared<FunctionNode>& node, size_t address, size_t frameSize);
+
+    bool lookup(const std::string& funcName, uint32_t& outIndex) const;
+
+    const Shared<FunctionNode>& node(uint32_t index) const { return defs[index]; }
 
     bool resolve(const std::string& funcName, Shared<FunctionNode>& outNode, size_t& outAddress);
     bool resolve(const std::string& funcName, size_t& outAddress);
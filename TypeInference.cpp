@@ -0,0 +1,261 @@
+#include "TypeInference.h"
+
+#include "Utils.h"
+
+// Declaring the same name with two different types leaves it unchecked
+static void declare(TypeInference::FunctionTypes& types, const std::string& name, const std::string& typeName) {
+    if (const ValueType type = valueTypeFromName(typeName); type != ValueType::None) {
+        const auto [it, inserted] = types.declared.try_emplace(name, type);
+        if (!inserted && it->second != type) {
+            it->second = ValueType::None;
+        }
+    } else {
+        const auto [it, inserted] = types.structs.try_emplace(name, typeName);
+        if (!inserted && it->second != typeName) {
+            it->second.clear();
+        }
+    }
+}
+
+static void collectDeclaredTypes(const Shared<AstNode>& node, TypeInference::FunctionTypes& types) {
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        for (auto& stmt : n->statements) {
+            collectDeclaredTypes(stmt, types);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        collectDeclaredTypes(n->thenBranch, types);
+        if (n->elseBranch) {
+            collectDeclaredTypes(n->elseBranch, types);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<VariableDeclarationNode>(node)) {
+        declare(types, n->name, n->type->typeName);
+    }
+}
+
+static void collectAssignedValues(const Shared<AstNode>& node, std::unordered_map<std::string, std::vector<Shared<ExprNode>>>& outValues) {
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        for (auto& stmt : n->statements) {
+            collectAssignedValues(stmt, outValues);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        collectAssignedValues(n->thenBranch, outValues);
+        if (n->elseBranch) {
+            collectAssignedValues(n->elseBranch, outValues);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<AssignmentNode>(node)) {
+        if (const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(n->lhs); lhsVar && n->rhs) {
+            outValues[lhsVar->identifier].push_back(n->rhs);
+        }
+    }
+}
+
+static void collectReturnedValues(const Shared<AstNode>& node, std::vector<Shared<ExprNode>>& outValues, bool& outReturnsNone) {
+    if (const auto n = std::dynamic_pointer_cast<BlockNode>(node)) {
+        for (auto& stmt : n->statements) {
+            collectReturnedValues(stmt, outValues, outReturnsNone);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        collectReturnedValues(n->thenBranch, outValues, outReturnsNone);
+        if (n->elseBranch) {
+            collectReturnedValues(n->elseBranch, outValues, outReturnsNone);
+        }
+    } else if (const auto n = std::dynamic_pointer_cast<ReturnStatementNode>(node)) {
+        if (n->expression) {
+            outValues.push_back(n->expression);
+        } else {
+            outReturnsNone = true;
+        }
+    }
+}
+
+void TypeInference::infer(const Shared<ProgramNode>& program) {
+    TIMED_FUNCTION();
+
+    std::vector<Shared<FunctionNode>> nodes;
+    for (auto& stmt : program->statements) {
+        if (const auto n = std::dynamic_pointer_cast<FunctionNode>(stmt)) {
+            definitions[n->name] = n;
+            nodes.push_back(n);
+        }
+    }
+
+    for (auto& node : nodes) {
+        collectDeclarations(node);
+    }
+
+    // Types only ever go from unset to a type to None, so this settles after a few rounds
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& node : nodes) {
+            changed |= update(node);
+        }
+    }
+
+    for (auto& node : nodes) {
+        const FunctionState& state = states.at(node.get());
+        FunctionTypes& types = functions.at(node.get());
+
+        types.returnType = state.returnType.value_or(ValueType::None);
+        for (const auto& [name, type] : state.locals) {
+            if (type.value_or(ValueType::None) != ValueType::None) {
+                types.locals[name] = *type;
+            }
+        }
+    }
+    states.clear();
+}
+
+ValueType TypeInference::returnType(const std::string& name) const {
+    const auto it = definitions.find(name);
+    if (it == definitions.end()) {
+        return ValueType::None;
+    }
+    return functions.at(it->second.get()).returnType;
+}
+
+ValueType TypeInference::typeOf(const Shared<ExprNode>& node, const FunctionTypes& function) const {
+    if (std::dynamic_pointer_cast<IntNode>(node)) return ValueType::Int;
+    if (std::dynamic_pointer_cast<FloatNode>(node)) return ValueType::Float;
+    if (std::dynamic_pointer_cast<BooleanNode>(node)) return ValueType::Bool;
+    if (std::dynamic_pointer_cast<StringNode>(node)) return ValueType::String;
+
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        const auto it = function.locals.find(n->identifier);
+        return it != function.locals.end() ? it->second : ValueType::None;
+    }
+    if (const auto n = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+        ArithmeticOp op;
+        if (!toArithmeticOp(n->op, op)) {
+            return ValueType::None;
+        }
+        return RuntimeValue::ResultType(typeOf(n->left, function), op, typeOf(n->right, function));
+    }
+    if (const auto n = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+        return returnType(n->functionName);
+    }
+    return ValueType::None;
+}
+
+void TypeInference::collectDeclarations(const Shared<FunctionNode>& node) {
+    FunctionTypes& types = functions[node.get()];
+    FunctionState& state = states[node.get()];
+
+    std::unordered_map<std::string, bool> isParameter;
+    for (const auto& [typeName, paramName] : node->parameters) {
+        isParameter[paramName] = true;
+        declare(types, paramName, typeName);
+    }
+    collectDeclaredTypes(node->body, types);
+
+    for (const auto& [typeName, paramName] : node->parameters) {
+        const auto declared = types.declared.find(paramName);
+        if (declared != types.declared.end() && declared->second != ValueType::None) {
+            state.locals[paramName] = declared->second;
+        }
+    }
+
+    // Find locals that get their first value from a top-level statement before anything reads them
+    std::unordered_map<std::string, size_t> readsSoFar;
+    std::unordered_map<std::string, size_t> writesSoFar;
+    for (auto& stmt : node->body->statements) {
+        countVariableReads(stmt, readsSoFar);
+
+        std::string defined;
+        if (const auto n = std::dynamic_pointer_cast<AssignmentNode>(stmt)) {
+            if (const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(n->lhs); lhsVar && n->rhs) {
+                defined = lhsVar->identifier;
+            }
+        } else if (const auto n = std::dynamic_pointer_cast<VariableDeclarationNode>(stmt)) {
+            defined = n->name;
+        }
+
+        // Struct typed locals don't take part, only primitive types are inferred
+        if (!defined.empty() && !isParameter.contains(defined) && !readsSoFar.contains(defined) && !writesSoFar.contains(defined)
+            && !types.structs.contains(defined)) {
+            const auto declared = types.declared.find(defined);
+            if (declared != types.declared.end()) {
+                // Declared locals start out with a value of their type and are checked on every assignment
+                if (declared->second != ValueType::None) {
+                    state.locals[defined] = declared->second;
+                }
+            } else {
+                state.locals[defined] = std::nullopt;
+                state.inferredLocals.push_back(defined);
+            }
+        }
+
+        countVariableWrites(stmt, writesSoFar);
+    }
+
+    collectAssignedValues(node->body, state.assignedValues);
+    collectReturnedValues(node->body, state.returnedValues, state.returnsNone);
+    // Falling off the end of the body returns None
+    state.returnsNone |= !alwaysReturns(node->body);
+}
+
+bool TypeInference::update(const Shared<FunctionNode>& node) {
+    FunctionState& state = states.at(node.get());
+    bool changed = false;
+
+    for (const auto& name : state.inferredLocals) {
+        InferredType type;
+        for (const auto& value : state.assignedValues[name]) {
+            type = join(type, inferredType(value, node.get()));
+        }
+        if (type != state.locals[name]) {
+            state.locals[name] = type;
+            changed = true;
+        }
+    }
+
+    InferredType returnType = state.returnsNone ? InferredType(ValueType::None) : std::nullopt;
+    for (const auto& value : state.returnedValues) {
+        returnType = join(returnType, inferredType(value, node.get()));
+    }
+    if (returnType != state.returnType) {
+        state.returnType = returnType;
+        changed = true;
+    }
+
+    return changed;
+}
+
+TypeInference::InferredType TypeInference::inferredType(const Shared<ExprNode>& node, const FunctionNode* function) const {
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        const FunctionState& state = states.at(function);
+        const auto it = state.locals.find(n->identifier);
+        return it != state.locals.end() ? it->second : InferredType(ValueType::None);
+    }
+    if (const auto n = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
+        ArithmeticOp op;
+        if (!toArithmeticOp(n->op, op)) {
+            return ValueType::None;
+        }
+        const InferredType left = inferredType(n->left, function);
+        const InferredType right = inferredType(n->right, function);
+        if (left == ValueType::None || right == ValueType::None) {
+            return ValueType::None;
+        }
+        if (!left || !right) {
+            return std::nullopt;
+        }
+        return RuntimeValue::ResultType(*left, op, *right);
+    }
+    if (const auto n = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
+        const auto it = definitions.find(n->functionName);
+        if (it == definitions.end()) {
+            return ValueType::None;
+        }
+        return states.at(it->second.get()).returnType;
+    }
+
+    // Literals, anything else has no static type
+    return typeOf(node, FunctionTypes());
+}
+
+TypeInference::InferredType TypeInference::join(const InferredType& lhs, const InferredType& rhs) {
+    if (!lhs) return rhs;
+    if (!rhs) return lhs;
+    return *lhs == *rhs ? lhs : InferredType(ValueType::None);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <optional>
+
+#include "Ast.h"
+#include "Common.h"
+#include "RuntimeValue.h"
+
+// Static types the compiler uses to pick specialized opcodes (ADD_INT, LT_FLOAT, ...).
+//
+// Declared types are taken as given: parameters are checked on entry and declared locals
+// on assignment, see `Compiler`. Other locals and function results are inferred from what's
+// assigned or returned, assuming the best for recursive uses until something contradicts it.
+// A local only gets a type when it's defined by a top-level statement of the function body
+// before anything reads it, so it can't be read while still None.
+class TypeInference
+{
+public:
+    struct FunctionTypes
+    {
+        // Type of every value the function can return, None if they differ or aren't known
+        ValueType returnType = ValueType::None;
+        // Variables with the same known type wherever they're read
+        std::unordered_map<std::string, ValueType> locals;
+        // Declared types of parameters and `int a;` style locals, enforced at run time
+        std::unordered_map<std::string, ValueType> declared;
+        // Struct type names of parameters and `Point p;` style locals, also enforced
+        std::unordered_map<std::string, std::string> structs;
+    };
+
+    void infer(const Shared<ProgramNode>& program);
+
+    const FunctionTypes& function(const FunctionNode* node) const { return functions.at(node); }
+
+    // Return type of whichever function a call to `name` ends up at
+    [[nodiscard]] ValueType returnType(const std::string& name) const;
+
+    // Static type of `node` when evaluated inside `function`
+    [[nodiscard]] ValueType typeOf(const Shared<ExprNode>& node, const FunctionTypes& function) const;
+
+private:
+    // Unset (nullopt) until something is known, the join of two different types is None
+    using InferredType = std::optional<ValueType>;
+
+    struct FunctionState
+    {
+        InferredType returnType;
+        std::unordered_map<std::string, InferredType> locals;
+        // Locals whose type comes from what's assigned to them
+        std::vector<std::string> inferredLocals;
+        std::unordered_map<std::string, std::vector<Shared<ExprNode>>> assignedValues;
+        std::vector<Shared<ExprNode>> returnedValues;
+        bool returnsNone = false;
+    };
+
+    std::unordered_map<const FunctionNode*, FunctionTypes> functions;
+    // Last definition of each name, calls are linked to it
+    std::unordered_map<std::string, Shared<FunctionNode>> definitions;
+
+    std::unordered_map<const FunctionNode*, FunctionState> states;
+
+    void collectDeclarations(const Shared<FunctionNode>& node);
+
+    // One round over `node`, returns whether anything it inferred changed
+    bool update(const Shared<FunctionNode>& node);
+
+    InferredType inferredType(const Shared<ExprNode>& node, const FunctionNode* function) const;
+
+    static InferredType join(const InferredType& lhs, const InferredType& rhs);
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "RuntimeValue.h"
+
+// Faults a running script can stop with. Expanded with `X(name, description)`.
+#define VM_STATUS_LIST(X) \
+    X(Ok, "ok") \
+    /* Operands or a value checked against its declared type don't fit */ \
+    X(TypeMismatch, "type mismatch") \
+    /* Integer division or modulus by zero */ \
+    X(DivisionByZero, "division by zero") \
+    X(UndefinedVariable, "undefined variable") \
+    X(UndefinedFunction, "undefined function") \
+    /* A late-bound call passed a different number of arguments than the callee takes */ \
+    X(ArityMismatch, "arity mismatch") \
+    /* A struct has no field of that name */ \
+    X(UnknownField, "unknown field") \
+    /* A call needed more stack than `MaxValueStackSize`/`MaxRegisterFileSize` */ \
+    X(StackOverflow, "stack overflow") \
+    /* An instruction popped a value the stack didn't have */ \
+    X(StackUnderflow, "stack underflow") \
+    X(InvalidOpcode, "invalid opcode") \
+    /* The program has no `main` to run */ \
+    X(NoMain, "no main function")
+
+enum class VMStatus : uint8_t
+{
+#define VM_STATUS_ENUM(name, description) name,
+    VM_STATUS_LIST(VM_STATUS_ENUM)
+#undef VM_STATUS_ENUM
+};
+
+inline const char* to_string(VMStatus e) {
+    switch (e) {
+#define VM_STATUS_DESCRIPTION(name, description) case VMStatus::name: return description;
+        VM_STATUS_LIST(VM_STATUS_DESCRIPTION)
+#undef VM_STATUS_DESCRIPTION
+        default: return "unknown";
+    }
+}
+
+// Why a run stopped and the instruction it stopped at.
+//
+// Handlers don't throw: they `raise` the status and message and return false, and the
+// dispatch loop leaves through its fault path, which fills in where it happened.
+struct VMError
+{
+    VMStatus status = VMStatus::Ok;
+    std::string message;
+
+    // Name of the failing instruction's opcode, in the bytecode of the VM that ran it
+    const char* opcode = "";
+    uint32_t pc = 0;
+    // Function the instruction belongs to, empty if it ran outside of any function
+    std::string function;
+    // Compiler site that emitted the instruction (`BytecodeInstructionSet::debugContext`), empty if unknown
+    std::string location;
+
+    // Records `status`, always false so handlers can `return error.raise(...)`
+    bool raise(VMStatus newStatus, std::string newMessage) {
+        status = newStatus;
+        message = std::move(newMessage);
+        return false;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const VMError& error) {
+    os << error.message << " (" << to_string(error.status);
+    if (error.opcode[0] != '\0') {
+        os << " at " << error.opcode << ", pc " << error.pc;
+    }
+    if (!error.function.empty()) {
+        os << " in " << error.function;
+    }
+    if (!error.location.empty()) {
+        os << ", emitted by " << error.location;
+    }
+    return os << ")";
+}
+
+// What running a script gives its host: `main`'s return value, or the error that stopped it
+class ExecutionResult
+{
+public:
+    RuntimeValue value;
+    VMError error;
+
+    bool ok() const { return error.status == VMStatus::Ok; }
+};
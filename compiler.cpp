@@ -1,10 +1,27 @@
-#include "Compiler.h"
+#include "compiler.h"
+#include "BytecodeImage.h"
 #include "BytecodeInstructions.h"
+#include "StructLayout.h"
 #include "SymbolTable.h"
 #include "Utils.h"
 
 Compiler::Compiler() {
     functionTable = std::make_shared<FunctionTable>();
+    structLayouts = std::make_shared<StructLayoutTable>();
+}
+
+
+uint32_t FunctionScope::declare(const std::string& name) {
+    return slots.try_emplace(name, static_cast<uint32_t>(slots.size())).first->second;
+}
+
+bool FunctionScope::resolve(const std::string& name, uint32_t& outSlot) const {
+    const auto it = slots.find(name);
+    if (it == slots.end())
+        return false;
+
+    outSlot = it->second;
+    return true;
 }
 
 
@@ -16,7 +33,79 @@ Compiler::Compiler() {
 
 void Compiler::compileProgram(const Shared<ProgramNode>& program) {
     TIMED_FUNCTION();
-    return compileNodeList(program->statements);
+    structLayouts->define(program);
+    types.infer(program);
+    compileNodeList(program->statements);
+    link();
+}
+
+void Compiler::link() {
+    for (auto& instruction : instructions) {
+        if (instruction.opcode != Opcode::CALL_FUNC && instruction.opcode != Opcode::TAIL_CALL)
+            continue;
+
+        uint32_t index;
+        const CallSite& site = instructions.callSite(instruction);
+        if (functionTable->lookup(instructions.calleeName(instruction), index)) {
+            // A direct call trusts the count, the frame would otherwise start in the caller's slots
+            const uint16_t arity = functionTable->descriptors[index].arity;
+            if (arity != site.argumentCount) {
+                throw std::runtime_error(std::format("Function {} takes {} arguments, called with {}", instructions.calleeName(instruction).str(), arity, site.argumentCount));
+            }
+            instruction.opcode = instruction.opcode == Opcode::CALL_FUNC ? Opcode::CALL_DIRECT : Opcode::TAIL_CALL_DIRECT;
+            instruction.operand = index;
+        }
+    }
+
+    for (auto& descriptor : functionTable->descriptors) {
+        descriptor.maxStack = maxStackDepth(descriptor.address);
+    }
+}
+
+void Compiler::save(std::ostream& os) const {
+    BytecodeImage::write(os, instructions, *functionTable, *structLayouts);
+}
+
+uint16_t Compiler::maxStackDepth(uint32_t address) const {
+    // Statements leave the stack as they found it, so every path reaches an instruction at
+    // the same depth and each one only needs to be visited once
+    std::unordered_map<uint32_t, int> depthAt = {{address, 0}};
+    std::vector<uint32_t> pending = {address};
+    int maxDepth = 0;
+
+    while (!pending.empty()) {
+        uint32_t pc = pending.back();
+        pending.pop_back();
+        int depth = depthAt[pc];
+
+        for (;;) {
+            const Instruction& instruction = instructions[pc];
+            depth += stackEffect(instruction.opcode);
+            if (instruction.opcode == Opcode::CALL_DIRECT) {
+                depth -= functionTable->descriptors[instruction.operand].arity;
+            }
+            maxDepth = std::max(maxDepth, depth);
+
+            const Opcode opcode = instruction.opcode;
+            if (opcode == Opcode::JUMP || opcode == Opcode::JUMP_IF_FALSE) {
+                if (depthAt.try_emplace(instruction.operand, depth).second) {
+                    pending.push_back(instruction.operand);
+                }
+            }
+            if (opcode == Opcode::JUMP || opcode == Opcode::RETURN || opcode == Opcode::RETURN_VALUE ||
+                opcode == Opcode::TAIL_CALL || opcode == Opcode::TAIL_CALL_DIRECT) {
+                break;
+            }
+            if (!depthAt.try_emplace(++pc, depth).second) {
+                break;
+            }
+        }
+    }
+
+    if (maxDepth > UINT16_MAX) {
+        throw std::runtime_error("[Compiler::maxStackDepth] Expression too deep");
+    }
+    return static_cast<uint16_t>(maxDepth);
 }
 
 void Compiler::compile(const Shared<AstNode>& node) {
@@ -38,22 +127,43 @@ void Compiler::compile(const Shared<AstNode>& node) {
     throw std::runtime_error("Unknown node type");
 }
 
-void Compiler::compileStruct(const Shared<StructNode>& node) {}
+// Layouts of every struct are built up front by `StructLayoutTable::define`, the declaration emits no code
+void Compiler::compileStruct(const Shared<StructNode>&) {}
 
 void Compiler::compileFunction(const Shared<FunctionNode>& node) {
     const size_t startAddress = instructions.size();
 
     // instructions.push(Opcode::PUSH_ARG_COUNT, static_cast<int>(node->parameters.size()));
 
-    // Step 1: Set up parameters in local scope
+    // Step 1: Parameters take the first frame slots, the caller's arguments are bound to them on call
+    scope = std::make_shared<FunctionScope>();
+    functionTypes = &types.function(node.get());
     for (const auto& param : node->parameters) {
-        push_op(STORE_VAR, param.second);
+        const uint32_t slot = scope->declare(param.second);
+
+        // Typed code in the body relies on the declared types, so check what the caller passed
+        const auto it = functionTypes->declared.find(param.second);
+        if (it != functionTypes->declared.end() && it->second != ValueType::None) {
+            push_op(CHECK_LOCAL_TYPE, static_cast<int>(slot << 8 | static_cast<uint32_t>(it->second)));
+        }
+        uint32_t layoutIndex;
+        if (declaredLayout(param.second, layoutIndex)) {
+            push_op(CHECK_LOCAL_STRUCT, static_cast<int>(slot << 16 | layoutIndex));
+        }
     }
 
     // Step 2: Compile the function body
     compileBlock(node->body);
 
-    functionTable->define(node, startAddress);
+    // Falling off the end of the body returns None to the caller
+    if (node->body->statements.empty() || !std::dynamic_pointer_cast<ReturnStatementNode>(node->body->statements.back())) {
+        push_op(RETURN, RuntimeValue());
+    }
+
+    const uint32_t index = functionTable->define(node, startAddress, scope->size());
+    functionTable->descriptors[index].returnType = functionTypes->returnType;
+    scope = nullptr;
+    functionTypes = nullptr;
 }
 
 void Compiler::compileExpression(const Shared<ExprNode>& node) {
@@ -86,8 +196,7 @@ void Compiler::compileExpression(const Shared<ExprNode>& node) {
         return;
     }
     if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
-        push_op(LOAD_VAR, n->identifier);
-        return;
+        return compileLoadVariable(n->identifier);
     }
     if (const auto n = std::dynamic_pointer_cast<BinaryOpNode>(node)) {
         return compileBinaryOp(n);
@@ -95,6 +204,9 @@ void Compiler::compileExpression(const Shared<ExprNode>& node) {
     if (const auto n = std::dynamic_pointer_cast<FunctionCallNode>(node)) {
         return compileFunctionCall(n);
     }
+    if (const auto n = std::dynamic_pointer_cast<MemberAccessNode>(node)) {
+        return compileMemberAccess(n);
+    }
 
     throw std::runtime_error("[compileExpression] Unknown/Unhandled node type: " + std::string(node->name));
 }
@@ -112,12 +224,20 @@ void Compiler::compileStatement(const Shared<StmtNode>& node) {
     if (const auto n = std::dynamic_pointer_cast<ReturnStatementNode>(node)) {
         return compileReturnStatement(n);
     }
+    if (const auto n = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        return compileIfStatement(n);
+    }
     throw std::runtime_error("[compileStatement] Unknown/Unhandled node type: " + std::string(node->name));
 }
 
 void Compiler::compileNodeList(const std::vector<Shared<AstNode>>& nodes) {
     for (auto& stmt : nodes) {
         compile(stmt);
+
+        // An expression used as a statement (e.g. `foo();`) still leaves its value on the stack
+        if (std::dynamic_pointer_cast<ExprNode>(stmt)) {
+            push_op(POP, RuntimeValue());
+        }
     }
 }
 
@@ -130,31 +250,73 @@ void Compiler::compileFunctionCall(const Shared<FunctionCallNode>& node) {
         compile(arg);
     }
 
-    push_op(CALL_FUNC, node->functionName);
+    push_op(CALL_FUNC, static_cast<int>(instructions.addCallSite(node->functionName, static_cast<uint32_t>(node->arguments.size()))));
 }
 
 void Compiler::compileBinaryOp(const Shared<BinaryOpNode>& node) {
     compileExpression(node->left);
     compileExpression(node->right);
 
+    // Both sides known to be ints or floats, use the unchecked version of the operation
+    const ValueType leftType = staticType(node->left);
+    const bool isInt = leftType == ValueType::Int && staticType(node->right) == ValueType::Int;
+    const bool isFloat = leftType == ValueType::Float && staticType(node->right) == ValueType::Float;
+
+#define push_binary_op(op) \
+    if (isInt) { \
+        push_op(op##_INT, RuntimeValue()); \
+    } else if (isFloat) { \
+        push_op(op##_FLOAT, RuntimeValue()); \
+    } else { \
+        push_op(op, RuntimeValue()); \
+    }
+
     switch (node->op) {
         case TokenType::Plus:
         case TokenType::PlusPlus:
-            push_op(ADD, RuntimeValue());
+            push_binary_op(ADD);
             break;
         case TokenType::Minus:
         case TokenType::MinusMinus:
-            push_op(SUB, RuntimeValue());
+            push_binary_op(SUB);
             break;
         case TokenType::Star:
-            push_op(MUL, RuntimeValue());
+            push_binary_op(MUL);
             break;
         case TokenType::Slash:
-            push_op(DIV, RuntimeValue());
+            push_binary_op(DIV);
+            break;
+        case TokenType::Percent:
+            // Float modulus isn't supported at all, it stays a checked MOD that throws
+            if (isInt) {
+                push_op(MOD_INT, RuntimeValue());
+            } else {
+                push_op(MOD, RuntimeValue());
+            }
+            break;
+        case TokenType::EqualsEquals:
+            push_binary_op(EQ);
+            break;
+        case TokenType::NotEquals:
+            push_binary_op(NEQ);
+            break;
+        case TokenType::LessThan:
+            push_binary_op(LT);
+            break;
+        case TokenType::LessThanEquals:
+            push_binary_op(LTE);
+            break;
+        case TokenType::GreaterThan:
+            push_binary_op(GT);
+            break;
+        case TokenType::GreaterThanEquals:
+            push_binary_op(GTE);
             break;
         default:
             throw std::runtime_error("Invalid binary operator: " + std::string(to_string(node->op)));
     }
+
+#undef push_binary_op
 }
 
 void Compiler::compileAssignment(const Shared<AssignmentNode>& node) {
@@ -163,11 +325,27 @@ void Compiler::compileAssignment(const Shared<AssignmentNode>& node) {
         compileExpression(node->rhs);
     }
 
-    // Compile the left-hand side (lhs) expression for member access
+    // Plain variable assignment, inside a function the variable gets a frame slot
+    if (const auto lhsVar = std::dynamic_pointer_cast<VariableNode>(node->lhs)) {
+        if (!scope) {
+            if (node->rhs) {
+                push_op(STORE_VAR, lhsVar->identifier);
+            }
+            return;
+        }
+        const uint32_t slot = scope->declare(lhsVar->identifier);
+        if (node->rhs) {
+            compileTypeGuard(lhsVar->identifier, node->rhs);
+            push_op(STORE_LOCAL, static_cast<int>(slot));
+        }
+        return;
+    }
+
+    // Member assignment, the modified struct is written back to wherever it came from
     if (const auto lhsMemberAccess = std::dynamic_pointer_cast<MemberAccessNode>(node->lhs)) {
-        // Compile nested member access
-        compileMemberAccess(lhsMemberAccess);
-        push_op(STORE_FIELD, lhsMemberAccess->member);
+        if (node->rhs) {
+            compileStoreMember(lhsMemberAccess, node->rhs);
+        }
     }
 
     /*if (auto lhsVar = std::dynamic_pointer_cast<VariableNode>(node->lhs)) {
@@ -183,6 +361,16 @@ void Compiler::compileAssignment(const Shared<AssignmentNode>& node) {
 }
 
 void Compiler::compileReturnStatement(const Shared<ReturnStatementNode>& node) {
+    // `return f(...)` is in tail position: the callee takes over this frame and returns
+    // straight to our caller, so there's no RETURN_VALUE of our own
+    if (const auto call = std::dynamic_pointer_cast<FunctionCallNode>(node->expression)) {
+        for (auto& arg : call->arguments) {
+            compile(arg);
+        }
+        push_op(TAIL_CALL, static_cast<int>(instructions.addCallSite(call->functionName, static_cast<uint32_t>(call->arguments.size()))));
+        return;
+    }
+
     if (node->expression) {
         compileExpression(node->expression);
         push_op(RETURN_VALUE, RuntimeValue());
@@ -191,15 +379,201 @@ void Compiler::compileReturnStatement(const Shared<ReturnStatementNode>& node) {
     }
 }
 
-void Compiler::compileMemberAccess(const Shared<MemberAccessNode>& node) {
-    // Recursively compile nested member access
-    if (const auto nestedMemberAccess = std::dynamic_pointer_cast<MemberAccessNode>(node->object)) {
-        compileMemberAccess(nestedMemberAccess);
-    } else if (const auto varNode = std::dynamic_pointer_cast<VariableNode>(node->object)) {
-        push_op(LOAD_VAR, varNode->identifier);
+void Compiler::compileIfStatement(const Shared<IfStatementNode>& node) {
+    compileExpression(node->condition);
+
+    const size_t jumpToElse = instructions.size();
+    push_op(JUMP_IF_FALSE, 0);
+    compileBlock(node->thenBranch);
+
+    if (node->elseBranch) {
+        const size_t jumpToEnd = instructions.size();
+        push_op(JUMP, 0);
+
+        instructions[jumpToElse].operand = static_cast<uint32_t>(instructions.size());
+        compileBlock(node->elseBranch);
+        instructions[jumpToEnd].operand = static_cast<uint32_t>(instructions.size());
+    } else {
+        instructions[jumpToElse].operand = static_cast<uint32_t>(instructions.size());
     }
+}
 
+void Compiler::compileMemberAccess(const Shared<MemberAccessNode>& node) {
+    // Fields of a struct whose layout is known are loaded by index
+    if (const StructLayout* layout = staticLayout(node->object)) {
+        const uint32_t index = fieldIndex(*layout, node->member);
+        // Reading a local's field directly keeps the struct from being marked as shared
+        uint32_t slot;
+        const auto varNode = std::dynamic_pointer_cast<VariableNode>(node->object);
+        if (varNode && scope->resolve(varNode->identifier, slot)) {
+            push_op(LOAD_LOCAL_FIELD, static_cast<int>(slot << 16 | index));
+            return;
+        }
+        compileExpression(node->object);
+        push_op(LOAD_FIELD_IDX, static_cast<int>(index));
+        return;
+    }
+    compileExpression(node->object);
     push_op(LOAD_FIELD, node->member);
 }
 
-void Compiler::compileVariableDeclaration(const Shared<VariableDeclarationNode>& node) {}
+void Compiler::compileStoreMember(const Shared<MemberAccessNode>& node, const Shared<ExprNode>& value) {
+    // The new value is on top of the stack, the struct goes above it
+    const StructLayout* layout = staticLayout(node->object);
+    if (!layout) {
+        compileStoreTarget(node->object);
+        push_op(STORE_FIELD, node->member);
+    } else {
+        const uint32_t index = fieldIndex(*layout, node->member);
+        // Struct typed fields keep the layout they're declared with, only the assigned value needs checking
+        const StructLayout* fieldLayout = layout->fieldLayouts[index];
+        if (fieldLayout && value) {
+            const StructLayout* valueLayout = staticLayout(value);
+            if (!valueLayout) {
+                push_op(CHECK_STRUCT, static_cast<int>(indexOfLayout(*fieldLayout)));
+            } else if (valueLayout != fieldLayout) {
+                throw std::runtime_error(std::format("Cannot assign {} to {} field '{}'", valueLayout->name.str(), fieldLayout->name.str(), node->member));
+            }
+        }
+        compileStoreTarget(node->object);
+        push_op(STORE_FIELD_IDX, static_cast<int>(index));
+    }
+
+    // Structs are values, so the modified copy replaces the one it was loaded from
+    if (const auto owner = std::dynamic_pointer_cast<MemberAccessNode>(node->object)) {
+        return compileStoreMember(owner, nullptr);
+    }
+    if (const auto varNode = std::dynamic_pointer_cast<VariableNode>(node->object)) {
+        uint32_t slot;
+        if (scope && scope->resolve(varNode->identifier, slot)) {
+            push_op(STORE_LOCAL, static_cast<int>(slot));
+        } else {
+            push_op(STORE_VAR, varNode->identifier);
+        }
+        return;
+    }
+    // A temporary, e.g. the result of a call
+    push_op(POP, RuntimeValue());
+}
+
+void Compiler::compileStoreTarget(const Shared<ExprNode>& object) {
+    // A local is stored back right after, moving it out leaves the struct unshared so the store doesn't copy it
+    if (const auto varNode = std::dynamic_pointer_cast<VariableNode>(object)) {
+        uint32_t slot;
+        if (scope && scope->resolve(varNode->identifier, slot)) {
+            push_op(TAKE_LOCAL, static_cast<int>(slot));
+            return;
+        }
+    }
+    compileExpression(object);
+}
+
+void Compiler::compileVariableDeclaration(const Shared<VariableDeclarationNode>& node) {
+    uint32_t layoutIndex;
+    const bool isStruct = structLayouts->lookup(node->type->typeName, layoutIndex);
+    // Declarations of unknown types don't hold anything until they're assigned
+    if (!isStruct && valueTypeFromName(node->type->typeName) == ValueType::None) {
+        return;
+    }
+
+    if (node->initializer) {
+        compileExpression(node->initializer);
+    } else if (isStruct) {
+        push_op(NEW_STRUCT, static_cast<int>(layoutIndex));
+    } else {
+        push_op(LOAD_CONST, RuntimeValue(node->type->typeName, {}));
+    }
+
+    if (!scope) {
+        push_op(STORE_VAR, node->name);
+        return;
+    }
+    if (node->initializer) {
+        compileTypeGuard(node->name, node->initializer);
+    }
+    push_op(STORE_LOCAL, static_cast<int>(scope->declare(node->name)));
+}
+
+void Compiler::compileLoadVariable(const std::string& name) {
+    uint32_t slot;
+    if (scope && scope->resolve(name, slot)) {
+        push_op(LOAD_LOCAL, static_cast<int>(slot));
+        return;
+    }
+
+    push_op(LOAD_VAR, name);
+}
+
+void Compiler::compileTypeGuard(const std::string& name, const Shared<ExprNode>& value) {
+    uint32_t layoutIndex;
+    if (declaredLayout(name, layoutIndex)) {
+        const StructLayout& layout = (*structLayouts)[layoutIndex];
+        const StructLayout* valueLayout = staticLayout(value);
+        if (!valueLayout) {
+            push_op(CHECK_STRUCT, static_cast<int>(layoutIndex));
+        } else if (valueLayout != &layout) {
+            throw std::runtime_error(std::format("Cannot assign {} to {} variable '{}'", valueLayout->name.str(), layout.name.str(), name));
+        }
+        return;
+    }
+
+    const auto it = functionTypes->declared.find(name);
+    if (it == functionTypes->declared.end() || it->second == ValueType::None) {
+        return;
+    }
+
+    const ValueType valueType = staticType(value);
+    if (valueType == ValueType::None) {
+        push_op(CHECK_TYPE, static_cast<int>(it->second));
+    } else if (valueType != it->second) {
+        throw std::runtime_error(std::format("Cannot assign {} to {} variable '{}'", to_string(valueType), to_string(it->second), name));
+    }
+}
+
+ValueType Compiler::staticType(const Shared<ExprNode>& node) const {
+    if (!functionTypes) {
+        // Only literals and calls have a type outside of functions
+        return types.typeOf(node, TypeInference::FunctionTypes());
+    }
+    return types.typeOf(node, *functionTypes);
+}
+
+const StructLayout* Compiler::staticLayout(const Shared<ExprNode>& node) const {
+    if (const auto n = std::dynamic_pointer_cast<VariableNode>(node)) {
+        uint32_t slot, layoutIndex;
+        if (scope && scope->resolve(n->identifier, slot) && declaredLayout(n->identifier, layoutIndex)) {
+            return &(*structLayouts)[layoutIndex];
+        }
+        return nullptr;
+    }
+    if (const auto n = std::dynamic_pointer_cast<MemberAccessNode>(node)) {
+        uint32_t index;
+        const StructLayout* layout = staticLayout(n->object);
+        if (layout && layout->fieldIndex(n->member, index)) {
+            return layout->fieldLayouts[index];
+        }
+    }
+    return nullptr;
+}
+
+bool Compiler::declaredLayout(const std::string& name, uint32_t& outIndex) const {
+    if (!functionTypes) {
+        return false;
+    }
+    const auto it = functionTypes->structs.find(name);
+    return it != functionTypes->structs.end() && structLayouts->lookup(it->second, outIndex);
+}
+
+uint32_t Compiler::fieldIndex(const StructLayout& layout, const std::string& member) const {
+    uint32_t index;
+    if (!layout.fieldIndex(member, index)) {
+        throw std::runtime_error(std::format("Struct {} has no field '{}'", layout.name.str(), member));
+    }
+    return index;
+}
+
+uint32_t Compiler::indexOfLayout(const StructLayout& layout) const {
+    uint32_t index;
+    structLayouts->lookup(layout.name, index);
+    return index;
+}
@@ -3,20 +3,56 @@
 #include "Ast.h"
 #include "BytecodeInstructions.h"
 #include "Common.h"
+#include "TypeInference.h"
 
 class FunctionTable;
+class StructLayout;
+class StructLayoutTable;
+
+// Frame slot assignment for the function currently being compiled.
+// Parameters take the first slots, then each new local gets the next one.
+class FunctionScope
+{
+    std::unordered_map<std::string, uint32_t> slots;
+
+public:
+    // Returns the slot for `name`, allocating one if it's new
+    uint32_t declare(const std::string& name);
+
+    bool resolve(const std::string& name, uint32_t& outSlot) const;
+
+    [[nodiscard]] size_t size() const { return slots.size(); }
+};
 
 class Compiler
 {
 public:
     Shared<FunctionTable> functionTable = {};
 
+    Shared<StructLayoutTable> structLayouts = {};
+
     BytecodeInstructionSet instructions = {};
 
+    // Scope of the function being compiled, null at the top level
+    Shared<FunctionScope> scope = nullptr;
+
+    TypeInference types;
+    // Types of the function being compiled, null at the top level
+    const TypeInference::FunctionTypes* functionTypes = nullptr;
+
     Compiler();
 
 
     void compileProgram(const Shared<ProgramNode>& program);
+
+    // Binds call sites to function descriptors once every function has an address:
+    // CALL_FUNC/TAIL_CALL become CALL_DIRECT/TAIL_CALL_DIRECT where the callee is known,
+    // unknown names stay late bound. Also sets each function's `maxStack`.
+    void link();
+
+    // Writes the linked program in `BytecodeImage`'s format, loading it skips the whole frontend
+    void save(std::ostream& os) const;
+
     void compile(const Shared<AstNode>& node);
 
     void compileStruct(const Shared<StructNode>& node);
@@ -39,9 +75,46 @@ public:
 
     void compileReturnStatement(const Shared<ReturnStatementNode>& node);
 
+    void compileIfStatement(const Shared<IfStatementNode>& node);
+
     void compileMemberAccess(const Shared<MemberAccessNode>& node);
 
+    // Stores the value on top of the stack (computed from `value`, null if it has no
+    // static layout) into `node`, writing modified struct copies back to their owner
+    void compileStoreMember(const Shared<MemberAccessNode>& node, const Shared<ExprNode>& value);
+
+    // Pushes the struct a member store writes to
+    void compileStoreTarget(const Shared<ExprNode>& object);
+
     void compileVariableDeclaration(const Shared<VariableDeclarationNode>& node);
 
+    // Emits a load of `name`: LOAD_LOCAL when it's a slot of the current function, LOAD_VAR otherwise
+    void compileLoadVariable(const std::string& name);
+
+    // Emits a CHECK_TYPE before a store of `value` to `name` when `name` has a declared
+    // type and `value` isn't known to have it, throws if it's known not to
+    void compileTypeGuard(const std::string& name, const Shared<ExprNode>& value);
+
+    // Type `node` is known to have in the current function, None if it isn't known
+    [[nodiscard]] ValueType staticType(const Shared<ExprNode>& node) const;
+
+    // Layout of the struct `node` is known to evaluate to, null if it isn't known
+    [[nodiscard]] const StructLayout* staticLayout(const Shared<ExprNode>& node) const;
+
+    // Layout `name` is declared with in the current function, e.g. `Point p`
+    bool declaredLayout(const std::string& name, uint32_t& outIndex) const;
+
+private:
+    // Index of `member` in `layout`, throws if there's no such field
+    uint32_t fieldIndex(const StructLayout& layout, const std::string& member) const;
+
+    uint32_t indexOfLayout(const StructLayout& layout) const;
+
+    // Deepest the operand stack gets in the function starting at `address`, follows every
+    // path through its linked bytecode
+    uint16_t maxStackDepth(uint32_t address) const;
+
+public:
+
     // ... methods to compile other types of nodes ...
 };
@@ -1,12 +1,103 @@
+#include <fstream>
+
+#include "AstSimplifier.h"
+#include "Benchmark.h"
+#include "BytecodeImage.h"
+#include "BytecodeOptimizer.h"
 #include "Common.h"
 #include "compiler.h"
+#include "CppTranslator.h"
 #include "Interpreter.h"
+#include "ObjectHeap.h"
 #include "Parser.h"
+#include "RegisterCompiler.h"
+#include "RegisterInterpreter.h"
 #include "Utils.h"
 
-int main() {
+namespace
+{
+    int runInterpreter(Interpreter& interpreter, bool useJit, bool printGcStats) {
+        if (!useJit) {
+            interpreter.jit.reset();
+        }
+        const ExecutionResult result = interpreter.execute();
+        if (printGcStats) {
+            ObjectHeap::printStats(std::cout);
+        }
+        return result.ok() ? 0 : 1;
+    }
+}
+
+// Usage: ScriptingLang [--register] [--dump] [--no-peephole] [--no-simplify] [--no-jit]
+//                     [--gc-stats] [--gc-incremental [budget-us]] [script]
+//        ScriptingLang --emit-cpp output.cpp [--no-peephole] [--no-simplify] [script]
+//        ScriptingLang --save-bytecode output.slbc [--no-peephole] [--no-simplify] [script]
+//        ScriptingLang --load-bytecode program.slbc [--no-jit] [--gc-stats] [--gc-incremental [budget-us]]
+//        ScriptingLang --bench [iterations]
+int main(int argc, char* argv[]) {
     TIMED_FUNCTION();
 
+    bool useRegisterVM = false;
+    bool dumpBytecode = false;
+    bool runPeephole = true;
+    bool runSimplifier = true;
+    bool useJit = true;
+    // Translate to C++ instead of running, see `CppTranslator`
+    std::string cppPath;
+    // Compiled program to write instead of running, or to run instead of a script
+    std::string saveBytecodePath;
+    std::string loadBytecodePath;
+    bool printGcStats = false;
+    ObjectHeap::Config gcConfig;
+    std::string scriptPath;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--register") {
+            useRegisterVM = true;
+        } else if (arg == "--dump") {
+            dumpBytecode = true;
+        } else if (arg == "--no-peephole") {
+            runPeephole = false;
+        } else if (arg == "--no-simplify") {
+            runSimplifier = false;
+        } else if (arg == "--no-jit") {
+            useJit = false;
+        } else if (arg == "--gc-stats") {
+            printGcStats = true;
+        } else if (arg == "--gc-incremental") {
+            gcConfig.incremental = true;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                gcConfig.pauseBudget = std::chrono::microseconds(std::stoul(argv[++i]));
+            }
+        } else if (arg == "--emit-cpp" && i + 1 < argc) {
+            cppPath = argv[++i];
+        } else if (arg == "--save-bytecode" && i + 1 < argc) {
+            saveBytecodePath = argv[++i];
+        } else if (arg == "--load-bytecode" && i + 1 < argc) {
+            loadBytecodePath = argv[++i];
+        } else if (arg == "--bench") {
+            runBenchmarks(i + 1 < argc ? std::stoul(argv[i + 1]) : 5);
+            return 0;
+        } else {
+            scriptPath = arg;
+        }
+    }
+
+    ObjectHeap::configure(gcConfig);
+
+    if (!loadBytecodePath.empty()) {
+        // Already compiled, none of the frontend runs
+        std::unique_ptr<BytecodeImage> image;
+        try {
+            image = std::make_unique<BytecodeImage>(loadBytecodePath);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Could not load bytecode: " << e.what() << std::endl;
+            return 1;
+        }
+        Interpreter interpreter(*image);
+        return runInterpreter(interpreter, useJit, printGcStats);
+    }
+
     std::string code = R"(
         int add(int a, int b) {
             return a + b;
@@ -17,6 +108,16 @@ int main() {
         }
     )";
 
+    if (!scriptPath.empty()) {
+        std::ifstream file(scriptPath);
+        if (!file) {
+            std::cerr << "Could not open script: " << scriptPath << std::endl;
+            return 1;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        code = contents.str();
+    }
 
     /*
     struct Something {
@@ -37,12 +138,63 @@ int main() {
     // parser->dump_info();
     // program->toString(std::cout);
 
+    if (runSimplifier) {
+        AstSimplifier simplifier;
+        simplifier.simplify(program);
+        if (dumpBytecode) {
+            simplifier.dumpStats();
+        }
+    }
+
+    if (useRegisterVM) {
+        RegisterCompiler compiler;
+        compiler.compileProgram(program);
+        if (dumpBytecode) {
+            compiler.instructions.dump();
+        }
+
+        RegisterInterpreter interpreter(compiler);
+        const ExecutionResult result = interpreter.execute();
+        if (printGcStats) {
+            ObjectHeap::printStats(std::cout);
+        }
+        return result.ok() ? 0 : 1;
+    }
+
     Compiler compiler;
     compiler.compileProgram(program);
-    // compiler.instructions.dump();
+    if (runPeephole) {
+        BytecodeOptimizer optimizer;
+        optimizer.optimize(compiler.instructions, *compiler.functionTable);
+        if (dumpBytecode) {
+            optimizer.dumpStats();
+        }
+    }
+    if (dumpBytecode) {
+        compiler.instructions.dump();
+    }
 
-    Interpreter interpreter(compiler);
-    interpreter.execute();
+    if (!cppPath.empty()) {
+        std::ofstream output(cppPath);
+        if (!output) {
+            std::cerr << "Could not write C++ output: " << cppPath << std::endl;
+            return 1;
+        }
+        CppTranslator(compiler.instructions, *compiler.functionTable, *compiler.structLayouts)
+            .translate(output, scriptPath.empty() ? "the built-in script" : scriptPath);
+        return 0;
+    }
 
-    return 0;
+    if (!saveBytecodePath.empty()) {
+        std::ofstream output(saveBytecodePath, std::ios::binary);
+        if (!output) {
+            std::cerr << "Could not write bytecode: " << saveBytecodePath << std::endl;
+            return 1;
+        }
+        compiler.save(output);
+        return 0;
+    }
+
+    Interpreter interpreter(compiler);
+    return runInterpreter(interpreter, useJit, printGcStats);
 }